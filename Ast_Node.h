@@ -6,13 +6,19 @@
 struct Ast_Node;
 
 typedef struct Ast_Declaration {
-    c8 *identifier;
-    c8 *type;
+    c8  *identifier;
+    // Interned type name, array types are spelled [length]element
+    c8  *type;
+    // Loop variables can't be assigned
+    s32  read_only;
 } Ast_Declaration;
 
 typedef struct Ast_Assignment {
-    c8              *identifier;
-    struct Ast_Node *expression;
+    c8               *identifier;
+    // Array elements are assigned as identifier[indices[0]][indices[1]]...
+    struct Ast_Node **indices;
+    struct Ast_Node  *expression;
+    struct Ast_Node  *declaration;
 } Ast_Assignment;
 
 typedef struct Ast_Function_Call {
@@ -25,11 +31,16 @@ typedef struct Ast_Number {
 } Ast_Litteral_Number;
 
 typedef struct Ast_String {
+    // Interned canonical C spelling, see string_literal_value
     c8 *value;
 } Ast_Litteral_String;
 
 typedef struct Ast_Variable {
-    c8 *identifier;
+    c8              *identifier;
+    struct Ast_Node *declaration;
+    // The name's binding while parsing, shared variables are equal only
+    // if it is, 0 for unshared ones
+    s32              binding;
 } Ast_Variable;
 
 typedef struct Ast_Bin_Operator {
@@ -38,10 +49,78 @@ typedef struct Ast_Bin_Operator {
     struct Ast_Node *rhs;
 } Ast_Operator;
 
+typedef struct Ast_Index {
+    struct Ast_Node *array;
+    struct Ast_Node *index;
+} Ast_Index;
+
 typedef struct Ast_Block {
     struct Ast_Node **statements;
 } Ast_Block;
 
+typedef struct Ast_Import {
+    c8               *module;
+    // The module's exported declarations, owned by the module
+    struct Ast_Node **declarations;
+} Ast_Import;
+
+/*
+ * if, then any elifs, share one node: blocks[i] runs when conditions[i]
+ * is the first condition to hold
+ */
+typedef struct Ast_If {
+    struct Ast_Node **conditions;
+    struct Ast_Node **blocks;
+    struct Ast_Node  *else_block;
+} Ast_If;
+
+typedef struct Ast_While {
+    // Null for loop
+    struct Ast_Node *condition;
+    struct Ast_Node *body;
+} Ast_While;
+
+typedef struct Ast_Match_Case {
+    s32 value;
+    // Index into the match's blocks
+    s32 block;
+} Ast_Match_Case;
+
+typedef struct Ast_Match {
+    struct Ast_Node  *expression;
+    struct Ast_Node **blocks;
+    // Every case value of every block, sorted by value
+    Ast_Match_Case   *cases;
+    struct Ast_Node  *default_block;
+} Ast_Match;
+
+/*
+ * each variable : first .. end    counts variable from first up to end
+ * each variable : array           binds variable to every element in turn
+ */
+typedef struct Ast_Each {
+    // N_Declaration, typed by the loop rather than by name
+    struct Ast_Node *variable;
+    // Set for ranges, array is set otherwise
+    struct Ast_Node *first;
+    struct Ast_Node *end;
+    struct Ast_Node *array;
+    struct Ast_Node *body;
+} Ast_Each;
+
+typedef struct Ast_Return {
+    // Null when nothing is returned
+    struct Ast_Node *expression;
+} Ast_Return;
+
+typedef struct Ast_Goto {
+    c8 *label;
+} Ast_Goto;
+
+typedef struct Ast_Label {
+    c8 *identifier;
+} Ast_Label;
+
 typedef struct Ast_Node {
     enum Node_Type {
         N_None = 0,
@@ -53,6 +132,16 @@ typedef struct Ast_Node {
         N_Variable,
         N_Bin_Operator,
         N_Block,
+        N_Error,
+        N_Import,
+        N_If,
+        N_While,
+        N_Match,
+        N_Return,
+        N_Goto,
+        N_Label,
+        N_Index,
+        N_Each,
     }Node_Type;
 
     union {
@@ -64,12 +153,27 @@ typedef struct Ast_Node {
         struct Ast_Variable      variable;
         struct Ast_Bin_Operator  bin_operator;
         struct Ast_Block         block;
+        struct Ast_Import        import;
+        struct Ast_If            if_statement;
+        struct Ast_While         while_statement;
+        struct Ast_Match         match;
+        struct Ast_Return        return_statement;
+        struct Ast_Goto          goto_statement;
+        struct Ast_Label         label;
+        struct Ast_Index         index;
+        struct Ast_Each          each;
     };
 
     enum Node_Type type;
+    s32 type_id;
     c8 *file;
     s32 line;
     s32 colm;
+    // Structural hash of hash-consed expressions and of their copies, 0
+    // for other nodes. Hashed nodes may be shared between occurrences:
+    // passes copy one rather than change it for a single occurrence, and
+    // its position is the first occurrence's.
+    u32 hash;
 } Ast_Node;
 
 #endif
@@ -2,7 +2,9 @@
 #ifndef CHAIN_BUFFER_HEADER
 #define CHAIN_BUFFER_HEADER
 
-#define CHAIN_BUFFER_MIN_SIZE 0x100000
+#define CHAIN_BUFFER_MIN_SIZE  0x100000
+// Every push is padded to this, so odd sized strings keep nodes aligned
+#define CHAIN_BUFFER_ALIGNMENT 8
 
 #include <stddef.h>
 
@@ -12,6 +14,21 @@
 void*
 chain_push_psize(void* data, size_t size);
 
+/*
+ * Everything pushed after a mark is released at once by chain_release
+ */
+typedef struct Chain_Mark
+{
+    int    buffer;
+    size_t size;
+} Chain_Mark;
+
+Chain_Mark
+chain_mark();
+
+void
+chain_release(Chain_Mark mark);
+
 #endif /*CHAIN_BUFFER_HEADER*/
 
 #ifdef CHAIN_BUFFER_IMPLEMENTATION
@@ -37,24 +54,45 @@ new_chain_buffer(Chain_Buffer *buffers, size_t min_size)
     return buffers;
 }
 
+static Chain_Buffer *buffers = 0;
+
 void*
 chain_push_psize(void* data, size_t size)
 {
-    static Chain_Buffer *buffers = 0;
-    if(!buffers)
-        buffers = new_chain_buffer(buffers, size);
+    size_t padded_size = (size + CHAIN_BUFFER_ALIGNMENT - 1) & ~(size_t)(CHAIN_BUFFER_ALIGNMENT - 1);
+    if(!sb_count(buffers))
+        buffers = new_chain_buffer(buffers, padded_size);
 
     Chain_Buffer *current = &buffers[sb_count(buffers)-1];
-    if(current->size + size > current->capacity) {
-        buffers = new_chain_buffer(buffers, size);
+    if(current->size + padded_size > current->capacity) {
+        buffers = new_chain_buffer(buffers, padded_size);
         current = &buffers[sb_count(buffers)-1];
     }
 
     if(data) memcpy(current->data + current->size, data, size);
 
     void* result = current->data + current->size;
-    current->size += size;
+    current->size += padded_size;
     return result;
 }
 
+Chain_Mark
+chain_mark()
+{
+    Chain_Mark mark;
+    mark.buffer = sb_count(buffers) - 1;
+    mark.size   = mark.buffer >= 0 ? buffers[mark.buffer].size : 0;
+    return mark;
+}
+
+void
+chain_release(Chain_Mark mark)
+{
+    int keep = mark.buffer >= 0 ? mark.buffer + 1 : 0;
+    for(int i = keep; i < sb_count(buffers); ++i)
+        free(buffers[i].data);
+    if(buffers) stb__sbn(buffers) = keep;
+    if(mark.buffer >= 0) buffers[mark.buffer].size = mark.size;
+}
+
 #endif
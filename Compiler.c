@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Compiler.h"
+#include "stretchy_buffer.h"
+
+#define CHAIN_BUFFER_IMPLEMENTATION
+#include "Chain_Buffer.h"
+
+/*
+ * Line offsets of the last file an error was reported in, so reporting
+ * many errors reads the file once instead of once per error
+ */
+typedef struct Error_Source {
+    c8   *file_name;
+    FILE *file;
+    long *line_starts;
+} Error_Source;
+
+static Error_Source error_source;
+
+static s32
+open_error_source(c8 *file_name)
+{
+    if(error_source.file_name == file_name) return error_source.file != 0;
+
+    if(error_source.file) fclose(error_source.file);
+    sb_free(error_source.line_starts);
+    error_source.file_name   = file_name;
+    error_source.line_starts = 0;
+    error_source.file        = fopen(file_name, "r");
+    if(!error_source.file) return 0;
+
+    c8   buffer[4096];
+    long offset = 0;
+    size_t read;
+    sb_push(error_source.line_starts, 0);
+    while((read = fread(buffer, 1, sizeof(buffer), error_source.file)) > 0) {
+        for(size_t i = 0; i < read; ++i)
+            if(buffer[i] == '\n') sb_push(error_source.line_starts, offset + i + 1);
+        offset += read;
+    }
+    return 1;
+}
+
+void
+emit_error(const c8 *message, c8 *file_name, s32 line, s32 colm)
+{
+    if(!file_name) {
+        fprintf(stderr, "%s\n", message);
+        return;
+    }
+
+    fprintf(stderr, "%s\n\t%s(%i:%i)\n", message, file_name, line, colm);
+
+    const s32 MAX_LINE_LEN = 120;
+    if(colm > MAX_LINE_LEN) {
+        fprintf(stderr, "Error line is too long, not printing\n");
+        return;
+    }
+
+    if(!open_error_source(file_name)) return;
+    if(line < 1 || line > sb_count(error_source.line_starts)) return;
+    fseek(error_source.file, error_source.line_starts[line - 1], SEEK_SET);
+
+    c8 line_buffer[MAX_LINE_LEN];
+    if(!fgets(line_buffer, MAX_LINE_LEN, error_source.file)) return;
+    // A line holding a nul byte prints up to it
+    size_t length = strlen(line_buffer);
+    fprintf(stderr, "%s", line_buffer);
+    if(!length || line_buffer[length - 1] != '\n') fputc('\n', stderr);
+
+    for(s32 i = 0; i < colm - 1; ++i)
+        fputc('~', stderr);
+
+    fprintf(stderr, "^\n");
+}
+
+void
+go_to_line (FILE *file, s32 line)
+{
+    int c;
+    for(s32 i = 0; i < line - 1; ++i) {
+        do c = fgetc(file);
+        while (c != '\n' && c != EOF);
+        if(c == EOF) return;
+    }
+}
+
+s32
+hash_file(c8 *file_name, u64 *hash)
+{
+    FILE *file = fopen(file_name, "rb");
+    if(!file) return 0;
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    u8 *contents = malloc(size ? size : 1);
+    size_t read  = fread(contents, 1, size, file);
+    fclose(file);
+
+    *hash = hash_bytes(contents, read);
+    free(contents);
+    return 1;
+}
@@ -19,4 +19,25 @@ emit_error(const c8 *message, c8 *file, s32 line, s32 colm);
 void
 go_to_line (FILE *file, s32 line);
 
+/*
+ * FNV-1a, used wherever source text or strings need a cheap stable key
+ */
+static inline u64
+hash_bytes(const void *data, u64 size)
+{
+    const u8 *bytes = data;
+    u64 hash = 0xcbf29ce484222325ull;
+    for(u64 i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/*
+ * hash_bytes of a whole file, returns 0 if it can't be read
+ */
+s32
+hash_file(c8 *file_name, u64 *hash);
+
 #endif
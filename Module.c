@@ -0,0 +1,388 @@
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Module.h"
+#include "Parser.h"
+#include "Rope.h"
+#include "Symbol_Table.h"
+#include "Type_Table.h"
+#include "code_emission.h"
+#include "stretchy_buffer.h"
+
+enum Module_State {
+    MODULE_UNLOADED = 0,
+    MODULE_LOADING,
+    MODULE_LOADED,
+    MODULE_FAILED,
+};
+
+typedef struct Source_Stamp {
+    u64 hash;
+    s64 size;
+    s64 mtime;
+} Source_Stamp;
+
+// Every module seen this run, each is loaded at most once
+static Module **modules = 0;
+
+static Module*
+load_module(c8 *importer_file, c8 *name);
+
+/*
+ * Modules live next to the file importing them
+ */
+static c8*
+module_path(const c8 *importer_file, const c8 *name, const c8 *extension)
+{
+    const c8 *slash = strrchr(importer_file, '/');
+    s32 directory_length = slash ? (s32)(slash - importer_file + 1) : 0;
+
+    c8 buffer[4096];
+    snprintf(buffer, sizeof(buffer), "%.*s%s%s", directory_length, importer_file, name, extension);
+    return intern_string(buffer);
+}
+
+static Module*
+find_module(c8 *importer_file, c8 *name)
+{
+    c8 *source_file = module_path(importer_file, name, ".cus");
+    for(s32 i = 0; i < sb_count(modules); ++i)
+        if(modules[i]->source_file == source_file) return modules[i];
+
+    Module *module = calloc(1, sizeof(Module));
+    module->name           = name;
+    module->source_file    = source_file;
+    module->interface_file = module_path(importer_file, name, ".cusi");
+    module->code_file      = module_path(importer_file, name, ".c");
+    sb_push(modules, module);
+    return module;
+}
+
+static s32
+stat_source(c8 *file_name, Source_Stamp *stamp)
+{
+    struct stat info;
+    if(stat(file_name, &info) != 0) return 0;
+    stamp->size  = info.st_size;
+    stamp->mtime = (s64)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+    return 1;
+}
+
+/*
+ * Interface files
+ */
+
+static u32
+add_string(c8 **strings, const c8 *string)
+{
+    u32 offset = sb_count(*strings);
+    size_t length = strlen(string) + 1;
+    memcpy(sb_add(*strings, length), string, length);
+    return offset;
+}
+
+static s32
+write_interface(Module *module, Ast_Node *root, Source_Stamp *stamp)
+{
+    Module_Import_Record      *imports      = 0;
+    Module_Declaration_Record *declarations = 0;
+    c8                        *strings      = 0;
+
+    for(s32 i = 0; i < sb_count(root->block.statements); ++i) {
+        Ast_Node *statement = root->block.statements[i];
+        if(statement->type == N_Import) {
+            Module_Import_Record record = {0};
+            record.name           = add_string(&strings, statement->import.module);
+            record.interface_hash = find_module(module->source_file, statement->import.module)->interface_hash;
+            sb_push(imports, record);
+        }
+        else if(statement->type == N_Declaration) {
+            Module_Declaration_Record record;
+            record.name = add_string(&strings, statement->declaration.identifier);
+            record.type = add_string(&strings, statement->declaration.type);
+            record.line = statement->line;
+            record.colm = statement->colm;
+            sb_push(declarations, record);
+        }
+    }
+
+    Module_Header header = {0};
+    header.magic             = MODULE_INTERFACE_MAGIC;
+    header.version           = MODULE_INTERFACE_VERSION;
+    header.source_hash       = stamp->hash;
+    header.source_size       = stamp->size;
+    header.source_mtime      = stamp->mtime;
+    header.import_count      = sb_count(imports);
+    header.declaration_count = sb_count(declarations);
+    header.string_bytes      = sb_count(strings);
+
+    // Written aside and renamed, so a failed build never leaves half a file
+    c8 temporary_file[4096];
+    snprintf(temporary_file, sizeof(temporary_file), "%s.tmp", module->interface_file);
+
+    s32 written = 0;
+    FILE *file = fopen(temporary_file, "wb");
+    if(file) {
+        written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  fwrite(imports, sizeof(*imports), header.import_count, file) == header.import_count &&
+                  fwrite(declarations, sizeof(*declarations), header.declaration_count, file) == header.declaration_count &&
+                  fwrite(strings, 1, header.string_bytes, file) == header.string_bytes;
+        written = (fclose(file) == 0) && written;
+        written = written && rename(temporary_file, module->interface_file) == 0;
+        if(!written) remove(temporary_file);
+    }
+
+    sb_free(imports);
+    sb_free(declarations);
+    sb_free(strings);
+
+    if(!written) {
+        emit_error("Module: Could not write interface file", module->interface_file, 0, 0);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Returns the header if size bytes of data are a well formed interface
+ */
+static Module_Header*
+check_interface(u8 *data, u64 size)
+{
+    if(size < sizeof(Module_Header)) return 0;
+
+    Module_Header *header = (Module_Header*)data;
+    if(header->magic != MODULE_INTERFACE_MAGIC || header->version != MODULE_INTERFACE_VERSION)
+        return 0;
+
+    u64 expected = sizeof(Module_Header)
+                 + (u64)header->import_count      * sizeof(Module_Import_Record)
+                 + (u64)header->declaration_count * sizeof(Module_Declaration_Record)
+                 + header->string_bytes;
+    if(expected != size) return 0;
+    if(header->string_bytes && data[size - 1] != 0) return 0;
+
+    Module_Import_Record *imports = (Module_Import_Record*)(header + 1);
+    Module_Declaration_Record *declarations = (Module_Declaration_Record*)(imports + header->import_count);
+    for(u32 i = 0; i < header->import_count; ++i)
+        if(imports[i].name >= header->string_bytes) return 0;
+    for(u32 i = 0; i < header->declaration_count; ++i)
+        if(declarations[i].name >= header->string_bytes || declarations[i].type >= header->string_bytes)
+            return 0;
+    return header;
+}
+
+static u8*
+read_interface(Module *module)
+{
+    s32 fd = open(module->interface_file, O_RDONLY);
+    if(fd < 0) return 0;
+
+    struct stat info;
+    u8 *data = 0;
+    if(fstat(fd, &info) == 0) {
+        data = malloc(info.st_size ? info.st_size : 1);
+        if(read(fd, data, info.st_size) != info.st_size || !check_interface(data, info.st_size)) {
+            free(data);
+            data = 0;
+        }
+    }
+    close(fd);
+    return data;
+}
+
+static s32
+interface_is_current(Module *module, u8 *data)
+{
+    Module_Header *header = (Module_Header*)data;
+
+    Source_Stamp stamp;
+    if(!stat_source(module->source_file, &stamp)) return 0;
+    if(stamp.size != header->source_size || stamp.mtime != header->source_mtime) {
+        if(!hash_file(module->source_file, &stamp.hash) || stamp.hash != header->source_hash)
+            return 0;
+
+        // Touched but unchanged, store the new time so it isn't hashed
+        // again. Failing to only costs another hash next time.
+        header->source_size  = stamp.size;
+        header->source_mtime = stamp.mtime;
+        s32 fd = open(module->interface_file, O_WRONLY);
+        if(fd >= 0) {
+            pwrite(fd, header, sizeof(*header), 0);
+            close(fd);
+        }
+    }
+
+    Module_Import_Record *imports = (Module_Import_Record*)(header + 1);
+    c8 *strings = (c8*)data + (sizeof(Module_Header)
+                + header->import_count      * sizeof(Module_Import_Record)
+                + header->declaration_count * sizeof(Module_Declaration_Record));
+    for(u32 i = 0; i < header->import_count; ++i) {
+        Module *dependency = load_module(module->source_file, intern_string(strings + imports[i].name));
+        if(dependency->state != MODULE_LOADED || dependency->interface_hash != imports[i].interface_hash)
+            return 0;
+    }
+    return 1;
+}
+
+static u64
+combine_hash(u64 hash, const c8 *string)
+{
+    return (hash ^ hash_bytes(string, strlen(string) + 1)) * 0x100000001b3ull;
+}
+
+static void
+unpack_interface(Module *module, u8 *data)
+{
+    Module_Header *header = (Module_Header*)data;
+    Module_Import_Record *imports = (Module_Import_Record*)(header + 1);
+    Module_Declaration_Record *records = (Module_Declaration_Record*)(imports + header->import_count);
+    c8 *strings = (c8*)(records + header->declaration_count);
+
+    module->source_hash    = header->source_hash;
+    module->interface_hash = hash_bytes(0, 0);
+    module->nodes = calloc(header->declaration_count ? header->declaration_count : 1, sizeof(Ast_Node));
+    for(u32 i = 0; i < header->declaration_count; ++i) {
+        Ast_Node *node = &module->nodes[i];
+        node->type                   = N_Declaration;
+        node->declaration.identifier = intern_string(strings + records[i].name);
+        node->declaration.type       = intern_string(strings + records[i].type);
+        node->file                   = module->source_file;
+        node->line                   = records[i].line;
+        node->colm                   = records[i].colm;
+        sb_push(module->declarations, node);
+
+        module->interface_hash = combine_hash(module->interface_hash, node->declaration.identifier);
+        module->interface_hash = combine_hash(module->interface_hash, node->declaration.type);
+    }
+}
+
+/*
+ * Building
+ */
+
+static s32
+write_module_code(Module *module, Ast_Node *root)
+{
+    FILE *out = fopen(module->code_file, "w");
+    if(!out) {
+        emit_error("Module: Could not write module code", module->code_file, 0, 0);
+        return 1;
+    }
+    emit_module_code(out, root, module->name);
+    fclose(out);
+    return 0;
+}
+
+static s32
+build_module(Module *module)
+{
+    // Stamped before reading, a source edited meanwhile is rebuilt next time
+    Source_Stamp stamp;
+    if(!stat_source(module->source_file, &stamp) || !hash_file(module->source_file, &stamp.hash)) {
+        emit_error("Module: Could not read module source", module->source_file, 0, 0);
+        return 1;
+    }
+
+    Token_Stream stream = {0};
+    tokenize_file(&stream, module->source_file);
+    Ast_Node *root = parse_stream(&stream);
+    sb_free(stream.tokens);
+
+    s32 errors = stream.error_count;
+    if(!errors) errors += load_imports(root);
+    if(!errors) errors += resolve_names(root);
+    if(!errors) errors += type_check(root);
+    if(!errors) errors += write_module_code(module, root);
+    if(!errors) errors += write_interface(module, root, &stamp);
+    return errors;
+}
+
+static Module*
+load_module(c8 *importer_file, c8 *name)
+{
+    Module *module = find_module(importer_file, name);
+    if(module->state == MODULE_LOADED || module->state == MODULE_FAILED) return module;
+    if(module->state == MODULE_LOADING) {
+        emit_error("Module: Import cycle", module->source_file, 0, 0);
+        module->state = MODULE_FAILED;
+        return module;
+    }
+    module->state = MODULE_LOADING;
+
+    u8 *data = read_interface(module);
+    if(data && !interface_is_current(module, data)) {
+        free(data);
+        data = 0;
+    }
+    if(!data && module->state == MODULE_LOADING && build_module(module) == 0)
+        data = read_interface(module);
+
+    if(data && module->state == MODULE_LOADING) {
+        unpack_interface(module, data);
+        module->state = MODULE_LOADED;
+    }
+    else module->state = MODULE_FAILED;
+    free(data);
+    return module;
+}
+
+s32
+load_import(Ast_Node *import)
+{
+    Module *module = load_module(import->file, import->import.module);
+    if(module->state != MODULE_LOADED) {
+        emit_error("Module: Could not load imported module", import->file, import->line, import->colm);
+        return 1;
+    }
+    import->import.declarations = module->declarations;
+    return 0;
+}
+
+s32
+load_imports(Ast_Node *root)
+{
+    s32 errors = 0;
+    for(s32 i = 0; i < sb_count(root->block.statements); ++i)
+        if(root->block.statements[i]->type == N_Import)
+            errors += load_import(root->block.statements[i]);
+    return errors;
+}
+
+s32
+build_module_file(c8 *source_file)
+{
+    const c8 *slash = strrchr(source_file, '/');
+    const c8 *base  = slash ? slash + 1 : source_file;
+    const c8 *dot   = strrchr(base, '.');
+    u32 length = dot ? (u32)(dot - base) : (u32)strlen(base);
+
+    // The name becomes part of the C init function's name
+    s32 valid = length > 0 && isalpha((uc8)base[0]);
+    for(u32 i = 0; i < length; ++i)
+        valid = valid && (isalnum((uc8)base[i]) || base[i] == '_');
+    if(!valid) {
+        emit_error("Module: Module file names must be identifiers", source_file, 0, 0);
+        return 1;
+    }
+
+    Module *module = find_module(source_file, intern_string_length(base, length));
+    module->state = MODULE_LOADING;
+    s32 errors = build_module(module);
+
+    u8 *data = errors ? 0 : read_interface(module);
+    if(data) {
+        unpack_interface(module, data);
+        module->state = MODULE_LOADED;
+    }
+    else module->state = MODULE_FAILED;
+    free(data);
+    return errors;
+}
@@ -0,0 +1,90 @@
+#ifndef MODULE_H_
+#define MODULE_H_
+
+#include "Ast_Node.h"
+
+/*
+ * Modules
+ * `import name` refers to name.cus next to the importing file. Building a
+ * module writes name.c, holding its globals and init function, and the
+ * binary interface name.cusi:
+ *
+ *     Module_Header
+ *     Module_Import_Record      [import_count]
+ *     Module_Declaration_Record [declaration_count]
+ *     string blob               [string_bytes], nul terminated
+ *
+ * Importers only ever load the interface, with a single read. A module is
+ * rebuilt when the hash of its source changes, or the declarations one of
+ * its imports exports; edits that keep an interface intact don't ripple
+ * to its importers. The source's size and modification time are compared
+ * first so an untouched source is not even hashed.
+ */
+
+#define MODULE_INTERFACE_MAGIC   0x49535543 // "CUSI"
+#define MODULE_INTERFACE_VERSION 1
+
+typedef struct Module_Header {
+    u32 magic;
+    u32 version;
+    u64 source_hash;
+    s64 source_size;
+    s64 source_mtime;
+    u32 import_count;
+    u32 declaration_count;
+    u32 string_bytes;
+    u32 reserved;
+} Module_Header;
+
+typedef struct Module_Import_Record {
+    u32 name;
+    u32 reserved;
+    // Interface hash of the import when this module was built
+    u64 interface_hash;
+} Module_Import_Record;
+
+// Names are offsets into the string blob
+typedef struct Module_Declaration_Record {
+    u32 name;
+    u32 type;
+    s32 line;
+    s32 colm;
+} Module_Declaration_Record;
+
+typedef struct Module {
+    c8        *name;
+    c8        *source_file;
+    c8        *interface_file;
+    c8        *code_file;
+    u64        source_hash;
+    // Hash of the exported names and types only
+    u64        interface_hash;
+    s32        state;
+
+    // Exported declarations, rebuilt from the interface
+    Ast_Node  *nodes;
+    Ast_Node **declarations;
+} Module;
+
+/*
+ * Attaches the exported declarations of the imported module to an N_Import
+ * node, building the module first if it is missing or out of date. Returns
+ * the number of errors.
+ */
+s32
+load_import(Ast_Node *import);
+
+/*
+ * load_import for every import of the outer block
+ */
+s32
+load_imports(Ast_Node *root);
+
+/*
+ * Builds a source file as a module regardless of its interface, returns
+ * the number of errors
+ */
+s32
+build_module_file(c8 *source_file);
+
+#endif
@@ -3,122 +3,1046 @@
  * Parser for simple C-like language
  */
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "Chain_Buffer.h"
 #include "Parser.h"
+#include "Rope.h"
+#include "Symbol_Table.h"
 #include "stretchy_buffer.h"
 
+static Ast_Node*
+new_node(enum Node_Type type, Token *token)
+{
+    Ast_Node *result = chain_reserve(Ast_Node);
+    result->type    = type;
+    result->type_id = 0;
+    result->file    = token->file;
+    result->line    = token->line;
+    result->colm    = token->colm;
+    result->hash    = 0;
+    return result;
+}
+
+/*
+ * Hash-consing
+ * Numbers, strings, variables, and operators and indexing over nothing
+ * else, are pure: structurally equal ones are built once per tree and
+ * shared, keeping the position of their first occurrence. Calls are never
+ * shared, nor is anything containing one. The table indexes nodes in the
+ * chain space, so it is emptied whenever that space is released.
+ *
+ * A variable is only shared once its name is declared in an enclosing
+ * scope, so an undeclared one keeps the position the resolver reports,
+ * and only with the variables bound to the same declaration. The parser
+ * tracks the names alone, streamed declarations are released before the
+ * block ends.
+ *
+ * Where else a shared node is written is kept beside it, see Occurrences.
+ */
+static Ast_Node   **consed_nodes      = 0;
+static u32          consed_slot_count = 0;
+static u32          consed_count      = 0;
+static Symbol_Table declared_names    = {0};
+
+static void
+clear_consed_nodes()
+{
+    free(consed_nodes);
+    consed_nodes      = 0;
+    consed_slot_count = 0;
+    consed_count      = 0;
+}
+
+static void
+clear_declared_names()
+{
+    free_symbol_table(&declared_names);
+    memset(&declared_names, 0, sizeof(declared_names));
+}
+
+static u32
+mix_hash(u32 hash, u64 value)
+{
+    return (u32)(((hash ^ value) * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+u32
+expression_hash(Ast_Node *node)
+{
+    if(node->hash) return node->hash;
+    u32 hash = mix_hash(0x811C9DC5u, node->type);
+    switch(node->type)
+    {
+    case N_Number:   hash = mix_hash(hash, (u32)node->number.value); break;
+    case N_String:   hash = mix_hash(hash, (uintptr_t)node->string.value); break;
+    case N_Variable:
+        hash = mix_hash(hash, (uintptr_t)node->variable.identifier);
+        hash = mix_hash(hash, (u32)node->variable.binding);
+        break;
+    case N_Bin_Operator:
+        hash = mix_hash(hash, node->bin_operator.tag);
+        hash = mix_hash(hash, expression_hash(node->bin_operator.lhs));
+        hash = mix_hash(hash, expression_hash(node->bin_operator.rhs));
+        break;
+    case N_Index:
+        hash = mix_hash(hash, expression_hash(node->index.array));
+        hash = mix_hash(hash, expression_hash(node->index.index));
+        break;
+    default: break;
+    }
+    return hash ? hash : 1;
+}
+
+Ast_Node*
+copy_node(Ast_Node *node)
+{
+    Ast_Node *result = chain_reserve(Ast_Node);
+    *result = *node;
+    return result;
+}
+
+// Children are compared by address, they are consed already
+static s32
+same_structure(Ast_Node *lhs, Ast_Node *rhs)
+{
+    if(lhs->type != rhs->type) return 0;
+    switch(lhs->type)
+    {
+    case N_Number:   return lhs->number.value == rhs->number.value;
+    case N_String:   return lhs->string.value == rhs->string.value;
+    case N_Variable:
+        return lhs->variable.identifier == rhs->variable.identifier
+            && lhs->variable.binding == rhs->variable.binding;
+    case N_Bin_Operator:
+        return lhs->bin_operator.tag == rhs->bin_operator.tag
+            && lhs->bin_operator.lhs == rhs->bin_operator.lhs
+            && lhs->bin_operator.rhs == rhs->bin_operator.rhs;
+    case N_Index:
+        return lhs->index.array == rhs->index.array && lhs->index.index == rhs->index.index;
+    default: return 0;
+    }
+}
+
+static void
+grow_consed_nodes()
+{
+    u32        old_count = consed_slot_count;
+    Ast_Node **old_nodes = consed_nodes;
+    consed_slot_count = old_count ? old_count * 2 : 1024;
+    consed_nodes      = calloc(consed_slot_count, sizeof(Ast_Node*));
+    for(u32 i = 0; i < old_count; ++i) {
+        if(!old_nodes[i]) continue;
+        u32 slot = old_nodes[i]->hash & (consed_slot_count - 1);
+        while(consed_nodes[slot]) slot = (slot + 1) & (consed_slot_count - 1);
+        consed_nodes[slot] = old_nodes[i];
+    }
+    free(old_nodes);
+}
+
+static s32
+children_shared(Ast_Node *node)
+{
+    switch(node->type)
+    {
+    case N_Bin_Operator: return node->bin_operator.lhs->hash && node->bin_operator.rhs->hash;
+    case N_Index:        return node->index.array->hash && node->index.index->hash;
+    default:             return 1;
+    }
+}
+
+static void
+add_occurrence(Ast_Node *node, Ast_Node *prototype);
+
+/*
+ * Returns the shared node equal to prototype, built on the first call. A
+ * prototype with an unshared child is built as is, unshared.
+ */
+static Ast_Node*
+consed_node(Ast_Node *prototype)
+{
+    if(!children_shared(prototype)) return copy_node(prototype);
+
+    if(2 * (consed_count + 1) > consed_slot_count) grow_consed_nodes();
+    u32 hash = expression_hash(prototype);
+    u32 slot = hash & (consed_slot_count - 1);
+    for(; consed_nodes[slot]; slot = (slot + 1) & (consed_slot_count - 1))
+        if(consed_nodes[slot]->hash == hash && same_structure(consed_nodes[slot], prototype)) {
+            add_occurrence(consed_nodes[slot], prototype);
+            return consed_nodes[slot];
+        }
+
+    Ast_Node *result = copy_node(prototype);
+    result->hash = hash;
+    consed_nodes[slot] = result;
+    ++consed_count;
+    return result;
+}
+
+/*
+ * Occurrences
+ * The positions a shared node is written at, in source order, starting
+ * with its own. Statements and calls hold copies of the expressions they
+ * take, each placed at the occurrence it was parsed from, which is taken
+ * out of the list. What is left are the places the node is written inside
+ * other shared nodes. Nodes written once have no entry.
+ */
+typedef struct Occurrence {
+    c8  *file;
+    s32  line;
+    s32  colm;
+} Occurrence;
+
+typedef struct Occurrences {
+    Ast_Node   *node;
+    Occurrence *positions;
+    s32         reported;
+} Occurrences;
+
+static Occurrences *occurrences           = 0;
+// Index + 1 into occurrences
+static s32         *occurrence_slots      = 0;
+static u32          occurrence_slot_count = 0;
+
+static u32
+occurrence_slot(Ast_Node *node)
+{
+    u32 slot = (u32)(((uintptr_t)node >> 3) * 0x9E3779B97F4A7C15ull >> 32) & (occurrence_slot_count - 1);
+    while(occurrence_slots[slot] && occurrences[occurrence_slots[slot] - 1].node != node)
+        slot = (slot + 1) & (occurrence_slot_count - 1);
+    return slot;
+}
+
+static void
+grow_occurrences()
+{
+    s32 *old_slots = occurrence_slots;
+    u32  old_count = occurrence_slot_count;
+    occurrence_slot_count = old_count ? old_count * 2 : 256;
+    occurrence_slots      = calloc(occurrence_slot_count, sizeof(s32));
+    for(u32 i = 0; i < old_count; ++i)
+        if(old_slots[i]) occurrence_slots[occurrence_slot(occurrences[old_slots[i] - 1].node)] = old_slots[i];
+    free(old_slots);
+}
+
+static Occurrences*
+find_occurrences(Ast_Node *node)
+{
+    if(!occurrence_slot_count) return 0;
+    s32 index = occurrence_slots[occurrence_slot(node)];
+    return index ? &occurrences[index - 1] : 0;
+}
+
+static Occurrence
+node_position(Ast_Node *node)
+{
+    Occurrence result = {node->file, node->line, node->colm};
+    return result;
+}
+
+static Occurrences*
+get_occurrences(Ast_Node *node)
+{
+    Occurrences *result = find_occurrences(node);
+    if(result) return result;
+
+    if(2 * (sb_count(occurrences) + 1) > (s32)occurrence_slot_count) grow_occurrences();
+    Occurrences entry = {node, 0, 0};
+    sb_push(entry.positions, node_position(node));
+    sb_push(occurrences, entry);
+    occurrence_slots[occurrence_slot(node)] = sb_count(occurrences);
+    return &sb_last(occurrences);
+}
+
+static void
+add_occurrence(Ast_Node *node, Ast_Node *prototype)
+{
+    sb_push(get_occurrences(node)->positions, node_position(prototype));
+}
+
+static s32
+at_or_after(Occurrence *position, Occurrence *start)
+{
+    return position->line > start->line || (position->line == start->line && position->colm >= start->colm);
+}
+
+/*
+ * Removes and returns the first position of node at or after start. A
+ * node never contains itself, so from the start of an occurrence that is
+ * the occurrence itself.
+ */
+static Occurrence
+take_occurrence(Ast_Node *node, Occurrence start)
+{
+    if(!node->hash) return node_position(node);
+    Occurrences *entry = get_occurrences(node);
+
+    s32 count = sb_count(entry->positions);
+    s32 found = count;
+    while(found > 0 && at_or_after(&entry->positions[found - 1], &start)) --found;
+    if(found == count) return node_position(node);
+
+    Occurrence result = entry->positions[found];
+    memmove(entry->positions + found, entry->positions + found + 1, (count - found - 1) * sizeof(Occurrence));
+    --stb__sbn(entry->positions);
+    return result;
+}
+
+static Ast_Node*
+placed_copy(Ast_Node *node, Occurrence position)
+{
+    Ast_Node *result = copy_node(node);
+    result->file = position.file;
+    result->line = position.line;
+    result->colm = position.colm;
+    return result;
+}
+
+/*
+ * The copy of an expression beginning at start that a statement or call
+ * holds. It stays shared with the copies the resolver may make of it.
+ */
+static Ast_Node*
+held_node(Ast_Node *node, Occurrence start)
+{
+    if(!node->hash) return node;
+    return placed_copy(node, take_occurrence(node, start));
+}
+
+static Ast_Node*
+parse_held_expression(Token_Stream *ts)
+{
+    Token *peek = peek_token(ts);
+    Occurrence start = {peek->file, peek->line, peek->colm};
+    return held_node(parse_expression(ts), start);
+}
+
+void
+emit_node_error(const c8 *message, Ast_Node *node)
+{
+    Occurrences *entry = node->hash ? find_occurrences(node) : 0;
+    if(!entry || !sb_count(entry->positions)) {
+        emit_error(message, node->file, node->line, node->colm);
+        return;
+    }
+    // The same error holds everywhere the node is written
+    if(entry->reported) return;
+    entry->reported = 1;
+    for(s32 i = 0; i < sb_count(entry->positions); ++i)
+        emit_error(message, entry->positions[i].file, entry->positions[i].line, entry->positions[i].colm);
+}
+
+void
+clear_occurrences()
+{
+    for(s32 i = 0; i < sb_count(occurrences); ++i) sb_free(occurrences[i].positions);
+    sb_free(occurrences);
+    free(occurrence_slots);
+    occurrences           = 0;
+    occurrence_slots      = 0;
+    occurrence_slot_count = 0;
+}
+
+static Ast_Node
+prototype_node(enum Node_Type type, Token *token)
+{
+    Ast_Node result = {0};
+    result.type = type;
+    result.file = token->file;
+    result.line = token->line;
+    result.colm = token->colm;
+    return result;
+}
+
+/*
+ * Literals are interned in their canonical spelling, which also gives
+ * streamed tokens, pointing into the source without a terminator, a copy
+ * that outlives the statement
+ */
+static c8*
+string_value(Token *token)
+{
+    return string_literal_value(token->lexeme, token->length);
+}
+
+// A program is a single block, nothing may follow it
+static void
+match_end_of_program(Token_Stream *ts)
+{
+    Token *peek = peek_token(ts);
+    if(peek->tag != tag_eof)
+        syntax_error(ts, "Parser: Unexpected token after the program's block", peek);
+}
 
 Ast_Node*
 parse_stream(Token_Stream *ts)
 {
+    clear_consed_nodes();
+    clear_declared_names();
     Ast_Node *root = parse_block(ts);
+    match_end_of_program(ts);
+    clear_consed_nodes();
+    clear_declared_names();
     return root;
 }
 
+void
+parse_stream_statements(Token_Stream *ts, Statement_Handler handler, void *data)
+{
+    Token opening_bracket = *match_token(ts, tag_lcurlybrack);
+    s32 opened = !ts->panic;
+    clear_consed_nodes();
+    clear_declared_names();
+
+    ++ts->depth;
+    enter_scope(&declared_names);
+    for(;;) {
+        Token *peek = peek_token(ts);
+        if(peek->tag == tag_rcurlybrack) break;
+        if(peek->tag == tag_eof) {
+            if(opened) syntax_error(ts, "Parser: Unmatched curly bracket '{'", &opening_bracket);
+            break;
+        }
+
+        Chain_Mark mark = chain_mark();
+        Ast_Node *statement = parse_statement(ts);
+        handler(data, statement);
+        free_node_buffers(statement);
+        chain_release(mark);
+        clear_consed_nodes();
+        clear_occurrences();
+        discard_consumed_tokens(ts);
+    }
+    clear_declared_names();
+    --ts->depth;
+    match_token(ts, tag_rcurlybrack);
+    match_end_of_program(ts);
+}
+
+void
+free_node_buffers(Ast_Node *node)
+{
+    switch(node->type)
+    {
+    case N_Block:
+        for(s32 i = 0; i < sb_count(node->block.statements); ++i)
+            free_node_buffers(node->block.statements[i]);
+        sb_free(node->block.statements);
+        break;
+    case N_Assignment:
+        for(s32 i = 0; i < sb_count(node->assignment.indices); ++i)
+            free_node_buffers(node->assignment.indices[i]);
+        sb_free(node->assignment.indices);
+        free_node_buffers(node->assignment.expression);
+        break;
+    case N_Index:
+        free_node_buffers(node->index.array);
+        free_node_buffers(node->index.index);
+        break;
+    case N_Each:
+        if(node->each.array) free_node_buffers(node->each.array);
+        else {
+            free_node_buffers(node->each.first);
+            free_node_buffers(node->each.end);
+        }
+        free_node_buffers(node->each.body);
+        break;
+    case N_Function_Call:
+        for(s32 i = 0; i < sb_count(node->function_call.arguments); ++i)
+            free_node_buffers(node->function_call.arguments[i]);
+        sb_free(node->function_call.arguments);
+        break;
+    case N_Bin_Operator:
+        free_node_buffers(node->bin_operator.lhs);
+        free_node_buffers(node->bin_operator.rhs);
+        break;
+    case N_If:
+        for(s32 i = 0; i < sb_count(node->if_statement.blocks); ++i) {
+            free_node_buffers(node->if_statement.conditions[i]);
+            free_node_buffers(node->if_statement.blocks[i]);
+        }
+        if(node->if_statement.else_block) free_node_buffers(node->if_statement.else_block);
+        sb_free(node->if_statement.conditions);
+        sb_free(node->if_statement.blocks);
+        break;
+    case N_While:
+        if(node->while_statement.condition) free_node_buffers(node->while_statement.condition);
+        free_node_buffers(node->while_statement.body);
+        break;
+    case N_Match:
+        free_node_buffers(node->match.expression);
+        for(s32 i = 0; i < sb_count(node->match.blocks); ++i)
+            free_node_buffers(node->match.blocks[i]);
+        if(node->match.default_block) free_node_buffers(node->match.default_block);
+        sb_free(node->match.blocks);
+        sb_free(node->match.cases);
+        break;
+    case N_Return:
+        if(node->return_statement.expression) free_node_buffers(node->return_statement.expression);
+        break;
+    default: break;
+    }
+}
+
 Ast_Node*
 parse_block(Token_Stream *ts)
 {
-    Token *opening_bracket = match_token(ts, tag_lcurlybrack);
-    Ast_Node *result = chain_reserve(Ast_Node);
-    result->type             = N_Block;
+    // Tokens held across a parse are copied, refilling a streamed token
+    // array may move it
+    Token opening_bracket = *match_token(ts, tag_lcurlybrack);
+    s32 opened = !ts->panic;
+    Ast_Node *result = new_node(N_Block, &opening_bracket);
     result->block.statements = 0;
+
+    // A nested block missing its bracket is skipped with the rest of its
+    // statement, it must not claim the enclosing block's closing bracket
+    if(!opened && ts->depth) return result;
+    if(ts->depth >= PARSER_MAX_DEPTH) {
+        syntax_error(ts, "Parser: Blocks nested too deeply", &opening_bracket);
+        return result;
+    }
+
+    ++ts->depth;
+    enter_scope(&declared_names);
     while(peek_token(ts)->tag != tag_rcurlybrack) {
         if(peek_token(ts)->tag == tag_eof) {
-            emit_error("Parser: Unmatched curly bracket '{'",
-                       opening_bracket->file, opening_bracket->line, opening_bracket->colm);
+            if(opened) syntax_error(ts, "Parser: Unmatched curly bracket '{'", &opening_bracket);
+            break;
         }
         Ast_Node *statement = parse_statement(ts);
         sb_push(result->block.statements, statement);
     }
+    leave_scope(&declared_names);
+    --ts->depth;
+    match_token(ts, tag_rcurlybrack);
     return result;
 }
 
+/*
+ * A type name, or [length] repeated before one for arrays. Array types are
+ * named by their spelling without spaces, which the type table parses.
+ */
+static c8*
+parse_type(Token_Stream *ts)
+{
+    c8  buffer[256];
+    s32 used = 0;
+    while(!ts->panic && peek_token(ts)->tag == tag_lsquarebrack) {
+        Token bracket = *eat_token(ts);
+        s32 length = match_token(ts, tag_number)->number;
+        match_token(ts, tag_rsquarebrack);
+        used += snprintf(buffer + used, sizeof(buffer) - used, "[%i]", length);
+        if(used >= (s32)sizeof(buffer) - 64) {
+            syntax_error(ts, "Parser: Too many array dimensions", &bracket);
+            used = 0;
+        }
+    }
+
+    c8 *element = match_token(ts, tag_id)->lexeme;
+    if(!used || ts->panic) return element;
+    snprintf(buffer + used, sizeof(buffer) - used, "%s", element);
+    return intern_string(buffer);
+}
+
 Ast_Node*
 parse_declaration(Token_Stream *ts)
 {
-    Ast_Node *result = chain_reserve(Ast_Node);
-    result->type = N_Declaration;
+    Ast_Node *result = new_node(N_Declaration, peek_token(ts));
     result->declaration.identifier = match_token(ts, tag_id)->lexeme;
+    result->declaration.read_only  = 0;
     match_token(ts, tag_colon);
-    result->declaration.type       = match_token(ts, tag_id)->lexeme;
+    result->declaration.type       = parse_type(ts);
+    declare_name(&declared_names, result->declaration.identifier);
     return result;
 }
 
 Ast_Node*
 parse_assignment(Token_Stream *ts)
 {
-    Ast_Node *result = chain_reserve(Ast_Node);
-    result->type = N_Assignment;
+    Ast_Node *result = new_node(N_Assignment, peek_token(ts));
     result->assignment.identifier  = match_token(ts, tag_id)->lexeme;
+    result->assignment.indices     = 0;
+    result->assignment.declaration = 0;
     match_token(ts, tag_equal);
-    result->assignment.expression  = parse_expression(ts);
+    result->assignment.expression  = parse_held_expression(ts);
     return result;
 }
 
 Ast_Node*
 parse_function_call(Token_Stream *ts)
 {
-    Ast_Node *result = chain_reserve(Ast_Node);
-    result->type = N_Function_Call;
+    Ast_Node *result = new_node(N_Function_Call, peek_token(ts));
     result->function_call.identifier = match_token(ts, tag_id)->lexeme;
     result->function_call.arguments  = 0;
     match_token(ts, tag_lbrack);
-    while(1) {
-        sb_push(result->function_call.arguments, parse_expression(ts));
-        if(peek_token(ts)->tag == tag_comma) {eat_token(ts); continue;}
-        if(peek_token(ts)->tag == tag_rbrack) break;
+    if(ts->depth >= PARSER_MAX_DEPTH) {
+        syntax_error(ts, "Parser: Calls nested too deeply", peek_token(ts));
+        return result;
     }
+
+    ++ts->depth;
+    if(peek_token(ts)->tag != tag_rbrack) {
+        while(!ts->panic) {
+            sb_push(result->function_call.arguments, parse_held_expression(ts));
+            if(peek_token(ts)->tag == tag_comma) {eat_token(ts); continue;}
+            break;
+        }
+    }
+    --ts->depth;
     match_token(ts, tag_rbrack);
     return result;
 }
 
 Ast_Node*
-parse_expression(Token_Stream *ts)
+parse_import(Token_Stream *ts)
 {
-    Token *peek = peek_token(ts);
-    if(peek->tag == tag_id) {
+    Ast_Node *result = new_node(N_Import, peek_token(ts));
+    result->import.declarations = 0;
+    if(ts->depth != 1)
+        syntax_error(ts, "Parser: Imports are only allowed in the outer block", peek_token(ts));
+    match_token(ts, tag_key_import);
+    result->import.module = match_token(ts, tag_id)->lexeme;
+    return result;
+}
+
+static Ast_Node*
+new_bin_operator(enum Tag tag, Ast_Node *lhs, Ast_Node *rhs, Token *token)
+{
+    Ast_Node result = prototype_node(N_Bin_Operator, token);
+    result.bin_operator.tag = tag;
+    result.bin_operator.lhs = lhs;
+    result.bin_operator.rhs = rhs;
+    return consed_node(&result);
+}
+
+static Ast_Node*
+new_number(s32 value, Token *token)
+{
+    Ast_Node result = prototype_node(N_Number, token);
+    result.number.value = value;
+    return consed_node(&result);
+}
+
+s32
+binary_precedence(enum Tag tag)
+{
+    switch(tag)
+    {
+    case tag_or               : return 1;
+    case tag_and              : return 2;
+    case tag_pipe             : return 3;
+    case tag_caret            : return 4;
+    case tag_ampersand        : return 5;
+    case tag_isequal          :
+    case tag_notequal         : return 6;
+    case tag_lessthan         :
+    case tag_lessthanequal    :
+    case tag_greaterthan      :
+    case tag_greaterthanequal : return 7;
+    case tag_lshift           :
+    case tag_rshift           : return 8;
+    case tag_plus             :
+    case tag_minus            : return 9;
+    case tag_astrix           :
+    case tag_slash            :
+    case tag_percent          : return 10;
+    default                   : return 0;
+    }
+}
+
+/*
+ * Indexing nests like the binary operators and shares their bound
+ */
+static Ast_Node*
+parse_indices(Token_Stream *ts, Ast_Node *array)
+{
+    while(!ts->panic && peek_token(ts)->tag == tag_lsquarebrack) {
+        Token bracket = *eat_token(ts);
+        if(++ts->operator_count > PARSER_MAX_OPERATORS) {
+            syntax_error(ts, "Parser: Too many operators in one statement", &bracket);
+            break;
+        }
+        if(ts->depth >= PARSER_MAX_DEPTH) {
+            syntax_error(ts, "Parser: Expression nested too deeply", &bracket);
+            break;
+        }
+
+        Ast_Node result = prototype_node(N_Index, &bracket);
+        result.index.array = array;
+        ++ts->depth;
+        result.index.index = parse_expression(ts);
+        --ts->depth;
+        match_token(ts, tag_rsquarebrack);
+        array = consed_node(&result);
+    }
+    return array;
+}
+
+static Ast_Node*
+parse_operand(Token_Stream *ts)
+{
+    Token peek = *peek_token(ts);
+    if(peek.tag == tag_id) {
         if(lookahead_token(ts, 1)->tag == tag_lbrack) return parse_function_call(ts);
 
-        Ast_Node *result = chain_reserve(Ast_Node);
-        result->type = N_Variable;
-        result->variable.identifier = peek->lexeme;
+        Ast_Node result = prototype_node(N_Variable, &peek);
+        result.variable.identifier  = peek.lexeme;
+        result.variable.declaration = 0;
+        result.variable.binding     = lookup_binding(&declared_names, peek.lexeme);
         eat_token(ts);
-        return result;
+        Ast_Node *variable = result.variable.binding ? consed_node(&result) : copy_node(&result);
+        return parse_indices(ts, variable);
     }
 
-    if(peek->tag == tag_number) {
-        Ast_Node *result = chain_reserve(Ast_Node);
-        result->type = N_Number;
-        result->number.value = peek->number;
+    if(peek.tag == tag_number) {
         eat_token(ts);
-        return result;
+        return new_number(peek.number, &peek);
     }
 
-    if(peek->tag == tag_string) {
-        Ast_Node *result = chain_reserve(Ast_Node);
-        result->type = N_String;
-        result->string.value = peek->lexeme;
+    if(peek.tag == tag_string) {
+        Ast_Node result = prototype_node(N_String, &peek);
+        result.string.value = string_value(&peek);
         eat_token(ts);
-        return result;
+        return consed_node(&result);
+    }
+
+    syntax_error(ts, "Parser: Unexpected token in expression", &peek);
+    return new_node(N_Error, &peek);
+}
+
+static Ast_Node*
+parse_binary(Token_Stream *ts, s32 min_precedence);
+
+/*
+ * -x is parsed as 0 - x and !x as x == 0, so there are no unary nodes,
+ * minus signs in front of numbers are folded into them
+ */
+static Ast_Node*
+parse_unary(Token_Stream *ts)
+{
+    Token peek = *peek_token(ts);
+    if(peek.tag != tag_minus && peek.tag != tag_bang && peek.tag != tag_lbrack)
+        return parse_operand(ts);
+
+    if(peek.tag == tag_minus && lookahead_token(ts, 1)->tag == tag_number) {
+        eat_token(ts);
+        return new_number(-eat_token(ts)->number, &peek);
+    }
+
+    if(ts->depth >= PARSER_MAX_DEPTH) {
+        syntax_error(ts, "Parser: Expression nested too deeply", &peek);
+        return new_node(N_Error, &peek);
     }
 
-    emit_error("Parser: Unexpected token in expression", peek->file, peek->line, peek->colm);
     eat_token(ts);
-    return 0;
+    ++ts->depth;
+    Ast_Node *result;
+    if(peek.tag == tag_lbrack) {
+        result = parse_binary(ts, 1);
+        match_token(ts, tag_rbrack);
+    }
+    else {
+        Ast_Node *operand = parse_unary(ts);
+        Ast_Node *zero    = new_number(0, &peek);
+        result = peek.tag == tag_minus ? new_bin_operator(tag_minus, zero, operand, &peek)
+                                       : new_bin_operator(tag_isequal, operand, zero, &peek);
+    }
+    --ts->depth;
+    return result;
+}
+
+/*
+ * Precedence climbing, operators of equal precedence associate left
+ */
+static Ast_Node*
+parse_binary(Token_Stream *ts, s32 min_precedence)
+{
+    Ast_Node *lhs = parse_unary(ts);
+    while(!ts->panic) {
+        Token op = *peek_token(ts);
+        s32 precedence = binary_precedence(op.tag);
+        if(!precedence || precedence < min_precedence) break;
+
+        if(++ts->operator_count > PARSER_MAX_OPERATORS) {
+            syntax_error(ts, "Parser: Too many operators in one statement", &op);
+            break;
+        }
+        eat_token(ts);
+        Ast_Node *rhs = parse_binary(ts, precedence + 1);
+        lhs = new_bin_operator(op.tag, lhs, rhs, &op);
+    }
+    return lhs;
 }
 
 Ast_Node*
-parse_statement(Token_Stream *ts)
+parse_expression(Token_Stream *ts)
+{
+    return parse_binary(ts, 1);
+}
+
+/*
+ * Statements
+ */
+
+/*
+ * Statements are never shared, a bare expression gets a copy of its own
+ * placed at its start
+ */
+static Ast_Node*
+unshared_node(Ast_Node *node, Occurrence start)
+{
+    if(!node->hash) return node;
+    take_occurrence(node, start);
+    Ast_Node *result = placed_copy(node, start);
+    result->hash = 0;
+    return result;
+}
+
+/*
+ * An expression, or the assignment of an array element, a[i][j] = value
+ */
+static Ast_Node*
+parse_expression_statement(Token_Stream *ts)
+{
+    Token start = *peek_token(ts);
+    Occurrence position = {start.file, start.line, start.colm};
+    Ast_Node *target = parse_expression(ts);
+    if(ts->panic || peek_token(ts)->tag != tag_equal) return unshared_node(target, position);
+
+    s32 count = 0;
+    Ast_Node *root = target;
+    for(; root->type == N_Index; root = root->index.array) ++count;
+    if(!count || root->type != N_Variable) {
+        syntax_error(ts, "Parser: Only variables and array elements can be assigned", &start);
+        return target;
+    }
+
+    Ast_Node *result = new_node(N_Assignment, &start);
+    result->assignment.identifier  = root->variable.identifier;
+    result->assignment.declaration = 0;
+    result->assignment.indices     = 0;
+    sb_add(result->assignment.indices, count);
+    for(Ast_Node *index = target; index->type == N_Index; index = index->index.array)
+        result->assignment.indices[--count] = index;
+
+    // Only the indices remain expressions, from the first bracket on
+    take_occurrence(root, position);
+    for(s32 i = 0; i < sb_count(result->assignment.indices); ++i) {
+        Ast_Node *index = result->assignment.indices[i];
+        position = take_occurrence(index, position);
+        result->assignment.indices[i] = held_node(index->index.index, position);
+    }
+
+    match_token(ts, tag_equal);
+    result->assignment.expression = parse_held_expression(ts);
+    return result;
+}
+
+Ast_Node*
+parse_each(Token_Stream *ts)
+{
+    Ast_Node *result = new_node(N_Each, peek_token(ts));
+    result->each.first = 0;
+    result->each.end   = 0;
+    result->each.array = 0;
+    match_token(ts, tag_key_each);
+
+    Ast_Node *variable = new_node(N_Declaration, peek_token(ts));
+    variable->declaration.identifier = match_token(ts, tag_id)->lexeme;
+    variable->declaration.type       = 0;
+    variable->declaration.read_only  = 1;
+    result->each.variable = variable;
+    match_token(ts, tag_colon);
+
+    Ast_Node *first = parse_held_expression(ts);
+    if(peek_token(ts)->tag == tag_fullstop && lookahead_token(ts, 1)->tag == tag_fullstop) {
+        eat_token(ts);
+        eat_token(ts);
+        result->each.first = first;
+        result->each.end   = parse_held_expression(ts);
+    }
+    else result->each.array = first;
+
+    // The variable is only visible in the body, as for the resolver
+    enter_scope(&declared_names);
+    declare_name(&declared_names, variable->declaration.identifier);
+    result->each.body = parse_block(ts);
+    leave_scope(&declared_names);
+    return result;
+}
+
+Ast_Node*
+parse_if(Token_Stream *ts)
+{
+    Ast_Node *result = new_node(N_If, peek_token(ts));
+    result->if_statement.conditions = 0;
+    result->if_statement.blocks     = 0;
+    result->if_statement.else_block = 0;
+    match_token(ts, tag_key_if);
+
+    for(;;) {
+        sb_push(result->if_statement.conditions, parse_held_expression(ts));
+        sb_push(result->if_statement.blocks,     parse_block(ts));
+        if(ts->panic || peek_token(ts)->tag != tag_key_elif) break;
+        eat_token(ts);
+    }
+    if(!ts->panic && peek_token(ts)->tag == tag_key_else) {
+        eat_token(ts);
+        result->if_statement.else_block = parse_block(ts);
+    }
+    return result;
+}
+
+Ast_Node*
+parse_while(Token_Stream *ts)
 {
+    Ast_Node *result = new_node(N_While, peek_token(ts));
+    result->while_statement.condition = 0;
+    if(eat_token(ts)->tag == tag_key_while)
+        result->while_statement.condition = parse_held_expression(ts);
+    result->while_statement.body = parse_block(ts);
+    return result;
+}
+
+static s32
+parse_case_value(Token_Stream *ts)
+{
+    s32 negative = peek_token(ts)->tag == tag_minus;
+    if(negative) eat_token(ts);
+    s32 value = match_token(ts, tag_number)->number;
+    return negative ? -value : value;
+}
+
+static int
+compare_cases(const void *a, const void *b)
+{
+    const Ast_Match_Case *lhs = a, *rhs = b;
+    if(lhs->value != rhs->value) return lhs->value < rhs->value ? -1 : 1;
+    return lhs->block - rhs->block;
+}
+
+/*
+ * match value {
+ *     1, 2 { ... }
+ *     -1   { ... }
+ *     default { ... }
+ * }
+ */
+Ast_Node*
+parse_match(Token_Stream *ts)
+{
+    Token keyword = *match_token(ts, tag_key_match);
+    Ast_Node *result = new_node(N_Match, &keyword);
+    result->match.blocks        = 0;
+    result->match.cases         = 0;
+    result->match.default_block = 0;
+    result->match.expression    = parse_held_expression(ts);
+
+    Token opening_bracket = *match_token(ts, tag_lcurlybrack);
+    while(!ts->panic) {
+        Token peek = *peek_token(ts);
+        if(peek.tag == tag_rcurlybrack) break;
+        if(peek.tag == tag_eof) {
+            syntax_error(ts, "Parser: Unmatched curly bracket '{'", &opening_bracket);
+            break;
+        }
+
+        if(peek.tag == tag_key_default) {
+            if(result->match.default_block)
+                syntax_error(ts, "Parser: Duplicate default case", &peek);
+            eat_token(ts);
+            result->match.default_block = parse_block(ts);
+            continue;
+        }
+
+        for(;;) {
+            Ast_Match_Case match_case;
+            match_case.value = parse_case_value(ts);
+            match_case.block = sb_count(result->match.blocks);
+            sb_push(result->match.cases, match_case);
+            if(ts->panic || peek_token(ts)->tag != tag_comma) break;
+            eat_token(ts);
+        }
+        sb_push(result->match.blocks, parse_block(ts));
+    }
+    match_token(ts, tag_rcurlybrack);
+
+    s32 case_count = sb_count(result->match.cases);
+    if(case_count) qsort(result->match.cases, case_count, sizeof(Ast_Match_Case), compare_cases);
+    for(s32 i = 1; i < case_count; ++i)
+        if(result->match.cases[i].value == result->match.cases[i - 1].value)
+            syntax_error(ts, "Parser: Duplicate case value in match", &keyword);
+    return result;
+}
+
+Ast_Node*
+parse_return(Token_Stream *ts)
+{
+    Token keyword = *match_token(ts, tag_key_return);
+    Ast_Node *result = new_node(N_Return, &keyword);
+    result->return_statement.expression = 0;
+
+    // Statements end at the end of a line, a value has to start on the
+    // same line as the return
     Token *peek = peek_token(ts);
-    if(peek->tag == tag_lcurlybrack) return parse_block(ts);
+    if(peek->line == keyword.line && peek->tag != tag_rcurlybrack && peek->tag != tag_eof)
+        result->return_statement.expression = parse_held_expression(ts);
+    return result;
+}
 
-    if(peek->tag == tag_id) {
-        if(lookahead_token(ts, 1)->tag == tag_colon)  return parse_declaration  (ts);
-        if(lookahead_token(ts, 1)->tag == tag_equal)  return parse_assignment   (ts);
-        return parse_expression(ts);
+Ast_Node*
+parse_goto(Token_Stream *ts)
+{
+    Ast_Node *result = new_node(N_Goto, peek_token(ts));
+    match_token(ts, tag_key_goto);
+    result->goto_statement.label = match_token(ts, tag_id)->lexeme;
+    return result;
+}
+
+Ast_Node*
+parse_label(Token_Stream *ts)
+{
+    Ast_Node *result = new_node(N_Label, peek_token(ts));
+    match_token(ts, tag_at);
+    result->label.identifier = match_token(ts, tag_id)->lexeme;
+    return result;
+}
+
+Ast_Node*
+parse_statement(Token_Stream *ts)
+{
+    Token peek = *peek_token(ts);
+    Ast_Node *result = 0;
+    ts->operator_count = 0;
+
+    switch(peek.tag)
+    {
+    case tag_lcurlybrack : result = parse_block  (ts); break;
+    case tag_key_import  : result = parse_import (ts); break;
+    case tag_key_if      : result = parse_if     (ts); break;
+    case tag_key_while   :
+    case tag_key_loop    : result = parse_while  (ts); break;
+    case tag_key_each    : result = parse_each   (ts); break;
+    case tag_key_match   : result = parse_match  (ts); break;
+    case tag_key_return  : result = parse_return (ts); break;
+    case tag_key_goto    : result = parse_goto   (ts); break;
+    case tag_at          : result = parse_label  (ts); break;
+    case tag_id:
+        if     (lookahead_token(ts, 1)->tag == tag_colon)  result = parse_declaration  (ts);
+        else if(lookahead_token(ts, 1)->tag == tag_equal)  result = parse_assignment   (ts);
+        else                                               result = parse_expression_statement(ts);
+        break;
+    default:
+        syntax_error(ts, "Parser: Unexpected token in statement", &peek);
+        break;
     }
-    eat_token(ts);
-    emit_error("Parser: Unexpected token in statement", peek->file, peek->line, peek->colm);
-    return 0;
+
+    // Replace whatever was built with an error node and skip to the next
+    // statement, so later errors are still reported
+    if(ts->panic) {
+        result = new_node(N_Error, &peek);
+        synchronize(ts);
+    }
+    return result;
 }
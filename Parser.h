@@ -4,9 +4,62 @@
 #include "Token_Stream.h"
 #include "Ast_Node.h"
 
+#define PARSER_MAX_DEPTH 256
+
+// Binary operators per statement, every operator deepens the expression
+// tree by at most one level
+#define PARSER_MAX_OPERATORS 4096
+
 Ast_Node*
 parse_stream(Token_Stream *stream);
 
+typedef void (*Statement_Handler)(void *data, Ast_Node *statement);
+
+/*
+ * Parses the outer block one statement at a time. Each statement is handed
+ * to handler as soon as it is complete, afterwards its nodes and the
+ * consumed tokens are released, so anything the handler wants to keep has
+ * to be copied out.
+ */
+void
+parse_stream_statements(Token_Stream *stream, Statement_Handler handler, void *data);
+
+/*
+ * Frees the statement and argument lists below node, the nodes themselves
+ * live in the chain buffer
+ */
+void
+free_node_buffers(Ast_Node *node);
+
+/*
+ * Copies node into the chain buffer. A copy of a shared expression keeps
+ * its hash and position, passes that bind or rewrite one occurrence
+ * of it differently work on a copy.
+ */
+Ast_Node*
+copy_node(Ast_Node *node);
+
+/*
+ * Structural hash of an expression, cached for hashed nodes and computed
+ * from the identifiers, values and operators below others
+ */
+u32
+expression_hash(Ast_Node *node);
+
+/*
+ * Reports message at node. A shared node is reported once, at every place
+ * it is written, as the same error holds at each.
+ */
+void
+emit_node_error(const c8 *message, Ast_Node *node);
+
+/*
+ * Forgets where shared nodes are written, for when the chain space they
+ * live in is released
+ */
+void
+clear_occurrences(void);
+
 Ast_Node*
 parse_block(Token_Stream *stream);
 
@@ -16,6 +69,43 @@ parse_declaration(Token_Stream *stream);
 Ast_Node*
 parse_statement(Token_Stream *stream);
 
+Ast_Node*
+parse_import(Token_Stream *stream);
+
+Ast_Node*
+parse_if(Token_Stream *stream);
+
+/*
+ * while and loop, which is a while without a condition
+ */
+Ast_Node*
+parse_while(Token_Stream *stream);
+
+/*
+ * each i : first .. end { } or each element : array { }
+ */
+Ast_Node*
+parse_each(Token_Stream *stream);
+
+Ast_Node*
+parse_match(Token_Stream *stream);
+
+Ast_Node*
+parse_return(Token_Stream *stream);
+
+Ast_Node*
+parse_goto(Token_Stream *stream);
+
+Ast_Node*
+parse_label(Token_Stream *stream);
+
 Ast_Node*
 parse_expression(Token_Stream *stream);
+
+/*
+ * Operators bind tighter the higher their precedence, as in C, 0 for
+ * tokens that aren't binary operators
+ */
+s32
+binary_precedence(enum Tag tag);
 #endif
@@ -2,6 +2,7 @@
 #include <malloc.h>
 
 #include "Rope.h"
+#include "Compiler.h"
 
 typedef struct Rope_Buffer {
   u32                  size;
@@ -10,7 +11,8 @@ typedef struct Rope_Buffer {
   struct Rope_Buffer*  prev;
 } Rope_Buffer;
 
-static Rope_Buffer* text = 0;
+// Each thread fills its own buffers, so lexer threads never contend
+static __thread Rope_Buffer* text = 0;
 
 static void
 new_buff(const u32 min_size) {
@@ -37,13 +39,60 @@ kill_text_buffer() {
 }
 
 c8*
-cache_string(const c8* cstr) {
-  u32 size = (u32)strlen(cstr) + 1;
-  if(size)++size;
-  if(!text || text->curs - text->cstr > text->size - size)
+cache_string_length(const c8* str, u32 length) {
+  u32 size = length + 1;
+  if(!text || text->size - (u32)(text->curs - text->cstr) < size)
     new_buff(size);
-  c8* to_return = strcpy(text->curs, cstr);
+  c8* to_return = text->curs;
+  memcpy(to_return, str, length);
+  to_return[length] = 0;
   text->curs += size;
   return to_return;
 }
 
+c8*
+cache_string(const c8* cstr) {
+  return cache_string_length(cstr, (u32)strlen(cstr));
+}
+
+
+static c8** interned       = 0;
+static u32  interned_count = 0;
+static u32  interned_size  = 0;
+
+static void
+grow_interned() {
+  u32  old_size = interned_size;
+  c8** old      = interned;
+
+  interned_size = old_size ? old_size * 2 : 1024;
+  interned      = calloc(interned_size, sizeof(c8*));
+  for(u32 i = 0; i < old_size; ++i) {
+    if(!old[i]) continue;
+    u32 slot = (u32)hash_bytes(old[i], strlen(old[i])) & (interned_size - 1);
+    while(interned[slot]) slot = (slot + 1) & (interned_size - 1);
+    interned[slot] = old[i];
+  }
+  free(old);
+}
+
+c8*
+intern_string_length(const c8* str, u32 length) {
+  if((interned_count + 1) * 2 > interned_size)
+    grow_interned();
+
+  u32 slot = (u32)hash_bytes(str, length) & (interned_size - 1);
+  while(interned[slot]) {
+    if(strncmp(interned[slot], str, length) == 0 && interned[slot][length] == 0)
+      return interned[slot];
+    slot = (slot + 1) & (interned_size - 1);
+  }
+
+  ++interned_count;
+  return interned[slot] = cache_string_length(str, length);
+}
+
+c8*
+intern_string(const c8* cstr) {
+  return intern_string_length(cstr, (u32)strlen(cstr));
+}
@@ -11,6 +11,20 @@
 c8*
 cache_string(const c8* cstr);
 
+c8*
+cache_string_length(const c8* str, u32 length);
+
+/*
+ * intern
+ * cache a string once, equal strings share a single pointer so they can
+ * be compared and hashed by address. Not thread safe.
+ */
+c8*
+intern_string(const c8* cstr);
+
+c8*
+intern_string_length(const c8* str, u32 length);
+
 void
 kill_text_buffer();
 
@@ -0,0 +1,304 @@
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "Parser.h"
+#include "Symbol_Table.h"
+#include "stretchy_buffer.h"
+
+static u32
+hash_identifier(c8 *identifier)
+{
+    u64 key = (u64)(uintptr_t)identifier;
+    return (u32)((key >> 3) * 0x9E3779B97F4A7C15ull >> 32);
+}
+
+static void
+grow_slots(Symbol_Table *table)
+{
+    free(table->slots);
+    table->slot_count = table->slot_count ? table->slot_count * 2 : 256;
+    table->slots      = calloc(table->slot_count, sizeof(s32));
+
+    u32 mask = table->slot_count - 1;
+    for(s32 i = 0; i < sb_count(table->symbols); ++i) {
+        u32 slot = hash_identifier(table->symbols[i].identifier) & mask;
+        while(table->slots[slot]) slot = (slot + 1) & mask;
+        table->slots[slot] = i + 1;
+    }
+}
+
+static Symbol*
+find_symbol(Symbol_Table *table, c8 *identifier, s32 create)
+{
+    if(!table->slots) {
+        if(!create) return 0;
+        grow_slots(table);
+    }
+
+    u32 mask = table->slot_count - 1;
+    u32 slot = hash_identifier(identifier) & mask;
+    while(table->slots[slot]) {
+        Symbol *symbol = &table->symbols[table->slots[slot] - 1];
+        if(symbol->identifier == identifier) return symbol;
+        slot = (slot + 1) & mask;
+    }
+    if(!create) return 0;
+
+    Symbol symbol;
+    symbol.identifier  = identifier;
+    symbol.declaration = 0;
+    symbol.binding     = 0;
+    symbol.depth       = -1;
+    symbol.label       = 0;
+    sb_push(table->symbols, symbol);
+    table->slots[slot] = sb_count(table->symbols);
+
+    if(sb_count(table->symbols) * 2 > table->slot_count)
+        grow_slots(table);
+    return &sb_last(table->symbols);
+}
+
+void
+enter_scope(Symbol_Table *table)
+{
+    sb_push(table->scopes, sb_count(table->undo_log));
+}
+
+void
+leave_scope(Symbol_Table *table)
+{
+    s32 mark = sb_last(table->scopes);
+    stb__sbn(table->scopes)--;
+
+    for(s32 i = sb_count(table->undo_log) - 1; i >= mark; --i) {
+        Symbol_Undo *undo = &table->undo_log[i];
+        table->symbols[undo->symbol].declaration = undo->declaration;
+        table->symbols[undo->symbol].binding     = undo->binding;
+        table->symbols[undo->symbol].depth       = undo->depth;
+    }
+    if(table->undo_log) stb__sbn(table->undo_log) = mark;
+}
+
+/*
+ * Returns the symbol instead if identifier is already bound in the
+ * current scope
+ */
+static Symbol*
+bind_symbol(Symbol_Table *table, c8 *identifier, Ast_Node *declaration)
+{
+    Symbol *symbol = find_symbol(table, identifier, 1);
+    s32 depth = sb_count(table->scopes);
+    if(symbol->binding && symbol->depth == depth)
+        return symbol;
+
+    Symbol_Undo undo;
+    undo.symbol      = (s32)(symbol - table->symbols);
+    undo.declaration = symbol->declaration;
+    undo.binding     = symbol->binding;
+    undo.depth       = symbol->depth;
+    sb_push(table->undo_log, undo);
+
+    symbol->declaration = declaration;
+    symbol->binding     = ++table->binding_count;
+    symbol->depth       = depth;
+    return 0;
+}
+
+Ast_Node*
+declare_symbol(Symbol_Table *table, Ast_Node *declaration)
+{
+    Symbol *previous = bind_symbol(table, declaration->declaration.identifier, declaration);
+    return previous ? previous->declaration : 0;
+}
+
+s32
+declare_name(Symbol_Table *table, c8 *identifier)
+{
+    return bind_symbol(table, identifier, 0) != 0;
+}
+
+s32
+lookup_binding(Symbol_Table *table, c8 *identifier)
+{
+    Symbol *symbol = find_symbol(table, identifier, 0);
+    return symbol ? symbol->binding : 0;
+}
+
+Ast_Node*
+lookup_symbol(Symbol_Table *table, c8 *identifier)
+{
+    Symbol *symbol = find_symbol(table, identifier, 0);
+    return symbol ? symbol->declaration : 0;
+}
+
+static void
+resolve_error(Symbol_Table *table, const c8 *message, Ast_Node *node)
+{
+    emit_node_error(message, node);
+    ++table->error_count;
+}
+
+/*
+ * Expressions are resolved through the slot holding them: a shared
+ * variable keeps the first declaration it was bound to, an occurrence
+ * bound to another one gets a copy, and so do the shared expressions
+ * above it
+ */
+static void
+resolve_slot(Symbol_Table *table, Ast_Node **slot)
+{
+    Ast_Node *node = *slot;
+    switch(node->type)
+    {
+    case N_Block:
+        enter_scope(table);
+        for(s32 i = 0; i < sb_count(node->block.statements); ++i)
+            resolve_slot(table, &node->block.statements[i]);
+        leave_scope(table);
+        break;
+    case N_Declaration: {
+        Ast_Node *previous = declare_symbol(table, node);
+        if(previous) {
+            resolve_error(table, "Resolver: Duplicate declaration", node);
+            emit_error("Resolver: Previously declared here", previous->file, previous->line, previous->colm);
+        }
+    } break;
+    case N_Import:
+        for(s32 i = 0; i < sb_count(node->import.declarations); ++i)
+            resolve_slot(table, &node->import.declarations[i]);
+        break;
+    case N_Assignment:
+        for(s32 i = 0; i < sb_count(node->assignment.indices); ++i)
+            resolve_slot(table, &node->assignment.indices[i]);
+        resolve_slot(table, &node->assignment.expression);
+        node->assignment.declaration = lookup_symbol(table, node->assignment.identifier);
+        if(!node->assignment.declaration)
+            resolve_error(table, "Resolver: Assignment to undeclared identifier", node);
+        break;
+    case N_Variable: {
+        Ast_Node *declaration = lookup_symbol(table, node->variable.identifier);
+        if(!declaration) resolve_error(table, "Resolver: Undeclared identifier", node);
+        if(node->hash && node->variable.declaration && node->variable.declaration != declaration)
+            *slot = node = copy_node(node);
+        node->variable.declaration = declaration;
+    } break;
+    case N_Function_Call:
+        for(s32 i = 0; i < sb_count(node->function_call.arguments); ++i)
+            resolve_slot(table, &node->function_call.arguments[i]);
+        break;
+    case N_Bin_Operator: {
+        Ast_Node *lhs = node->bin_operator.lhs;
+        Ast_Node *rhs = node->bin_operator.rhs;
+        resolve_slot(table, &lhs);
+        resolve_slot(table, &rhs);
+        if(lhs == node->bin_operator.lhs && rhs == node->bin_operator.rhs) break;
+        if(node->hash) *slot = node = copy_node(node);
+        node->bin_operator.lhs = lhs;
+        node->bin_operator.rhs = rhs;
+    } break;
+    case N_If:
+        for(s32 i = 0; i < sb_count(node->if_statement.blocks); ++i) {
+            resolve_slot(table, &node->if_statement.conditions[i]);
+            resolve_slot(table, &node->if_statement.blocks[i]);
+        }
+        if(node->if_statement.else_block) resolve_slot(table, &node->if_statement.else_block);
+        break;
+    case N_While:
+        if(node->while_statement.condition) resolve_slot(table, &node->while_statement.condition);
+        resolve_slot(table, &node->while_statement.body);
+        break;
+    case N_Match:
+        resolve_slot(table, &node->match.expression);
+        for(s32 i = 0; i < sb_count(node->match.blocks); ++i)
+            resolve_slot(table, &node->match.blocks[i]);
+        if(node->match.default_block) resolve_slot(table, &node->match.default_block);
+        break;
+    case N_Return:
+        if(node->return_statement.expression) resolve_slot(table, &node->return_statement.expression);
+        break;
+    case N_Index: {
+        Ast_Node *array = node->index.array;
+        Ast_Node *index = node->index.index;
+        resolve_slot(table, &array);
+        resolve_slot(table, &index);
+        if(array == node->index.array && index == node->index.index) break;
+        if(node->hash) *slot = node = copy_node(node);
+        node->index.array = array;
+        node->index.index = index;
+    } break;
+    case N_Each:
+        // The range or array is resolved outside the loop variable's scope
+        if(node->each.array) resolve_slot(table, &node->each.array);
+        else {
+            resolve_slot(table, &node->each.first);
+            resolve_slot(table, &node->each.end);
+        }
+        enter_scope(table);
+        resolve_slot(table, &node->each.variable);
+        resolve_slot(table, &node->each.body);
+        leave_scope(table);
+        break;
+    case N_Label: {
+        Symbol *symbol = find_symbol(table, node->label.identifier, 1);
+        if(symbol->label) {
+            Ast_Node *previous = &table->labels[symbol->label - 1];
+            resolve_error(table, "Resolver: Duplicate label", node);
+            emit_error("Resolver: Previously declared here", previous->file, previous->line, previous->colm);
+            break;
+        }
+        sb_push(table->labels, *node);
+        symbol->label = sb_count(table->labels);
+    } break;
+    case N_Goto: {
+        Symbol *symbol = find_symbol(table, node->goto_statement.label, 0);
+        if(!symbol || !symbol->label) sb_push(table->pending_gotos, *node);
+    } break;
+    default: break;
+    }
+}
+
+void
+resolve_node(Symbol_Table *table, Ast_Node *node)
+{
+    resolve_slot(table, &node);
+}
+
+void
+resolve_pending_gotos(Symbol_Table *table)
+{
+    for(s32 i = 0; i < sb_count(table->pending_gotos); ++i) {
+        Ast_Node *node = &table->pending_gotos[i];
+        Symbol *symbol = find_symbol(table, node->goto_statement.label, 0);
+        if(!symbol || !symbol->label)
+            resolve_error(table, "Resolver: Goto to undeclared label", node);
+    }
+    if(table->pending_gotos) stb__sbn(table->pending_gotos) = 0;
+}
+
+s32
+resolve_names(Ast_Node *root)
+{
+    Symbol_Table table = {0};
+    resolve_node(&table, root);
+    resolve_pending_gotos(&table);
+    free_symbol_table(&table);
+    return table.error_count;
+}
+
+void
+free_symbol_table(Symbol_Table *table)
+{
+    free(table->slots);
+    sb_free(table->symbols);
+    sb_free(table->undo_log);
+    sb_free(table->scopes);
+    sb_free(table->labels);
+    sb_free(table->pending_gotos);
+    table->slots         = 0;
+    table->symbols       = 0;
+    table->undo_log      = 0;
+    table->scopes        = 0;
+    table->labels        = 0;
+    table->pending_gotos = 0;
+}
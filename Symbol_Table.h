@@ -0,0 +1,104 @@
+#ifndef SYMBOL_TABLE_H_
+#define SYMBOL_TABLE_H_
+
+#include "Ast_Node.h"
+
+/*
+ * Scoped symbol table
+ *
+ * Identifiers are interned, so the table hashes and compares their
+ * addresses. Every identifier ever declared owns one symbol holding its
+ * innermost visible declaration; shadowing pushes the old binding onto an
+ * undo log which leave_scope rewinds to the mark taken by enter_scope.
+ * Labels are visible in the whole program no matter where they stand, so
+ * they bypass the scopes; gotos are checked once every label is known.
+ */
+
+typedef struct Symbol {
+    c8       *identifier;
+    Ast_Node *declaration;
+    // Numbers the table's bindings in the order they were made, 0 while
+    // the identifier isn't visible
+    s32       binding;
+    s32       depth;
+    // Index + 1 into the table's labels, 0 if no label has this name
+    s32       label;
+} Symbol;
+
+typedef struct Symbol_Undo {
+    s32       symbol;
+    Ast_Node *declaration;
+    s32       binding;
+    s32       depth;
+} Symbol_Undo;
+
+typedef struct Symbol_Table {
+    s32         *slots;
+    s32          slot_count;
+    Symbol      *symbols;
+    Symbol_Undo *undo_log;
+    s32         *scopes;
+    s32          binding_count;
+    s32          error_count;
+
+    // Copies, streamed statements are released before the program ends
+    Ast_Node    *labels;
+    Ast_Node    *pending_gotos;
+} Symbol_Table;
+
+void
+enter_scope(Symbol_Table *table);
+
+void
+leave_scope(Symbol_Table *table);
+
+/*
+ * Returns the declaration already bound in the current scope, if any
+ */
+Ast_Node*
+declare_symbol(Symbol_Table *table, Ast_Node *declaration);
+
+Ast_Node*
+lookup_symbol(Symbol_Table *table, c8 *identifier);
+
+/*
+ * Binds identifier in the current scope without keeping a declaration,
+ * for tables that only track which names are visible and outlive the
+ * nodes. Returns 1 if it was already bound in the current scope.
+ */
+s32
+declare_name(Symbol_Table *table, c8 *identifier);
+
+/*
+ * The innermost visible binding of identifier, unique within the table,
+ * 0 if there is none
+ */
+s32
+lookup_binding(Symbol_Table *table, c8 *identifier);
+
+/*
+ * Links every variable and assignment to its declaration, reports
+ * undeclared and duplicate names into table->error_count. node is a
+ * statement, shared expressions below it are copied where they bind
+ * differently.
+ */
+void
+resolve_node(Symbol_Table *table, Ast_Node *node);
+
+/*
+ * Reports gotos to labels that were never declared, call once every
+ * statement has been resolved
+ */
+void
+resolve_pending_gotos(Symbol_Table *table);
+
+/*
+ * Resolve a whole tree, returns the number of errors
+ */
+s32
+resolve_names(Ast_Node *root);
+
+void
+free_symbol_table(Symbol_Table *table);
+
+#endif
@@ -0,0 +1,127 @@
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "Thread_Pool.h"
+
+typedef struct Thread_Pool {
+    pthread_mutex_t  lock;
+    pthread_cond_t   wake;
+    pthread_cond_t   done;
+    pthread_t       *threads;
+    s32              thread_count;
+
+    // Current batch, guarded by lock except for next_index
+    Parallel_Job     job;
+    void            *data;
+    s32              count;
+    s32              next_index;
+    s32              busy_workers;
+    u32              generation;
+} Thread_Pool;
+
+static Thread_Pool pool = {
+    .lock         = PTHREAD_MUTEX_INITIALIZER,
+    .wake         = PTHREAD_COND_INITIALIZER,
+    .done         = PTHREAD_COND_INITIALIZER,
+    .threads      = 0,
+    .thread_count = 0,
+    .job          = 0,
+    .data         = 0,
+    .count        = 0,
+    .next_index   = 0,
+    .busy_workers = 0,
+    .generation   = 0,
+};
+
+static s32 requested_threads = 0;
+
+static void
+run_jobs(Parallel_Job job, void *data, s32 count)
+{
+    for(;;) {
+        s32 index = __sync_fetch_and_add(&pool.next_index, 1);
+        if(index >= count) break;
+        job(data, index);
+    }
+}
+
+static void*
+worker_main(void *unused)
+{
+    (void)unused;
+    u32 seen = 0;
+    pthread_mutex_lock(&pool.lock);
+    for(;;) {
+        while(pool.generation == seen)
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        seen = pool.generation;
+
+        Parallel_Job job = pool.job;
+        void *data       = pool.data;
+        s32 count        = pool.count;
+        pthread_mutex_unlock(&pool.lock);
+
+        run_jobs(job, data, count);
+
+        pthread_mutex_lock(&pool.lock);
+        if(--pool.busy_workers == 0)
+            pthread_cond_signal(&pool.done);
+    }
+    return 0;
+}
+
+void
+set_thread_count(s32 count)
+{
+    requested_threads = count;
+}
+
+s32
+get_thread_count()
+{
+    if(requested_threads > 0) return requested_threads;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (s32)online : 1;
+}
+
+static void
+start_workers()
+{
+    if(pool.threads) return;
+    pool.thread_count = get_thread_count() - 1;
+    pool.threads = malloc((pool.thread_count + 1) * sizeof(pthread_t));
+    for(s32 i = 0; i < pool.thread_count; ++i)
+        pthread_create(&pool.threads[i], 0, worker_main, 0);
+}
+
+void
+run_parallel(Parallel_Job job, void *data, s32 count)
+{
+    if(count <= 0) return;
+    start_workers();
+
+    if(pool.thread_count == 0 || count == 1) {
+        for(s32 i = 0; i < count; ++i) job(data, i);
+        return;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.job          = job;
+    pool.data         = data;
+    pool.count        = count;
+    pool.next_index   = 0;
+    pool.busy_workers = pool.thread_count;
+    ++pool.generation;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    run_jobs(job, data, count);
+
+    pthread_mutex_lock(&pool.lock);
+    while(pool.busy_workers)
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+}
@@ -0,0 +1,26 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include "types.h"
+
+/*
+ * Persistent worker pool
+ * run_parallel calls job(data, i) for every i in [0, count) spread over
+ * the workers and the calling thread, and returns once all calls are done
+ */
+typedef void (*Parallel_Job)(void *data, s32 index);
+
+void
+run_parallel(Parallel_Job job, void *data, s32 count);
+
+/*
+ * Defaults to the number of online processors, must be set before the
+ * first run_parallel to take effect
+ */
+void
+set_thread_count(s32 count);
+
+s32
+get_thread_count();
+
+#endif
@@ -1,18 +1,109 @@
 
+#define _GNU_SOURCE
 #include <ctype.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "stretchy_buffer.h"
 
 #include "Token_Stream.h"
 #include "Rope.h"
+#include "Thread_Pool.h"
 
-u8
-fpeekc(FILE *file)
+// Inputs smaller than this are lexed on the calling thread
+#define LEXER_PARALLEL_MIN_SIZE  0x100000
+#define LEXER_CHUNK_MIN_SIZE     0x40000
+
+// Streamed sources are lexed this much at a time, rounded up to a line
+#define LEXER_WINDOW_SIZE        0x10000
+
+typedef struct Lexer_Identifier {
+    const c8 *start;
+    u32       length;
+} Lexer_Identifier;
+
+typedef struct Lexer_Error {
+    const c8 *message;
+    s32       line;
+    s32       colm;
+} Lexer_Error;
+
+/*
+ * State for lexing one line aligned chunk of a file. Identifiers are only
+ * interned into a chunk local table while lexing, so chunks never touch
+ * shared state; tokens hold the local index until the chunks are stitched.
+ */
+typedef struct Lexer {
+    const c8         *start;
+    const c8         *end;
+    c8               *file_name;
+    s32               is_last;
+    s32               raw_strings;
+
+    Token            *tokens;
+    Lexer_Error      *errors;
+    s32               line_count;
+
+    Lexer_Identifier *identifiers;
+    c8              **interned;
+    enum Tag         *identifier_tags;
+    s32              *slots;
+    u32               slot_count;
+
+    s32               token_offset;
+    s32               line_offset;
+} Lexer;
+
+typedef struct Keyword {
+    const c8 *name;
+    enum Tag  tag;
+} Keyword;
+
+static const Keyword keywords[] = {
+    { "import",  tag_key_import  },
+    { "if",      tag_key_if      },
+    { "elif",    tag_key_elif    },
+    { "else",    tag_key_else    },
+    { "while",   tag_key_while   },
+    { "each",    tag_key_each    },
+    { "loop",    tag_key_loop    },
+    { "match",   tag_key_match   },
+    { "default", tag_key_default },
+    { "return",  tag_key_return  },
+    { "goto",    tag_key_goto    },
+};
+
+#define KEYWORD_COUNT (s32)(sizeof(keywords) / sizeof(keywords[0]))
+
+static enum Tag
+digraph_tag(uc8 first, uc8 second)
 {
-    u8 result = fgetc(file);
-    ungetc(result, file);
-    return result;
+    switch(first)
+    {
+    case '=': if(second == '=') return tag_isequal;          break;
+    case '!': if(second == '=') return tag_notequal;         break;
+    case '&': if(second == '&') return tag_and;              break;
+    case '|': if(second == '|') return tag_or;               break;
+    case '<':
+        if(second == '=') return tag_lessthanequal;
+        if(second == '<') return tag_lshift;
+        break;
+    case '>':
+        if(second == '=') return tag_greaterthanequal;
+        if(second == '>') return tag_rshift;
+        break;
+    }
+    return tag_none;
 }
 
+typedef struct Lexer_Batch {
+    Lexer *lexers;
+    Token *tokens;
+} Lexer_Batch;
+
 void
 print_token(Token *token)
 {
@@ -24,138 +115,561 @@ print_token(Token *token)
 }
 
 void
-tokenize_file(Token_Stream *stream, c8 *file_name)
+syntax_error(Token_Stream *stream, const c8 *message, Token *token)
 {
-    FILE *file = fopen(file_name, "r");
+    if(stream->panic) return;
+    if(!stream->quiet) emit_error(message, token->file, token->line, token->colm);
+    ++stream->error_count;
+    stream->panic      = 1;
+    stream->panic_line = token->line;
+}
+
+void
+synchronize(Token_Stream *stream)
+{
+    s32 depth = 0;
+    for(;;) {
+        Token *token = peek_token(stream);
+        if(token->tag == tag_eof) break;
+        if(token->line > stream->panic_line && depth == 0) break;
+        if(token->tag == tag_rcurlybrack) {
+            if(depth == 0) break;
+            --depth;
+        }
+        if(token->tag == tag_lcurlybrack) ++depth;
+        eat_token(stream);
+    }
+    stream->panic = 0;
+}
+
+static void
+grow_identifier_slots(Lexer *lexer)
+{
+    free(lexer->slots);
+    lexer->slot_count = lexer->slot_count ? lexer->slot_count * 2 : 1024;
+    lexer->slots      = calloc(lexer->slot_count, sizeof(s32));
+
+    u32 mask = lexer->slot_count - 1;
+    for(s32 i = 0; i < sb_count(lexer->identifiers); ++i) {
+        Lexer_Identifier *identifier = &lexer->identifiers[i];
+        u32 slot = (u32)hash_bytes(identifier->start, identifier->length) & mask;
+        while(lexer->slots[slot]) slot = (slot + 1) & mask;
+        lexer->slots[slot] = i + 1;
+    }
+}
+
+static s32
+local_identifier(Lexer *lexer, const c8 *start, u32 length)
+{
+    if((sb_count(lexer->identifiers) + 1) * 2 > (s32)lexer->slot_count)
+        grow_identifier_slots(lexer);
+
+    u32 mask = lexer->slot_count - 1;
+    u32 slot = (u32)hash_bytes(start, length) & mask;
+    while(lexer->slots[slot]) {
+        Lexer_Identifier *identifier = &lexer->identifiers[lexer->slots[slot] - 1];
+        if(identifier->length == length && memcmp(identifier->start, start, length) == 0)
+            return lexer->slots[slot] - 1;
+        slot = (slot + 1) & mask;
+    }
+
+    Lexer_Identifier identifier;
+    identifier.start  = start;
+    identifier.length = length;
+    sb_push(lexer->identifiers, identifier);
+    lexer->slots[slot] = sb_count(lexer->identifiers);
+    return sb_count(lexer->identifiers) - 1;
+}
+
+static void
+lexer_error(Lexer *lexer, const c8 *message, s32 line, s32 colm)
+{
+    Lexer_Error error;
+    error.message = message;
+    error.line    = line;
+    error.colm    = colm;
+    sb_push(lexer->errors, error);
+}
+
+static s32
+hex_digit(c8 c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
 
+/*
+ * Characters of the escape sequence after a backslash, 0 if it is invalid
+ */
+static u32
+escape_length(const c8 *cursor, const c8 *end)
+{
+    if(*cursor >= '0' && *cursor <= '7') {
+        u32 length = 0;
+        s32 value  = 0;
+        while(length < 3 && cursor + length < end && cursor[length] >= '0' && cursor[length] <= '7')
+            value = value * 8 + cursor[length++] - '0';
+        return value <= 0xFF ? length : 0;
+    }
+
+    switch(*cursor)
+    {
+    case 'n': case 't': case 'r': case 'a': case 'b': case 'f': case 'v':
+    case '\\': case '"': case '\'': case '?':
+        return 1;
+    case 'x':
+        return end - cursor > 2 && hex_digit(cursor[1]) >= 0 && hex_digit(cursor[2]) >= 0 ? 3 : 0;
+    default:
+        return 0;
+    }
+}
+
+u32
+decode_string_literal(const c8 *text, u32 length, c8 *out)
+{
+    u32 result = 0;
+    for(u32 i = 0; i < length; ++i) {
+        if(text[i] != '\\' || i + 1 == length) {
+            out[result++] = text[i];
+            continue;
+        }
+
+        c8 c = text[++i];
+        switch(c)
+        {
+        case 'n': c = '\n'; break;
+        case 't': c = '\t'; break;
+        case 'r': c = '\r'; break;
+        case 'a': c = '\a'; break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'v': c = '\v'; break;
+        case 'x':
+            if(i + 2 < length && hex_digit(text[i+1]) >= 0 && hex_digit(text[i+2]) >= 0) {
+                c = (c8)(hex_digit(text[i+1]) * 16 + hex_digit(text[i+2]));
+                i += 2;
+            }
+            break;
+        case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': {
+            s32 value = 0;
+            for(u32 digits = 0; digits < 3 && i < length && text[i] >= '0' && text[i] <= '7'; ++digits)
+                value = value * 8 + text[i++] - '0';
+            c = (c8)value;
+            --i;
+        } break;
+        default: break;
+        }
+        out[result++] = c;
+    }
+    return result;
+}
+
+/*
+ * Bytes are spelled the same way whatever escapes the source used, so
+ * equal contents intern to the same pointer. Other control characters
+ * become three digit octal escapes, which can't absorb a following digit,
+ * and a question mark after another is escaped to rule out trigraphs.
+ */
+c8*
+string_literal_value(const c8 *text, u32 length)
+{
+    c8  small[256];
+    c8 *decoded = length * 5 <= sizeof(small) ? small : malloc(length * 5 + 1);
+    c8 *spelled = decoded + length;
+
+    u32 decoded_length = decode_string_literal(text, length, decoded);
+    u32 spelled_length = 0;
+    for(u32 i = 0; i < decoded_length; ++i) {
+        uc8 c = (uc8)decoded[i];
+        c8 *out = spelled + spelled_length;
+        if     (c == '"' )                        { out[0] = '\\'; out[1] = '"';  spelled_length += 2; }
+        else if(c == '\\')                        { out[0] = '\\'; out[1] = '\\'; spelled_length += 2; }
+        else if(c == '\n')                        { out[0] = '\\'; out[1] = 'n';  spelled_length += 2; }
+        else if(c == '\t')                        { out[0] = '\\'; out[1] = 't';  spelled_length += 2; }
+        else if(c == '?' && i && decoded[i-1] == '?') { out[0] = '\\'; out[1] = '?';  spelled_length += 2; }
+        else if(c < 0x20 || c == 0x7F)            {
+            out[0] = '\\';
+            out[1] = (c8)('0' + (c >> 6));
+            out[2] = (c8)('0' + ((c >> 3) & 7));
+            out[3] = (c8)('0' + (c & 7));
+            spelled_length += 4;
+        }
+        else { out[0] = (c8)c; spelled_length += 1; }
+    }
+
+    c8 *result = intern_string_length(spelled, spelled_length);
+    if(decoded != small) free(decoded);
+    return result;
+}
+
+/*
+ * Lines and columns are one based and relative to the start of the chunk
+ */
+static void
+lex_chunk(Lexer *lexer)
+{
+    const c8 *cursor = lexer->start;
+    const c8 *end    = lexer->end;
     s32 line = 1;
     s32 colm = 1;
 
-    while(!feof(file)) {
-        c8 next = fgetc(file);
-        ++colm;
-
+    for(;;) {
         // Ignore Whitespace and Comments
-        for(;;next = fgetc(file), ++colm) {
-            if(next == ' ' || next == '\t') {
+        while(cursor < end) {
+            c8 next = *cursor;
+            if(next == ' ' || next == '\t' || next == '\r') {
+                ++cursor;
                 ++colm;
-                continue;
             }
             else if(next == '\n') {
+                ++cursor;
                 ++line;
                 colm = 1;
             }
             // Ignore until newline if '//' is reached
-            else if(next == '/' && fpeekc(file) == '/') {
-                do
-                    next = fgetc(file);
-                while(next != '\n');
-                colm = 0;
+            else if(next == '/' && cursor + 1 < end && cursor[1] == '/') {
+                while(cursor < end && *cursor != '\n') ++cursor;
             }
             else break;
         }
+        if(cursor >= end) break;
+
+        Token result;
+        result.file = lexer->file_name;
+        result.line = line;
+        result.colm = colm;
+
+        uc8 next = *cursor;
 
         // string litteral
         if(next == '\"') {
-            s32 string_start_colm = colm;
-            c8 buffer[256] = {0};
-            s32 current_char = 0;
-            while(1) {
-                next = fgetc(file);
-                ++colm;
-                if(next == '\"') break;
-                if(next == '\n') {
-                    emit_error("Lexer: Newline encountered before end of string",
-                            file_name, line, string_start_colm);
-                    return;
-                }
-                if(feof(file)) {
-                    emit_error("Lexer: End of file reached inside of string!",
-                            file_name, line, string_start_colm);
-                    return;
+            const c8 *string_start = ++cursor;
+            ++colm;
+            while(cursor < end && *cursor != '\"' && *cursor != '\n') {
+                // An escaped quote doesn't end the string, a backslash
+                // ending the line is left for the newline error
+                if(*cursor == '\\' && cursor + 1 < end && cursor[1] != '\n') {
+                    u32 escape = escape_length(cursor + 1, end);
+                    if(!escape) {
+                        lexer_error(lexer, "Lexer: Unknown escape sequence in string", line, colm);
+                        escape = 1;
+                    }
+                    cursor += escape;
+                    colm   += escape;
                 }
-                buffer[current_char++] = next;
+                ++cursor;
+                ++colm;
             }
-            buffer[current_char] = 0;
 
-            Token result;
             result.tag    = tag_string;
-            result.file   = file_name;
-            result.lexeme = cache_string(buffer);
-            result.line   = line;
-            result.colm   = string_start_colm;
-            sb_push(stream->tokens, result);
+            result.length = (u32)(cursor - string_start);
+            result.lexeme = lexer->raw_strings ? (c8*)string_start
+                                               : cache_string_length(string_start, result.length);
 
-            goto NEXT_TOKEN;
+            if(cursor >= end)
+                lexer_error(lexer, "Lexer: End of file reached inside of string!", line, result.colm);
+            else if(*cursor == '\n')
+                lexer_error(lexer, "Lexer: Newline encountered before end of string", line, result.colm);
+            else {
+                ++cursor;
+                ++colm;
+            }
         }
 
         // number litteral
-        if(isdigit(next)) {
-            s32 number_start_colm = colm;
-            s32 value = 0;
-
-            while(1) {
-                value *= 10;
-                value += next - '0';
-                next = fpeekc(file);
-                if(!isdigit(next)) break;
-                fgetc(file);
+        else if(isdigit(next)) {
+            s64 value = 0;
+            while(cursor < end && isdigit((uc8)*cursor)) {
+                // Saturates so the digits left don't overflow the s64 too
+                if(value <= INT32_MAX) value = value * 10 + (*cursor - '0');
+                ++cursor;
                 ++colm;
             }
-
-            Token result;
-            result.tag  = tag_number;
-            result.file = file_name;
-            result.number = value;
-            result.line = line;
-            result.colm = number_start_colm;
-            sb_push(stream->tokens, result);
-
-            goto NEXT_TOKEN;
+            if(value > INT32_MAX) {
+                lexer_error(lexer, "Lexer: Number literal out of range", line, result.colm);
+                value = 0;
+            }
+            result.tag    = tag_number;
+            result.number = (s32)value;
         }
 
         // identifier
-        if(isalpha(next)) {
-            s32 identifier_start_colm = colm;
-            c8 buffer[256] = {0};
-            s32 current_char = 0;
-            while(1) {
-                buffer[current_char++] = next;
-                next = fpeekc(file);
-                if(!isalnum(next) && next != '_') break;
-                fgetc(file);
+        else if(isalpha(next)) {
+            const c8 *identifier_start = cursor;
+            while(cursor < end && (isalnum((uc8)*cursor) || *cursor == '_')) {
+                ++cursor;
                 ++colm;
             }
-            buffer[current_char] = 0;
-
-            Token result;
             result.tag    = tag_id;
-            result.file   = file_name;
-            result.lexeme = cache_string(buffer);
-            result.line   = line;
-            result.colm   = identifier_start_colm;
-            sb_push(stream->tokens, result);
-
-            goto NEXT_TOKEN;
+            result.number = local_identifier(lexer, identifier_start,
+                                             (u32)(cursor - identifier_start));
         }
 
         // symbol
-        if(!feof(file)) {
-            Token result;
-            result.tag    = next;
-            result.file   = file_name;
-            result.line   = line;
-            result.colm   = colm;
-            sb_push(stream->tokens, result);
-        } else {
-            Token result;
-            result.tag    = tag_eof;
-            result.file   = file_name;
-            result.line   = line;
-            result.colm   = colm;
-            sb_push(stream->tokens, result);
+        else if(ispunct(next)) {
+            enum Tag digraph = cursor + 1 < end ? digraph_tag(next, cursor[1]) : tag_none;
+            s32 length = digraph ? 2 : 1;
+            result.tag = digraph ? digraph : next;
+            cursor += length;
+            colm   += length;
+        }
+
+        // Control and non ascii bytes would alias the token tags
+        else {
+            lexer_error(lexer, "Lexer: Unexpected character", line, colm);
+            ++cursor;
+            ++colm;
+            continue;
+        }
+
+        sb_push(lexer->tokens, result);
+    }
+
+    if(lexer->is_last) {
+        Token result;
+        result.tag  = tag_eof;
+        result.file = lexer->file_name;
+        result.line = line;
+        result.colm = colm;
+        sb_push(lexer->tokens, result);
+    }
+    lexer->line_count = line - 1;
+}
+
+static void
+lex_chunk_job(void *data, s32 index)
+{
+    Lexer_Batch *batch = data;
+    lex_chunk(&batch->lexers[index]);
+}
+
+static void
+stitch_chunk_job(void *data, s32 index)
+{
+    Lexer_Batch *batch = data;
+    Lexer *lexer = &batch->lexers[index];
+    Token *out   = batch->tokens + lexer->token_offset;
+
+    for(s32 i = 0; i < sb_count(lexer->tokens); ++i) {
+        out[i] = lexer->tokens[i];
+        out[i].line += lexer->line_offset;
+        if(out[i].tag == tag_id) {
+            s32 local = out[i].number;
+            out[i].tag    = lexer->identifier_tags[local];
+            out[i].lexeme = lexer->interned[local];
         }
-NEXT_TOKEN: ;
     }
-    fclose(file);
+}
+
+/*
+ * Keywords are told apart once per unique identifier, by comparing
+ * interned addresses
+ */
+static enum Tag
+identifier_tag(c8 *interned)
+{
+    static c8 *keyword_names[KEYWORD_COUNT];
+    if(!keyword_names[0])
+        for(s32 i = 0; i < KEYWORD_COUNT; ++i)
+            keyword_names[i] = intern_string(keywords[i].name);
+
+    for(s32 i = 0; i < KEYWORD_COUNT; ++i)
+        if(keyword_names[i] == interned) return keywords[i].tag;
+    return tag_id;
+}
+
+/*
+ * Lexes data, which starts on line line_offset + 1, onto the end of the
+ * stream. Returns the number of complete lines lexed.
+ */
+static s32
+lex_into_stream(Token_Stream *stream, c8 *file_name, const c8 *data, u64 size,
+                s32 line_offset, s32 is_last)
+{
+    s32 chunk_count = 1;
+    if(size >= LEXER_PARALLEL_MIN_SIZE && get_thread_count() > 1) {
+        chunk_count = (s32)(size / LEXER_CHUNK_MIN_SIZE);
+        if(chunk_count > get_thread_count() * 4) chunk_count = get_thread_count() * 4;
+    }
+
+    // Chunks start right after a newline, which never falls inside a token
+    Lexer *lexers = calloc(chunk_count, sizeof(Lexer));
+    const c8 *chunk_start = data;
+    for(s32 i = 0; i < chunk_count; ++i) {
+        const c8 *chunk_end = data + size * (i + 1) / chunk_count;
+        if(chunk_end < chunk_start) chunk_end = chunk_start;
+        while(chunk_end < data + size && chunk_end[-1] != '\n') ++chunk_end;
+        if(i == chunk_count - 1) chunk_end = data + size;
+
+        lexers[i].start       = chunk_start;
+        lexers[i].end         = chunk_end;
+        lexers[i].file_name   = file_name;
+        lexers[i].is_last     = is_last && (i == chunk_count - 1);
+        lexers[i].raw_strings = stream->streaming;
+        chunk_start = chunk_end;
+    }
+
+    Lexer_Batch batch;
+    batch.lexers = lexers;
+    run_parallel(lex_chunk_job, &batch, chunk_count);
+
+    // Only unique identifiers go through the shared intern table
+    s32 token_count = sb_count(stream->tokens);
+    s32 line_count  = line_offset;
+    for(s32 i = 0; i < chunk_count; ++i) {
+        Lexer *lexer = &lexers[i];
+        lexer->interned        = malloc((sb_count(lexer->identifiers) + 1) * sizeof(c8*));
+        lexer->identifier_tags = malloc((sb_count(lexer->identifiers) + 1) * sizeof(enum Tag));
+        for(s32 j = 0; j < sb_count(lexer->identifiers); ++j) {
+            lexer->interned[j] = intern_string_length(lexer->identifiers[j].start,
+                                                      lexer->identifiers[j].length);
+            lexer->identifier_tags[j] = identifier_tag(lexer->interned[j]);
+        }
+        lexer->token_offset = token_count;
+        lexer->line_offset  = line_count;
+        token_count += sb_count(lexer->tokens);
+        line_count  += lexer->line_count;
+
+        for(s32 j = 0; j < sb_count(lexer->errors); ++j) {
+            Lexer_Error *error = &lexer->errors[j];
+            if(!stream->quiet) emit_error(error->message, file_name, error->line + lexer->line_offset, error->colm);
+            ++stream->error_count;
+        }
+    }
+
+    sb_add(stream->tokens, token_count - sb_count(stream->tokens));
+    batch.tokens = stream->tokens;
+    run_parallel(stitch_chunk_job, &batch, chunk_count);
+
+    for(s32 i = 0; i < chunk_count; ++i) {
+        sb_free(lexers[i].tokens);
+        sb_free(lexers[i].errors);
+        sb_free(lexers[i].identifiers);
+        free(lexers[i].interned);
+        free(lexers[i].identifier_tags);
+        free(lexers[i].slots);
+    }
+    free(lexers);
+    return line_count - line_offset;
+}
+
+void
+tokenize_buffer(Token_Stream *stream, c8 *file_name, const c8 *data, u64 size)
+{
+    lex_into_stream(stream, file_name, data, size, 0, 1);
+}
+
+/*
+ * Maps a whole source file, an empty one maps to nothing. On failure the
+ * error is reported and the stream only holds an eof token.
+ */
+static s32
+map_source(Token_Stream *stream, c8 *file_name, void **data, u64 *size)
+{
+    const c8 *message = 0;
+    s32 fd = open(file_name, O_RDONLY);
+    struct stat info;
+    if(fd < 0 || fstat(fd, &info) != 0) message = "Lexer: Could not open file";
+    else {
+        *size = info.st_size;
+        *data = *size ? mmap(0, *size, PROT_READ, MAP_PRIVATE, fd, 0) : 0;
+        if(*data == MAP_FAILED) message = "Lexer: Could not map file";
+    }
+    if(fd >= 0) close(fd);
+    if(!message) return 1;
+
+    if(!stream->quiet) emit_error(message, file_name, 0, 0);
+    ++stream->error_count;
+    Token result = {0};
+    result.tag  = tag_eof;
+    result.file = file_name;
+    sb_push(stream->tokens, result);
+    return 0;
+}
+
+void
+tokenize_file(Token_Stream *stream, c8 *file_name)
+{
+    void *data;
+    u64   size;
+    if(!map_source(stream, file_name, &data, &size)) return;
+
+    tokenize_buffer(stream, file_name, data, size);
+    if(data) munmap(data, size);
+}
+
+void
+open_token_stream(Token_Stream *stream, c8 *file_name)
+{
+    stream->streaming   = 1;
+    stream->source_file = file_name;
+    stream->source_line = 0;
+
+    void *data;
+    u64   size;
+    if(!map_source(stream, file_name, &data, &size)) return;
+
+    // Nothing to map still needs one refill to push the eof token
+    static const c8 empty = 0;
+    stream->mapping          = data;
+    stream->mapping_size     = size;
+    stream->mapping_released = 0;
+    stream->source       = data ? data : &empty;
+    stream->source_end   = stream->source + size;
+}
+
+void
+close_token_stream(Token_Stream *stream)
+{
+    if(stream->mapping) munmap(stream->mapping, stream->mapping_size);
+    stream->mapping = 0;
+    stream->source  = 0;
+    sb_free(stream->tokens);
+    stream->tokens  = 0;
+    stream->current = 0;
+}
+
+void
+refill_tokens(Token_Stream *stream, s32 index)
+{
+    while(stream->source && index >= sb_count(stream->tokens)) {
+        const c8 *start = stream->source;
+        const c8 *end   = stream->source_end;
+        if(end - start > LEXER_WINDOW_SIZE) {
+            end = start + LEXER_WINDOW_SIZE;
+            while(end < stream->source_end && end[-1] != '\n') ++end;
+        }
+
+        // Pages lexed earlier are only read again by pending string tokens,
+        // dropping them faults them back in from the file when needed
+        if(stream->mapping) {
+            u64 page_size = sysconf(_SC_PAGESIZE);
+            u64 released  = (u64)(start - (const c8*)stream->mapping) & ~(page_size - 1);
+            if(released > stream->mapping_released) {
+                madvise((c8*)stream->mapping + stream->mapping_released,
+                        released - stream->mapping_released, MADV_DONTNEED);
+                stream->mapping_released = released;
+            }
+        }
+
+        s32 is_last = end == stream->source_end;
+        stream->source_line += lex_into_stream(stream, stream->source_file, start,
+                                               end - start, stream->source_line, is_last);
+        stream->source = is_last ? 0 : end;
+    }
+}
+
+void
+discard_consumed_tokens(Token_Stream *stream)
+{
+    // Only compact once the consumed tokens outnumber the rest, so every
+    // token is moved a constant number of times
+    s32 remaining = sb_count(stream->tokens) - stream->current;
+    if(stream->current < remaining) return;
+
+    memmove(stream->tokens, stream->tokens + stream->current, remaining * sizeof(Token));
+    stb__sbn(stream->tokens) = remaining;
+    stream->current = 0;
 }
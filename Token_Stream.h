@@ -80,11 +80,14 @@ typedef struct Token
         tag_key_uninit,
         tag_key_global,
         tag_key_internal,
+        tag_key_import,
 
         tag_eof = 255,
     }Tag;
 
     enum Tag  tag;
+    // Length of a streamed string lexeme, which points into the source
+    u32       length;
     c8        *file;
     s32       line, colm;
 
@@ -99,38 +102,138 @@ typedef struct Token_Stream
 {
     struct Token *tokens;
     s32 current;
+
+    // Set by the first error of a statement, further errors are suppressed
+    // until the parser has synchronized
+    s32 panic;
+    s32 panic_line;
+    s32 error_count;
+
+    // Nesting of blocks and calls, bounded so deep input can't overflow
+    // the stack of the recursive passes
+    s32 depth;
+
+    // Binary operators in the current statement, bounded for the same
+    // reason since each one can deepen an expression by a level
+    s32 operator_count;
+
+    // Lexer and syntax errors are counted but not reported, for passes
+    // that only look ahead at a file that is read again later
+    s32 quiet;
+
+    // Streaming only, see open_token_stream. source is the first byte not
+    // lexed yet and is cleared once the eof token has been pushed.
+    s32       streaming;
+    c8       *source_file;
+    const c8 *source;
+    const c8 *source_end;
+    s32       source_line;
+    void     *mapping;
+    u64       mapping_size;
+    u64       mapping_released;
 } Token_Stream;
 
 void
 print_token(Token *token);
 
+void
+syntax_error(Token_Stream *stream, const c8 *message, Token *token);
+
+/*
+ * Skip the rest of a broken statement, stops before a closing bracket
+ * or at the first token on a line after the error
+ */
+void
+synchronize(Token_Stream *stream);
+
+/*
+ * Lexes further windows of a streamed source until the token at index
+ * exists or the source is exhausted
+ */
+void
+refill_tokens(Token_Stream *stream, s32 index);
+
+inline void INLINE
+ensure_token(Token_Stream *stream, s32 index)
+{
+    if(stream->source) refill_tokens(stream, index);
+}
+
 inline Token* INLINE
 match_token(Token_Stream *stream, enum Tag tag)
 {
-    Token *result = stream->tokens + stream->current++;
-    if(result->tag != tag) emit_error("Parser: unexpected token", result->file, result->line, result->colm);
+    ensure_token(stream, stream->current);
+    Token *result = stream->tokens + stream->current;
+    if(result->tag != tag) {
+        syntax_error(stream, "Parser: unexpected token", result);
+        return result;
+    }
+    ++stream->current;
     return result;
 }
 
 inline Token* INLINE
 eat_token(Token_Stream *stream)
 {
-    return stream->tokens + stream->current++;
+    ensure_token(stream, stream->current);
+    Token *result = stream->tokens + stream->current;
+    if(result->tag != tag_eof) ++stream->current;
+    return result;
 }
 
 inline Token* INLINE
 peek_token(Token_Stream *stream)
 {
+    ensure_token(stream, stream->current);
     return stream->tokens + stream->current;
 }
 
 inline Token* INLINE
 lookahead_token(Token_Stream *stream, s32 count)
 {
+    ensure_token(stream, stream->current + count);
     return stream->tokens + stream->current + count;
 }
 
+/*
+ * Appends the tokens of data to the stream. Large inputs are split into
+ * line aligned chunks which are lexed concurrently.
+ */
+void
+tokenize_buffer(struct Token_Stream *stream, c8 *file_name, const c8 *data, u64 size);
+
 void
 tokenize_file(struct Token_Stream *stream, c8 *file_name);
 
+/*
+ * Streaming: maps the file but only lexes it a window at a time as the
+ * parser asks for tokens, string lexemes point into the mapping. Peak
+ * memory stays bounded as long as the consumed tokens are discarded.
+ * Tokens may move whenever the stream is refilled.
+ */
+void
+open_token_stream(struct Token_Stream *stream, c8 *file_name);
+
+/*
+ * String literals
+ * Lexemes keep the escapes of the source. decode_string_literal writes
+ * the bytes they stand for to out, which needs length bytes, and returns
+ * how many. string_literal_value interns a canonical C spelling of those
+ * bytes, which decodes back to them.
+ */
+u32
+decode_string_literal(const c8 *text, u32 length, c8 *out);
+
+c8*
+string_literal_value(const c8 *text, u32 length);
+
+void
+close_token_stream(struct Token_Stream *stream);
+
+/*
+ * Drops the tokens before the current one, call between statements only
+ */
+void
+discard_consumed_tokens(struct Token_Stream *stream);
+
 #endif
@@ -0,0 +1,290 @@
+
+#include <limits.h>
+#include <stdlib.h>
+
+#include "Type_Table.h"
+#include "Parser.h"
+#include "format.h"
+#include "Rope.h"
+#include "stretchy_buffer.h"
+
+static Type *types = 0;
+
+static Type_Id
+intern_type(enum Type_Kind kind, c8 *name, c8 *c_name)
+{
+    for(s32 i = 0; i < sb_count(types); ++i)
+        if(types[i].kind == kind && types[i].name == name) return i;
+
+    Type type;
+    type.kind   = kind;
+    type.name   = name;
+    type.c_name  = c_name;
+    type.element = TYPE_ID_UNKNOWN;
+    type.length  = 0;
+    sb_push(types, type);
+    return sb_count(types) - 1;
+}
+
+static void
+init_types()
+{
+    if(types) return;
+    intern_type(TYPE_UNKNOWN, intern_string("?"),      "int");
+    intern_type(TYPE_INT,     intern_string("int"),    "int");
+    intern_type(TYPE_CHAR,    intern_string("char"),   "char");
+    intern_type(TYPE_STRING,  intern_string("string"), "const char*");
+}
+
+/*
+ * [length]element, recursing once per dimension
+ */
+static Type_Id
+find_array_type(c8 *name)
+{
+    c8 *end;
+    long length = strtol(name + 1, &end, 10);
+    if(end == name + 1 || *end != ']' || length <= 0 || length > INT_MAX) return TYPE_ID_UNKNOWN;
+
+    Type_Id element = find_type(intern_string(end + 1));
+    if(element == TYPE_ID_UNKNOWN) return TYPE_ID_UNKNOWN;
+
+    Type_Id result = intern_type(TYPE_ARRAY, name, get_type(element)->c_name);
+    types[result].element = element;
+    types[result].length  = (s32)length;
+    return result;
+}
+
+Type_Id
+find_type(c8 *name)
+{
+    init_types();
+    for(s32 i = 1; i < sb_count(types); ++i)
+        if(types[i].name == name) return i;
+    if(name[0] == '[') return find_array_type(name);
+    return intern_type(TYPE_OPAQUE, name, name);
+}
+
+s32
+is_array_type(Type_Id id)
+{
+    return get_type(id)->kind == TYPE_ARRAY;
+}
+
+s32
+is_opaque_type(Type_Id id)
+{
+    return get_type(id)->kind == TYPE_OPAQUE;
+}
+
+Type*
+get_type(Type_Id id)
+{
+    init_types();
+    return &types[id];
+}
+
+s32
+is_integer_type(Type_Id id)
+{
+    enum Type_Kind kind = get_type(id)->kind;
+    return kind == TYPE_INT || kind == TYPE_CHAR;
+}
+
+s32
+is_assignable(Type_Id to, Type_Id from)
+{
+    if(to == from) return 1;
+    if(to == TYPE_ID_UNKNOWN || from == TYPE_ID_UNKNOWN) return 1;
+    return is_integer_type(to) && is_integer_type(from);
+}
+
+static s32
+type_error(const c8 *message, Type_Id lhs, Type_Id rhs, Ast_Node *node)
+{
+    c8 buffer[256];
+    snprintf(buffer, sizeof(buffer), message, get_type(lhs)->name, get_type(rhs)->name);
+    emit_node_error(buffer, node);
+    return 1;
+}
+
+static s32
+type_node(Ast_Node *node);
+
+/*
+ * Conditions, match values and results of the program are integers
+ */
+static s32
+type_integer(Ast_Node *node, const c8 *message)
+{
+    s32 errors = type_node(node);
+    if(!is_assignable(TYPE_ID_INT, node->type_id))
+        errors += type_error(message, node->type_id, TYPE_ID_INT, node);
+    return errors;
+}
+
+/*
+ * Arguments of a printf call against its literal format
+ */
+static s32
+type_format(Ast_Node *node)
+{
+    Ast_Node  *literal   = literal_format(node);
+    Ast_Node **arguments = node->function_call.arguments + 1;
+    s32        count     = sb_count(node->function_call.arguments) - 1;
+
+    // Formats printf understands better than we do are passed on unchecked
+    Format format;
+    parse_format(&format, literal->string.value);
+    if(!format.checked) return 0;
+
+    s32 errors = 0;
+    if(format.argument_count != count) {
+        c8 buffer[128];
+        snprintf(buffer, sizeof(buffer), "Typer: Format takes %i arguments, not %i", format.argument_count, count);
+        emit_error(buffer, node->file, node->line, node->colm);
+        ++errors;
+    }
+    else for(s32 i = 0, argument = 0; i < sb_count(format.pieces); ++i) {
+        if(!format.pieces[i].conversion) continue;
+        Type_Id expected = format.pieces[i].conversion == 's' ? TYPE_ID_STRING : TYPE_ID_INT;
+        Ast_Node *actual = arguments[argument++];
+        if(format.pieces[i].conversion == '?') continue;
+        if(!is_assignable(expected, actual->type_id))
+            errors += type_error("Typer: Format expects %s, not %s", expected, actual->type_id, actual);
+    }
+    free_format(&format);
+    return errors;
+}
+
+static s32
+type_node(Ast_Node *node)
+{
+    s32 errors = 0;
+    switch(node->type)
+    {
+    case N_Block:
+        for(s32 i = 0; i < sb_count(node->block.statements); ++i)
+            errors += type_node(node->block.statements[i]);
+        break;
+    case N_Declaration:
+        node->type_id = find_type(node->declaration.type);
+        if(node->type_id == TYPE_ID_UNKNOWN) {
+            emit_error("Typer: Unknown type", node->file, node->line, node->colm);
+            ++errors;
+        }
+        break;
+    case N_Import:
+        for(s32 i = 0; i < sb_count(node->import.declarations); ++i)
+            errors += type_node(node->import.declarations[i]);
+        break;
+    case N_Assignment: {
+        errors += type_node(node->assignment.expression);
+        Type_Id to   = node->assignment.declaration->type_id;
+        Type_Id from = node->assignment.expression->type_id;
+        for(s32 i = 0; i < sb_count(node->assignment.indices); ++i) {
+            errors += type_integer(node->assignment.indices[i], "Typer: Index is %s, not %s");
+            if(!is_array_type(to)) {
+                errors += type_error("Typer: Cannot index %s", to, to, node);
+                to = TYPE_ID_UNKNOWN;
+                break;
+            }
+            to = get_type(to)->element;
+        }
+        node->type_id = to;
+        if(node->assignment.declaration->declaration.read_only) {
+            emit_error("Typer: Cannot assign to a loop variable", node->file, node->line, node->colm);
+            ++errors;
+        }
+        else if(is_array_type(to))
+            errors += type_error("Typer: Cannot assign whole arrays of type %s", to, to, node);
+        else if(!is_assignable(to, from))
+            errors += type_error("Typer: Cannot assign %s to %s", from, to, node);
+    } break;
+    case N_Index: {
+        errors += type_node(node->index.array);
+        errors += type_node(node->index.index);
+        // The index may be shared with places it is fine, it is wrong here
+        Type_Id index = node->index.index->type_id;
+        if(!is_assignable(TYPE_ID_INT, index))
+            errors += type_error("Typer: Index is %s, not %s", index, TYPE_ID_INT, node);
+        Type_Id array = node->index.array->type_id;
+        node->type_id = is_array_type(array) ? get_type(array)->element : TYPE_ID_UNKNOWN;
+        if(!is_array_type(array))
+            errors += type_error("Typer: Cannot index %s", array, array, node);
+    } break;
+    case N_Each: {
+        Ast_Node *variable = node->each.variable;
+        if(node->each.array) {
+            errors += type_node(node->each.array);
+            Type_Id array = node->each.array->type_id;
+            variable->type_id = is_array_type(array) ? get_type(array)->element : TYPE_ID_UNKNOWN;
+            // Elements are bound by value, rows of an array can't be copied
+            if(!is_array_type(array) || is_array_type(variable->type_id))
+                errors += type_error("Typer: Cannot iterate over %s", array, array, node->each.array);
+        }
+        else {
+            errors += type_integer(node->each.first, "Typer: Range bound is %s, not %s");
+            errors += type_integer(node->each.end,   "Typer: Range bound is %s, not %s");
+            variable->type_id = TYPE_ID_INT;
+        }
+        errors += type_node(node->each.body);
+    } break;
+    case N_Function_Call:
+        for(s32 i = 0; i < sb_count(node->function_call.arguments); ++i)
+            errors += type_node(node->function_call.arguments[i]);
+        if(!errors && literal_format(node)) errors += type_format(node);
+        // External functions are not declared, their result is unchecked
+        node->type_id = TYPE_ID_UNKNOWN;
+        break;
+    case N_Number:
+        node->type_id = TYPE_ID_INT;
+        break;
+    case N_String:
+        node->type_id = TYPE_ID_STRING;
+        break;
+    case N_Variable:
+        node->type_id = node->variable.declaration->type_id;
+        break;
+    case N_Bin_Operator: {
+        errors += type_node(node->bin_operator.lhs);
+        errors += type_node(node->bin_operator.rhs);
+        Type_Id lhs = node->bin_operator.lhs->type_id;
+        Type_Id rhs = node->bin_operator.rhs->type_id;
+        node->type_id = TYPE_ID_INT;
+        if(!is_assignable(node->type_id, lhs) || !is_assignable(node->type_id, rhs))
+            errors += type_error("Typer: Invalid operands %s and %s", lhs, rhs, node);
+    } break;
+    case N_If:
+        for(s32 i = 0; i < sb_count(node->if_statement.blocks); ++i) {
+            errors += type_integer(node->if_statement.conditions[i], "Typer: Condition is %s, not %s");
+            errors += type_node(node->if_statement.blocks[i]);
+        }
+        if(node->if_statement.else_block) errors += type_node(node->if_statement.else_block);
+        break;
+    case N_While:
+        if(node->while_statement.condition)
+            errors += type_integer(node->while_statement.condition, "Typer: Condition is %s, not %s");
+        errors += type_node(node->while_statement.body);
+        break;
+    case N_Match:
+        errors += type_integer(node->match.expression, "Typer: Cannot match %s, only %s");
+        for(s32 i = 0; i < sb_count(node->match.blocks); ++i)
+            errors += type_node(node->match.blocks[i]);
+        if(node->match.default_block) errors += type_node(node->match.default_block);
+        break;
+    case N_Return:
+        if(node->return_statement.expression)
+            errors += type_integer(node->return_statement.expression, "Typer: Cannot return %s, only %s");
+        break;
+    default: break;
+    }
+    return errors;
+}
+
+s32
+type_check(Ast_Node *node)
+{
+    init_types();
+    return type_node(node);
+}
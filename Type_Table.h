@@ -0,0 +1,70 @@
+#ifndef TYPE_TABLE_H_
+#define TYPE_TABLE_H_
+
+#include "Ast_Node.h"
+
+/*
+ * Canonical types
+ * each type exists once in the table, so a type is fully identified by its
+ * index and two types are equal exactly when their ids are
+ */
+
+typedef s32 Type_Id;
+
+enum Type_Kind {
+    TYPE_UNKNOWN = 0,
+    TYPE_INT,
+    TYPE_CHAR,
+    TYPE_STRING,
+    TYPE_ARRAY,
+    // Any other name, passed through to C and only equal to itself
+    TYPE_OPAQUE,
+};
+
+typedef struct Type {
+    enum Type_Kind  kind;
+    c8             *name;
+    // Arrays use the C name of their innermost element type
+    c8             *c_name;
+    Type_Id         element;
+    s32             length;
+} Type;
+
+// Builtin types are interned first, in this order
+#define TYPE_ID_UNKNOWN 0
+#define TYPE_ID_INT     1
+#define TYPE_ID_CHAR    2
+#define TYPE_ID_STRING  3
+
+/*
+ * name must be interned, array and opaque types are created on first use
+ */
+Type_Id
+find_type(c8 *name);
+
+Type*
+get_type(Type_Id id);
+
+s32
+is_integer_type(Type_Id id);
+
+s32
+is_array_type(Type_Id id);
+
+s32
+is_opaque_type(Type_Id id);
+
+/*
+ * Unknown types, the results of external calls, go with anything
+ */
+s32
+is_assignable(Type_Id to, Type_Id from);
+
+/*
+ * Assigns a type id to every declaration and expression below node,
+ * variables must already be resolved. Returns the number of errors.
+ */
+s32
+type_check(Ast_Node *node);
+
+#endif
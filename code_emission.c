@@ -1,7 +1,76 @@
 
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
 #include "code_emission.h"
 #include "stretchy_buffer.h"
 #include "Compiler.h"
+#include "Type_Table.h"
+#include "Thread_Pool.h"
+#include "format.h"
+
+// Blocks with fewer statements than this are always emitted serially
+#define EMIT_PARALLEL_MIN_STATEMENTS 4096
+#define EMIT_RANGE_MIN_STATEMENTS    1024
+
+static const c8 code_prologue[] = "int main() {\n{\n";
+static const c8 code_epilogue[] = "}\nreturn 0; }\n\n";
+
+// Every module runs its statements once, from a function named this
+#define MODULE_INIT_PREFIX "__cus_init_"
+
+// A match becomes a switch, for a jump table, when at least this many
+// cases fill at least half of its slots, otherwise a binary search over the
+// sorted cases ending in runs of at most MATCH_LINEAR_CASES comparisons
+#define MATCH_TABLE_MIN_CASES 4
+#define MATCH_LINEAR_CASES    3
+
+// Loops whose bodies touch more outer variables than this get no hints
+#define EACH_MAX_OUTER 64
+
+// Written ahead of the pool, each only if some specialized printf call uses it
+static const c8 print_unsigned[] =
+    "static void __cus_print_unsigned(unsigned long long value, unsigned base) {\n"
+    "char digits[24], *at = digits + sizeof(digits);\n"
+    "do *--at = \"0123456789abcdef\"[value % base]; while(value /= base);\n"
+    "fwrite(at, 1, (size_t)(digits + sizeof(digits) - at), stdout);\n"
+    "}\n";
+static const c8 print_signed[] =
+    "static void __cus_print_signed(long long value) {\n"
+    "if(value < 0) putchar('-');\n"
+    "__cus_print_unsigned(value < 0 ? 0ull - (unsigned long long)value : (unsigned long long)value, 10);\n"
+    "}\n";
+
+#define PROFILE_COUNTERS "__cus_counters"
+#define PROFILE_DUMP     "__cus_dump_counters"
+
+// Literals of the tree being emitted, see pool_string_literal
+typedef struct Pooled_String {
+    c8 *value;
+    s32 line;
+    s32 colm;
+    s32 id;
+} Pooled_String;
+
+static Pooled_String *string_pool       = 0;
+// Open addressing on the interned value, holds string_pool indices + 1
+static s32           *string_slots      = 0;
+static u32            string_slot_count = 0;
+// Some printf call is specialized, and some writes a signed or unsigned integer
+static s32            uses_formats      = 0;
+static s32            uses_signed       = 0;
+static s32            uses_unsigned     = 0;
+
+// Set while emitting a profiled program, which is always done serially
+static Profile *profile = 0;
+
+// Set while emitting a module, whose statements run in a void function
+static s32 emitting_module = 0;
 
 void
 emit_code_for_block         (FILE *out, Ast_Node *root);
@@ -17,6 +86,26 @@ void
 emit_code_for_number        (FILE *out, Ast_Node *root);
 void
 emit_code_for_string        (FILE *out, Ast_Node *root);
+void
+emit_code_for_import        (FILE *out, Ast_Node *root);
+void
+emit_code_for_bin_operator  (FILE *out, Ast_Node *root);
+void
+emit_code_for_if            (FILE *out, Ast_Node *root);
+void
+emit_code_for_while         (FILE *out, Ast_Node *root);
+void
+emit_code_for_match         (FILE *out, Ast_Node *root);
+void
+emit_code_for_return        (FILE *out, Ast_Node *root);
+void
+emit_code_for_goto          (FILE *out, Ast_Node *root);
+void
+emit_code_for_label         (FILE *out, Ast_Node *root);
+void
+emit_code_for_index         (FILE *out, Ast_Node *root);
+void
+emit_code_for_each          (FILE *out, Ast_Node *root);
 
 void
 emit_code_node(FILE *out, Ast_Node *node)
@@ -30,52 +119,624 @@ emit_code_node(FILE *out, Ast_Node *node)
     case N_Variable      : emit_code_for_variable      (out, node); break;
     case N_Number        : emit_code_for_number        (out, node); break;
     case N_String        : emit_code_for_string        (out, node); break;
+    case N_Import        : emit_code_for_import        (out, node); break;
+    case N_Bin_Operator  : emit_code_for_bin_operator  (out, node); break;
+    case N_If            : emit_code_for_if            (out, node); break;
+    case N_While         : emit_code_for_while         (out, node); break;
+    case N_Match         : emit_code_for_match         (out, node); break;
+    case N_Return        : emit_code_for_return        (out, node); break;
+    case N_Goto          : emit_code_for_goto          (out, node); break;
+    case N_Label         : emit_code_for_label         (out, node); break;
+    case N_Index         : emit_code_for_index         (out, node); break;
+    case N_Each          : emit_code_for_each          (out, node); break;
     default: emit_error("Codegen: Unknown AST Node type", 0, 0, 0); break;
     }
 }
 
+static s32
+emit_code_for_format(FILE *out, Ast_Node *node);
+
+static void
+emit_code_for_statements    (FILE *out, Ast_Node **statements, s32 count)
+{
+    for(s32 i = 0; i < count; ++i) {
+        if(emit_code_for_format(out, statements[i])) continue;
+        emit_code_node(out, statements[i]);
+        fprintf(out, ";\n");
+    }
+}
+
+/*
+ * String pool
+ */
+
+static u32
+string_slot(c8 *value)
+{
+    return (u32)(((uintptr_t)value >> 3) * 0x9E3779B97F4A7C15ull >> 32) & (string_slot_count - 1);
+}
+
+static Pooled_String*
+find_pooled_string(c8 *value)
+{
+    if(!string_slot_count) return 0;
+    for(u32 slot = string_slot(value); string_slots[slot]; slot = (slot + 1) & (string_slot_count - 1))
+        if(string_pool[string_slots[slot] - 1].value == value) return &string_pool[string_slots[slot] - 1];
+    return 0;
+}
+
+static void
+grow_string_slots(void)
+{
+    free(string_slots);
+    string_slot_count = string_slot_count ? string_slot_count * 2 : 64;
+    string_slots      = calloc(string_slot_count, sizeof(s32));
+    for(s32 i = 0; i < sb_count(string_pool); ++i) {
+        u32 slot = string_slot(string_pool[i].value);
+        while(string_slots[slot]) slot = (slot + 1) & (string_slot_count - 1);
+        string_slots[slot] = i + 1;
+    }
+}
+
+s32
+pool_string_literal(c8 *value, s32 line, s32 colm)
+{
+    Pooled_String *pooled = find_pooled_string(value);
+    if(pooled) {
+        if(line < pooled->line || (line == pooled->line && colm < pooled->colm)) {
+            pooled->line = line;
+            pooled->colm = colm;
+        }
+        return (s32)(pooled - string_pool);
+    }
+
+    Pooled_String entry = { value, line, colm, -1 };
+    sb_push(string_pool, entry);
+    if((u32)sb_count(string_pool) * 2 > string_slot_count) grow_string_slots();
+    else {
+        u32 slot = string_slot(value);
+        while(string_slots[slot]) slot = (slot + 1) & (string_slot_count - 1);
+        string_slots[slot] = sb_count(string_pool);
+    }
+    return sb_count(string_pool) - 1;
+}
+
+void
+clear_string_pool(void)
+{
+    sb_free(string_pool);
+    free(string_slots);
+    string_pool       = 0;
+    string_slots      = 0;
+    string_slot_count = 0;
+    uses_formats      = 0;
+    uses_signed       = 0;
+    uses_unsigned     = 0;
+}
+
+void
+pool_format_helpers(Format *format)
+{
+    uses_formats = 1;
+    for(s32 i = 0; i < sb_count(format->pieces); ++i) {
+        c8 conversion = format->pieces[i].conversion;
+        if(conversion && strchr("di", conversion)) uses_signed = uses_unsigned = 1;
+        if(conversion && strchr("ux", conversion)) uses_unsigned = 1;
+    }
+}
+
+/*
+ * A printf statement whose literal format is simple enough to be written
+ * piecewise, leaves the parsed format to the caller to free
+ */
+static s32
+specialized_format(Ast_Node *statement, Format *format)
+{
+    Ast_Node *literal = literal_format(statement);
+    if(!literal) return 0;
+    parse_format(format, literal->string.value);
+    if(format->simple) return 1;
+    free_format(format);
+    return 0;
+}
+
+static void
+pool_strings(Ast_Node *node);
+
+/*
+ * The format of a specialized printf is written as slices of its own,
+ * so it is only pooled where some other use passes it through
+ */
+void
+pool_statement_strings(Ast_Node *statement)
+{
+    Format format;
+    if(!specialized_format(statement, &format)) {
+        pool_strings(statement);
+        return;
+    }
+    pool_format_helpers(&format);
+    free_format(&format);
+    for(s32 i = 1; i < sb_count(statement->function_call.arguments); ++i)
+        pool_strings(statement->function_call.arguments[i]);
+}
+
+static void
+pool_strings(Ast_Node *node)
+{
+    switch(node->type)
+    {
+    case N_String:
+        pool_string_literal(node->string.value, node->line, node->colm);
+        break;
+    case N_Block:
+        for(s32 i = 0; i < sb_count(node->block.statements); ++i)
+            pool_statement_strings(node->block.statements[i]);
+        break;
+    case N_Assignment:
+        for(s32 i = 0; i < sb_count(node->assignment.indices); ++i)
+            pool_strings(node->assignment.indices[i]);
+        pool_strings(node->assignment.expression);
+        break;
+    case N_Function_Call:
+        for(s32 i = 0; i < sb_count(node->function_call.arguments); ++i)
+            pool_strings(node->function_call.arguments[i]);
+        break;
+    case N_Bin_Operator:
+        pool_strings(node->bin_operator.lhs);
+        pool_strings(node->bin_operator.rhs);
+        break;
+    case N_Index:
+        pool_strings(node->index.array);
+        pool_strings(node->index.index);
+        break;
+    case N_If:
+        for(s32 i = 0; i < sb_count(node->if_statement.blocks); ++i) {
+            pool_strings(node->if_statement.conditions[i]);
+            pool_strings(node->if_statement.blocks[i]);
+        }
+        if(node->if_statement.else_block) pool_strings(node->if_statement.else_block);
+        break;
+    case N_While:
+        if(node->while_statement.condition) pool_strings(node->while_statement.condition);
+        pool_strings(node->while_statement.body);
+        break;
+    case N_Each:
+        if(node->each.array) pool_strings(node->each.array);
+        else {
+            pool_strings(node->each.first);
+            pool_strings(node->each.end);
+        }
+        pool_strings(node->each.body);
+        break;
+    case N_Match:
+        pool_strings(node->match.expression);
+        for(s32 i = 0; i < sb_count(node->match.blocks); ++i)
+            pool_strings(node->match.blocks[i]);
+        if(node->match.default_block) pool_strings(node->match.default_block);
+        break;
+    case N_Return:
+        if(node->return_statement.expression) pool_strings(node->return_statement.expression);
+        break;
+    default: break;
+    }
+}
+
+static s32
+compare_first_use(const void *a, const void *b)
+{
+    const Pooled_String *lhs = *(Pooled_String *const*)a, *rhs = *(Pooled_String *const*)b;
+    if(lhs->line != rhs->line) return lhs->line - rhs->line;
+    return lhs->colm - rhs->colm;
+}
+
+/*
+ * Numbering by first use in the source rather than by emission order
+ * keeps the names the same however the tree was walked
+ */
+static void
+emit_string_pool(FILE *out)
+{
+    if(uses_formats)  fputs("#include <stdio.h>\n", out);
+    if(uses_unsigned) fputs(print_unsigned, out);
+    if(uses_signed)   fputs(print_signed, out);
+
+    s32 count = sb_count(string_pool);
+    if(!count) return;
+
+    Pooled_String **order = malloc(count * sizeof(Pooled_String*));
+    for(s32 i = 0; i < count; ++i) order[i] = &string_pool[i];
+    qsort(order, count, sizeof(Pooled_String*), compare_first_use);
+
+    for(s32 i = 0; i < count; ++i) {
+        order[i]->id = i;
+        fprintf(out, "static const char " STRING_POOL_PREFIX "%i[] = \"%s\";\n", i, order[i]->value);
+    }
+    fprintf(out, "\n");
+    free(order);
+}
+
 void
 emit_code(FILE *out, Ast_Node *root)
 {
-    fprintf(out, "int main() {\n");
-    emit_code_node(out, root);
-    fprintf(out, "return 0; }\n\n");
+    pool_strings(root);
+    emit_code_prologue(out);
+    emit_code_for_statements(out, root->block.statements, sb_count(root->block.statements));
+    emit_code_epilogue(out);
+    clear_string_pool();
+}
+
+static void
+emit_counter(FILE *out, Profile_Site_Kind kind, Ast_Node *node)
+{
+    fprintf(out, "++" PROFILE_COUNTERS "[%i]", add_profile_site(profile, kind, node));
+}
+
+/*
+ * The counter array is only sized once every site has been seen, so it is
+ * declared ahead of main and defined after it
+ */
+void
+emit_profiled_code(FILE *out, Ast_Node *root, Profile *target)
+{
+    profile = target;
+    pool_strings(root);
+
+    fputs("#include <stdio.h>\n#include <stdlib.h>\n", out);
+    fputs("extern unsigned long long " PROFILE_COUNTERS "[];\n", out);
+    fputs("static void " PROFILE_DUMP "(void);\n", out);
+    emit_code_prologue(out);
+    fputs("atexit(" PROFILE_DUMP ");\n", out);
+    emit_counter(out, PROFILE_BLOCK, root);
+    fputs(";\n", out);
+    emit_code_for_statements(out, root->block.statements, sb_count(root->block.statements));
+    emit_code_epilogue(out);
+
+    s32 count = sb_count(profile->sites);
+    fprintf(out, "unsigned long long " PROFILE_COUNTERS "[%i];\n", count);
+    fputs("static void " PROFILE_DUMP "(void) {\n", out);
+    fprintf(out, "static const unsigned long long header[3] = { %lluull, %iull, %lluull };\n",
+            (unsigned long long)PROFILE_MAGIC, count, (unsigned long long)profile->source_hash);
+    fputs("FILE *file = fopen(\"", out);
+    for(c8 *c = profile->data_file; *c; ++c) {
+        if(*c == '"' || *c == '\\') fputc('\\', out);
+        fputc(*c, out);
+    }
+    fputs("\", \"wb\");\nif(!file) return;\n", out);
+    fputs("fwrite(header, sizeof(header), 1, file);\n", out);
+    fputs("fwrite(" PROFILE_COUNTERS ", sizeof(" PROFILE_COUNTERS "), 1, file);\n", out);
+    fputs("fclose(file);\n}\n", out);
+
+    clear_string_pool();
+    profile = 0;
+}
+
+void
+emit_module_code(FILE *out, Ast_Node *root, c8 *module_name)
+{
+    Ast_Node **statements = root->block.statements;
+
+    pool_strings(root);
+    emit_string_pool(out);
+    for(s32 i = 0; i < sb_count(statements); ++i) {
+        if(statements[i]->type != N_Declaration) continue;
+        emit_code_for_declaration(out, statements[i]);
+        fprintf(out, ";\n");
+    }
+
+    emitting_module = 1;
+    fprintf(out, "\nvoid " MODULE_INIT_PREFIX "%s(void) {\n", module_name);
+    fprintf(out, "static int initialized = 0;\nif(initialized) return;\ninitialized = 1;\n{\n");
+    for(s32 i = 0; i < sb_count(statements); ++i) {
+        if(statements[i]->type == N_Declaration) continue;
+        emit_code_for_statements(out, &statements[i], 1);
+    }
+    fprintf(out, "}\n}\n");
+    emitting_module = 0;
+    clear_string_pool();
+}
+
+void
+emit_code_prologue(FILE *out)
+{
+    emit_string_pool(out);
+    fputs(code_prologue, out);
+}
+
+void
+emit_code_statement(FILE *out, Ast_Node *statement)
+{
+    emit_code_for_statements(out, &statement, 1);
+}
+
+void
+emit_code_epilogue(FILE *out)
+{
+    fputs(code_epilogue, out);
+}
+
+typedef struct Emit_Range {
+    Ast_Node **statements;
+    s32        count;
+    c8        *text;
+    size_t     size;
+} Emit_Range;
+
+static void
+emit_range_job(void *data, s32 index)
+{
+    Emit_Range *range = (Emit_Range*)data + index;
+    FILE *out = open_memstream(&range->text, &range->size);
+    emit_code_for_statements(out, range->statements, range->count);
+    fclose(out);
+}
+
+static void
+write_ranges(FILE *out, struct iovec *iov, s32 count)
+{
+    fflush(out);
+    s32 fd = fileno(out);
+
+    while(count > 0) {
+        s32 batch = count < IOV_MAX ? count : IOV_MAX;
+        ssize_t written = fd >= 0 ? writev(fd, iov, batch) : -1;
+        if(written < 0) {
+            // Not backed by a descriptor, or the write failed: go through stdio
+            for(s32 i = 0; i < count; ++i)
+                fwrite(iov[i].iov_base, 1, iov[i].iov_len, out);
+            return;
+        }
+
+        while(batch > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            ++iov; --count; --batch;
+        }
+        if(written > 0) {
+            iov->iov_base  = (c8*)iov->iov_base + written;
+            iov->iov_len  -= written;
+        }
+    }
+}
+
+void
+emit_code_parallel(FILE *out, Ast_Node *root)
+{
+    s32 statement_count = sb_count(root->block.statements);
+    s32 range_count = statement_count / EMIT_RANGE_MIN_STATEMENTS;
+    if(range_count > get_thread_count() * 4) range_count = get_thread_count() * 4;
+
+    if(statement_count < EMIT_PARALLEL_MIN_STATEMENTS || range_count < 2) {
+        emit_code(out, root);
+        return;
+    }
+
+    Emit_Range *ranges = calloc(range_count, sizeof(Emit_Range));
+    for(s32 i = 0; i < range_count; ++i) {
+        s32 first = (s32)((s64)statement_count * i / range_count);
+        s32 last  = (s32)((s64)statement_count * (i + 1) / range_count);
+        ranges[i].statements = root->block.statements + first;
+        ranges[i].count      = last - first;
+    }
+
+    // Ranges only read the pool, which is complete before they start
+    pool_strings(root);
+    emit_string_pool(out);
+    run_parallel(emit_range_job, ranges, range_count);
+
+    struct iovec *iov = malloc((range_count + 2) * sizeof(struct iovec));
+    iov[0].iov_base = (void*)code_prologue;
+    iov[0].iov_len  = sizeof(code_prologue) - 1;
+    for(s32 i = 0; i < range_count; ++i) {
+        iov[i + 1].iov_base = ranges[i].text;
+        iov[i + 1].iov_len  = ranges[i].size;
+    }
+    iov[range_count + 1].iov_base = (void*)code_epilogue;
+    iov[range_count + 1].iov_len  = sizeof(code_epilogue) - 1;
+
+    write_ranges(out, iov, range_count + 2);
+
+    for(s32 i = 0; i < range_count; ++i)
+        free(ranges[i].text);
+    free(ranges);
+    free(iov);
+    clear_string_pool();
 }
 
 void
 emit_code_for_block         (FILE *out, Ast_Node *node)
 {
     fprintf(out, "{\n");
-    for(s32 i = 0; i < sb_count(node->block.statements); ++i) {
-        emit_code_node(out, node->block.statements[i]);
+    if(profile) {
+        emit_counter(out, PROFILE_BLOCK, node);
         fprintf(out, ";\n");
     }
+    emit_code_for_statements(out, node->block.statements, sb_count(node->block.statements));
     fprintf(out, "}\n");
 }
 
+/*
+ * Array dimensions follow the name in C, outermost first
+ */
+static void
+emit_declarator(FILE *out, Type_Id type, const c8 *identifier)
+{
+    fprintf(out, "%s %s", get_type(type)->c_name, identifier);
+    for(; is_array_type(type); type = get_type(type)->element)
+        fprintf(out, "[%i]", get_type(type)->length);
+}
+
+/*
+ * A pointer to the first row of an array, which indexes like the array
+ */
+static void
+emit_row_pointer(FILE *out, Type_Id type, const c8 *qualifier, const c8 *identifier)
+{
+    fprintf(out, "%s (*%s%s)", get_type(type)->c_name, qualifier, identifier);
+    for(type = get_type(type)->element; is_array_type(type); type = get_type(type)->element)
+        fprintf(out, "[%i]", get_type(type)->length);
+}
+
 void
 emit_code_for_declaration   (FILE *out, Ast_Node *node)
 {
-    fprintf(out, "%s %s", node->declaration.type, node->declaration.identifier);
+    emit_declarator(out, node->type_id, node->declaration.identifier);
 }
 
 void
 emit_code_for_assignment    (FILE *out, Ast_Node *node)
 {
-    fprintf(out, "%s = ", node->assignment.identifier);
+    fprintf(out, "%s", node->assignment.identifier);
+    for(s32 i = 0; i < sb_count(node->assignment.indices); ++i) {
+        fprintf(out, "[");
+        emit_code_node(out, node->assignment.indices[i]);
+        fprintf(out, "]");
+    }
+    fprintf(out, " = ");
     emit_code_node(out, node->assignment.expression);
 }
 
 void
 emit_code_for_function_call (FILE *out, Ast_Node *node)
 {
+    // A comma expression counts the call wherever the call may stand
+    if(profile) {
+        fprintf(out, "(");
+        emit_counter(out, PROFILE_CALL, node);
+        fprintf(out, ", ");
+    }
     fprintf(out, "%s(", node->function_call.identifier);
     for(s32 i = 0; i < sb_count(node->function_call.arguments); ++i) {
         emit_code_node(out, node->function_call.arguments[i]);
         if(i < sb_count(node->function_call.arguments)-1)
             fprintf(out, ", ");
     }
-    fprintf(out, ")");
+    fprintf(out, profile ? "))" : ")");
+}
+
+static s32
+contains_call(Ast_Node *node)
+{
+    switch(node->type)
+    {
+    case N_Function_Call: return 1;
+    case N_Bin_Operator : return contains_call(node->bin_operator.lhs) || contains_call(node->bin_operator.rhs);
+    case N_Index        : return contains_call(node->index.array) || contains_call(node->index.index);
+    default             : return 0;
+    }
+}
+
+/*
+ * Decoded bytes spelled as string_literal_value does, between quotes
+ */
+static void
+emit_quoted(FILE *out, const c8 *bytes, s32 length, c8 quote)
+{
+    fputc(quote, out);
+    for(s32 i = 0; i < length; ++i) {
+        uc8 c = (uc8)bytes[i];
+        if     (c == (uc8)quote || c == '\\')       fprintf(out, "\\%c", c);
+        else if(c == '\n')                          fputs("\\n", out);
+        else if(c == '\t')                          fputs("\\t", out);
+        else if(c == '?' && i && bytes[i-1] == '?') fputs("\\?", out);
+        else if(c < 0x20 || c == 0x7F)              fprintf(out, "\\%03o", c);
+        else                                        fputc(c, out);
+    }
+    fputc(quote, out);
+}
+
+/*
+ * Arguments that call functions are evaluated into temporaries first, as
+ * printf would before writing anything
+ */
+void
+emit_format_writes(FILE *out, Format *format, Format_Arguments *arguments)
+{
+    for(s32 i = 0, argument = 0; i < sb_count(format->pieces); ++i) {
+        c8 conversion = format->pieces[i].conversion;
+        if(!conversion) continue;
+        if(arguments->calls(arguments->data, argument)) {
+            const c8 *type = conversion == 's' ? "const char*" : strchr("ux", conversion) ? "unsigned" : "int";
+            fprintf(out, "%s __cus_arg_%i = ", type, argument);
+            arguments->emit(out, arguments->data, argument);
+            fprintf(out, ";\n");
+        }
+        ++argument;
+    }
+
+    for(s32 i = 0, argument = 0; i < sb_count(format->pieces); ++i) {
+        Format_Piece *piece = &format->pieces[i];
+        if(!piece->conversion) {
+            const c8 *text = format->text + piece->offset;
+            if(piece->length == 1) {
+                fprintf(out, "putchar(");
+                emit_quoted(out, text, 1, '\'');
+                fprintf(out, ");\n");
+            }
+            else {
+                fprintf(out, "fwrite(");
+                emit_quoted(out, text, piece->length, '"');
+                fprintf(out, ", 1, %i, stdout);\n", piece->length);
+            }
+            continue;
+        }
+
+        switch(piece->conversion)
+        {
+        case 'd': case 'i': fprintf(out, "__cus_print_signed(");            break;
+        case 'u': case 'x': fprintf(out, "__cus_print_unsigned((unsigned)"); break;
+        case 'c':           fprintf(out, "putchar(");                        break;
+        case 's':           fprintf(out, "fputs(");                          break;
+        }
+        if(arguments->calls(arguments->data, argument)) fprintf(out, "__cus_arg_%i", argument);
+        else {
+            fprintf(out, "(");
+            arguments->emit(out, arguments->data, argument);
+            fprintf(out, ")");
+        }
+        switch(piece->conversion)
+        {
+        case 'u': fprintf(out, ", 10);\n");     break;
+        case 'x': fprintf(out, ", 16);\n");     break;
+        case 's': fprintf(out, ", stdout);\n"); break;
+        default : fprintf(out, ");\n");         break;
+        }
+        ++argument;
+    }
+}
+
+static void
+emit_format_argument(FILE *out, void *data, s32 index)
+{
+    emit_code_node(out, ((Ast_Node**)data)[index]);
+}
+
+static s32
+format_argument_calls(void *data, s32 index)
+{
+    return contains_call(((Ast_Node**)data)[index]);
+}
+
+/*
+ * A printf statement with a plain literal format becomes writes of slices
+ * of the literal and of its converted arguments. Returns 0 for statements
+ * left to emit_code_node.
+ */
+static s32
+emit_code_for_format(FILE *out, Ast_Node *node)
+{
+    Format format;
+    if(!specialized_format(node, &format)) return 0;
+
+    Format_Arguments arguments = { node->function_call.arguments + 1, emit_format_argument, format_argument_calls };
+    fprintf(out, "{\n");
+    if(profile) {
+        emit_counter(out, PROFILE_CALL, node);
+        fprintf(out, ";\n");
+    }
+    emit_format_writes(out, &format, &arguments);
+    fprintf(out, "}\n");
+    free_format(&format);
+    return 1;
 }
 
 void
@@ -87,12 +748,467 @@ emit_code_for_variable      (FILE *out, Ast_Node *node)
 void
 emit_code_for_number        (FILE *out, Ast_Node *node)
 {
-    fprintf(out, "%li", node->number.value);
+    fprintf(out, "%i", node->number.value);
 }
 
 void
 emit_code_for_string        (FILE *out, Ast_Node *node)
 {
-    fprintf(out, "\"%s\"", node->string.value);
+    Pooled_String *pooled = find_pooled_string(node->string.value);
+    if(pooled && pooled->id >= 0) fprintf(out, STRING_POOL_PREFIX "%i", pooled->id);
+    else                          fprintf(out, "\"%s\"", node->string.value);
+}
+
+/*
+ * Block scope declarations of the module's globals and its init function,
+ * then the call running it
+ */
+void
+emit_code_for_import        (FILE *out, Ast_Node *node)
+{
+    for(s32 i = 0; i < sb_count(node->import.declarations); ++i) {
+        Ast_Node *declaration = node->import.declarations[i];
+        fprintf(out, "extern ");
+        emit_code_for_declaration(out, declaration);
+        fprintf(out, ";\n");
+    }
+    fprintf(out, "void " MODULE_INIT_PREFIX "%s(void);\n", node->import.module);
+    fprintf(out, MODULE_INIT_PREFIX "%s()", node->import.module);
+}
+
+const c8*
+operator_spelling(enum Tag tag)
+{
+    switch(tag)
+    {
+    case tag_and              : return "&&";
+    case tag_or               : return "||";
+    case tag_isequal          : return "==";
+    case tag_notequal         : return "!=";
+    case tag_lessthanequal    : return "<=";
+    case tag_greaterthanequal : return ">=";
+    case tag_lshift           : return "<<";
+    case tag_rshift           : return ">>";
+    case tag_pipe             : return "|";
+    case tag_caret            : return "^";
+    case tag_ampersand        : return "&";
+    case tag_lessthan         : return "<";
+    case tag_greaterthan      : return ">";
+    case tag_plus             : return "+";
+    case tag_minus            : return "-";
+    case tag_astrix           : return "*";
+    case tag_slash            : return "/";
+    case tag_percent          : return "%";
+    default                   : return "?";
+    }
+}
+
+void
+emit_code_for_bin_operator  (FILE *out, Ast_Node *node)
+{
+    // Fully parenthesized, the tree already holds the precedence
+    fprintf(out, "(");
+    emit_code_node(out, node->bin_operator.lhs);
+    fprintf(out, " %s ", operator_spelling(node->bin_operator.tag));
+    emit_code_node(out, node->bin_operator.rhs);
+    fprintf(out, ")");
+}
+
+void
+emit_code_for_if            (FILE *out, Ast_Node *node)
+{
+    for(s32 i = 0; i < sb_count(node->if_statement.blocks); ++i) {
+        fprintf(out, i ? "else if(" : "if(");
+        emit_code_node(out, node->if_statement.conditions[i]);
+        fprintf(out, ") ");
+        emit_code_for_block(out, node->if_statement.blocks[i]);
+    }
+    if(node->if_statement.else_block) {
+        fprintf(out, "else ");
+        emit_code_for_block(out, node->if_statement.else_block);
+    }
+}
+
+void
+emit_code_for_while         (FILE *out, Ast_Node *node)
+{
+    if(node->while_statement.condition) {
+        fprintf(out, "while(");
+        emit_code_node(out, node->while_statement.condition);
+        fprintf(out, ") ");
+    }
+    else fprintf(out, "for(;;) ");
+    emit_code_for_block(out, node->while_statement.body);
+}
+
+/*
+ * Labels and temporaries of a match are named after its position, which
+ * keeps them unique and the output independent of emission order
+ */
+static void
+emit_match_search(FILE *out, const c8 *id, Ast_Match_Case *cases, s32 count)
+{
+    if(count <= MATCH_LINEAR_CASES) {
+        for(s32 i = 0; i < count; ++i)
+            fprintf(out, "if(__cus_match_%s == %i) goto __cus_case_%s_%i;\n",
+                    id, cases[i].value, id, cases[i].block);
+        fprintf(out, "goto __cus_default_%s;\n", id);
+        return;
+    }
+
+    s32 half = count / 2;
+    fprintf(out, "if(__cus_match_%s < %i) {\n", id, cases[half].value);
+    emit_match_search(out, id, cases, half);
+    fprintf(out, "}\n");
+    emit_match_search(out, id, cases + half, count - half);
+}
+
+/*
+ * Dense matches become a switch over the cases present, which C compilers
+ * turn into a jump table behind one range check. Gaps fall out of the
+ * switch to the default.
+ */
+static void
+emit_match_switch(FILE *out, const c8 *id, Ast_Match_Case *cases, s32 count)
+{
+    fprintf(out, "switch(__cus_match_%s) {\n", id);
+    for(s32 i = 0; i < count; ++i)
+        fprintf(out, "case %i: goto __cus_case_%s_%i;\n", cases[i].value, id, cases[i].block);
+    fprintf(out, "}\n");
+    fprintf(out, "goto __cus_default_%s;\n", id);
+}
+
+void
+emit_code_for_match         (FILE *out, Ast_Node *node)
+{
+    c8 id[32];
+    snprintf(id, sizeof(id), "%i_%i", node->line, node->colm);
+
+    Ast_Match_Case *cases = node->match.cases;
+    s32 count = sb_count(cases);
+
+    fprintf(out, "{\nint __cus_match_%s = ", id);
+    emit_code_node(out, node->match.expression);
+    fprintf(out, ";\n");
+
+    s64 range = count ? (s64)cases[count - 1].value - cases[0].value + 1 : 0;
+    if(count >= MATCH_TABLE_MIN_CASES && range <= 2 * (s64)count)
+        emit_match_switch(out, id, cases, count);
+    else
+        emit_match_search(out, id, cases, count);
+
+    for(s32 i = 0; i < sb_count(node->match.blocks); ++i) {
+        fprintf(out, "__cus_case_%s_%i:\n", id, i);
+        emit_code_for_block(out, node->match.blocks[i]);
+        fprintf(out, "goto __cus_end_%s;\n", id);
+    }
+    fprintf(out, "__cus_default_%s:\n", id);
+    if(node->match.default_block) emit_code_for_block(out, node->match.default_block);
+    fprintf(out, "__cus_end_%s:;\n}\n", id);
+}
+
+void
+emit_code_for_return        (FILE *out, Ast_Node *node)
+{
+    Ast_Node *expression = node->return_statement.expression;
+
+    // A module's statements run in its void init function, returning ends it
+    if(emitting_module) {
+        fprintf(out, "{\n");
+        if(expression) {
+            emit_code_node(out, expression);
+            fprintf(out, ";\n");
+        }
+        fprintf(out, "return;\n}\n");
+        return;
+    }
+
+    fprintf(out, "return ");
+    if(expression) emit_code_node(out, expression);
+    else           fprintf(out, "0");
+}
+
+void
+emit_code_for_goto          (FILE *out, Ast_Node *node)
+{
+    fprintf(out, "goto %s", node->goto_statement.label);
+}
+
+void
+emit_code_for_label         (FILE *out, Ast_Node *node)
+{
+    fprintf(out, "%s:", node->label.identifier);
+}
+
+void
+emit_code_for_index         (FILE *out, Ast_Node *node)
+{
+    emit_code_node(out, node->index.array);
+    fprintf(out, "[");
+    emit_code_node(out, node->index.index);
+    fprintf(out, "]");
+}
+
+/*
+ * Dependence analysis of each loops
+ * A loop is independent when no iteration can observe another: its body
+ * has no calls or jumps, writes outer arrays only at the loop index and
+ * reads those arrays only there, and updates outer scalars only as sums
+ * x = x + e which read x nowhere else. Such loops get `#pragma omp simd`,
+ * the sums as its reductions. Without calls or labels in the body the
+ * outer arrays it touches can also only be reached through their names,
+ * which are then shadowed by restrict pointers.
+ */
+
+typedef struct Each_Outer {
+    Ast_Node *declaration;
+    s32       written;
+    // Reads of a scalar, and the sums among its writes
+    s32       reads;
+    s32       sums;
+} Each_Outer;
+
+typedef struct Each_Analysis {
+    // Null for the array form, whose index is hidden
+    Ast_Node   *index;
+    // Declarations in the body, sorted
+    Ast_Node  **locals;
+    Each_Outer *outer;
+    s32         independent;
+    s32         restrictable;
+} Each_Analysis;
+
+static s32
+compare_pointers(const void *a, const void *b)
+{
+    uintptr_t lhs = (uintptr_t)*(void *const*)a, rhs = (uintptr_t)*(void *const*)b;
+    return lhs < rhs ? -1 : lhs > rhs;
+}
+
+static void
+collect_locals(Each_Analysis *analysis, Ast_Node *node)
+{
+    switch(node->type)
+    {
+    case N_Declaration:
+        sb_push(analysis->locals, node);
+        break;
+    case N_Block:
+        for(s32 i = 0; i < sb_count(node->block.statements); ++i)
+            collect_locals(analysis, node->block.statements[i]);
+        break;
+    case N_If:
+        for(s32 i = 0; i < sb_count(node->if_statement.blocks); ++i)
+            collect_locals(analysis, node->if_statement.blocks[i]);
+        if(node->if_statement.else_block) collect_locals(analysis, node->if_statement.else_block);
+        break;
+    default: break;
+    }
+}
+
+static Each_Outer*
+find_outer(Each_Analysis *analysis, Ast_Node *declaration)
+{
+    if(bsearch(&declaration, analysis->locals, sb_count(analysis->locals),
+               sizeof(Ast_Node*), compare_pointers))
+        return 0;
+
+    for(s32 i = 0; i < sb_count(analysis->outer); ++i)
+        if(analysis->outer[i].declaration == declaration) return &analysis->outer[i];
+    if(sb_count(analysis->outer) >= EACH_MAX_OUTER) {
+        analysis->independent  = 0;
+        analysis->restrictable = 0;
+        return 0;
+    }
+
+    Each_Outer outer = { declaration, 0, 0, 0 };
+    sb_push(analysis->outer, outer);
+    return &sb_last(analysis->outer);
+}
+
+static s32
+is_loop_index(Each_Analysis *analysis, Ast_Node *node)
+{
+    return analysis->index && node->type == N_Variable && node->variable.declaration == analysis->index;
+}
+
+static void
+analyze_each_node(Each_Analysis *analysis, Ast_Node *node)
+{
+    switch(node->type)
+    {
+    case N_Block:
+        for(s32 i = 0; i < sb_count(node->block.statements); ++i)
+            analyze_each_node(analysis, node->block.statements[i]);
+        break;
+    case N_If:
+        for(s32 i = 0; i < sb_count(node->if_statement.blocks); ++i) {
+            analyze_each_node(analysis, node->if_statement.conditions[i]);
+            analyze_each_node(analysis, node->if_statement.blocks[i]);
+        }
+        if(node->if_statement.else_block) analyze_each_node(analysis, node->if_statement.else_block);
+        break;
+    case N_Bin_Operator:
+        analyze_each_node(analysis, node->bin_operator.lhs);
+        analyze_each_node(analysis, node->bin_operator.rhs);
+        break;
+    case N_Variable: {
+        Each_Outer *outer = find_outer(analysis, node->variable.declaration);
+        if(outer) ++outer->reads;
+    } break;
+    case N_Index: {
+        Ast_Node *array = node->index.array;
+        if(array->type == N_Variable) {
+            Each_Outer *outer = find_outer(analysis, array->variable.declaration);
+            // Only a[index] stays within one iteration if a is written
+            if(outer && !is_loop_index(analysis, node->index.index)) outer->reads = -1;
+        }
+        else analyze_each_node(analysis, array);
+        analyze_each_node(analysis, node->index.index);
+    } break;
+    case N_Assignment: {
+        Ast_Node **indices   = node->assignment.indices;
+        Ast_Node *expression = node->assignment.expression;
+        for(s32 i = 0; i < sb_count(indices); ++i)
+            analyze_each_node(analysis, indices[i]);
+        analyze_each_node(analysis, expression);
+
+        Each_Outer *outer = find_outer(analysis, node->assignment.declaration);
+        if(!outer) break;
+        outer->written = 1;
+        if(indices) {
+            if(sb_count(indices) != 1 || !is_loop_index(analysis, indices[0])) analysis->independent = 0;
+        }
+        else if(expression->type == N_Bin_Operator && expression->bin_operator.tag == tag_plus &&
+                ((expression->bin_operator.lhs->type == N_Variable &&
+                  expression->bin_operator.lhs->variable.declaration == outer->declaration) ||
+                 (expression->bin_operator.rhs->type == N_Variable &&
+                  expression->bin_operator.rhs->variable.declaration == outer->declaration)))
+            ++outer->sums;
+        else analysis->independent = 0;
+    } break;
+    case N_Declaration:
+    case N_Number:
+    case N_String:
+        break;
+    default:
+        // Calls, jumps and nested loops
+        analysis->independent  = 0;
+        analysis->restrictable = 0;
+        break;
+    }
 }
 
+static void
+analyze_each(Each_Analysis *analysis, Ast_Node *node)
+{
+    memset(analysis, 0, sizeof(*analysis));
+    analysis->index        = node->each.array ? 0 : node->each.variable;
+    analysis->independent  = !profile;
+    analysis->restrictable = 1;
+
+    collect_locals(analysis, node->each.body);
+    qsort(analysis->locals, sb_count(analysis->locals), sizeof(Ast_Node*), compare_pointers);
+    analyze_each_node(analysis, node->each.body);
+
+    for(s32 i = 0; i < sb_count(analysis->outer); ++i) {
+        Each_Outer *outer = &analysis->outer[i];
+        if(!outer->written) continue;
+        if(is_array_type(outer->declaration->type_id)) {
+            // The array form has no index to write at
+            if(outer->reads < 0 || !analysis->index) analysis->independent = 0;
+        }
+        else if(outer->reads != outer->sums) analysis->independent = 0;
+    }
+}
+
+/*
+ * Bounds are evaluated once, before the first iteration. Temporaries are
+ * named after the loop's position like those of a match.
+ */
+void
+emit_code_for_each          (FILE *out, Ast_Node *node)
+{
+    c8 id[32];
+    snprintf(id, sizeof(id), "%i_%i", node->line, node->colm);
+
+    Ast_Node *variable = node->each.variable;
+    Ast_Node *array    = node->each.array;
+    Type_Id array_type = array ? array->type_id : TYPE_ID_UNKNOWN;
+
+    fprintf(out, "{\n");
+    if(array) {
+        c8 name[64];
+        snprintf(name, sizeof(name), "__cus_array_%s", id);
+        emit_row_pointer(out, array_type, "const ", name);
+        fprintf(out, " = ");
+        emit_code_node(out, array);
+        fprintf(out, ";\n");
+    }
+    else {
+        fprintf(out, "const int __cus_first_%s = ", id);
+        emit_code_node(out, node->each.first);
+        fprintf(out, ";\nconst int __cus_end_%s = ", id);
+        emit_code_node(out, node->each.end);
+        fprintf(out, ";\n");
+    }
+
+    Each_Analysis analysis;
+    analyze_each(&analysis, node);
+
+    // Written arrays are only reached through their restrict pointers, but
+    // for the one iterated over, which is also read through __cus_array
+    Ast_Node *iterated = array;
+    while(iterated && iterated->type == N_Index) iterated = iterated->index.array;
+    Ast_Node **restricted = 0;
+    for(s32 i = 0; analysis.restrictable && i < sb_count(analysis.outer); ++i) {
+        Ast_Node *declaration = analysis.outer[i].declaration;
+        if(!analysis.outer[i].written || !is_array_type(declaration->type_id)) continue;
+        if(iterated && iterated->type == N_Variable && iterated->variable.declaration == declaration) continue;
+        sb_push(restricted, declaration);
+    }
+    for(s32 i = 0; i < sb_count(restricted); ++i) {
+        c8 alias[64];
+        snprintf(alias, sizeof(alias), "__cus_alias_%s_%i", id, i);
+        emit_row_pointer(out, restricted[i]->type_id, "const ", alias);
+        fprintf(out, " = %s;\n", restricted[i]->declaration.identifier);
+    }
+    if(restricted) fprintf(out, "{\n");
+    for(s32 i = 0; i < sb_count(restricted); ++i) {
+        emit_row_pointer(out, restricted[i]->type_id, "restrict ", restricted[i]->declaration.identifier);
+        fprintf(out, " = __cus_alias_%s_%i;\n", id, i);
+    }
+
+    if(analysis.independent) {
+        s32 sums = 0;
+        fprintf(out, "#pragma omp simd");
+        for(s32 i = 0; i < sb_count(analysis.outer); ++i) {
+            if(!analysis.outer[i].sums) continue;
+            fprintf(out, sums++ ? ", %s" : " reduction(+:%s", analysis.outer[i].declaration->declaration.identifier);
+        }
+        fprintf(out, sums ? ")\n" : "\n");
+    }
+
+    if(array) {
+        s32 length = get_type(array_type)->length;
+        fprintf(out, "for(int __cus_index_%s = 0; __cus_index_%s < %i; ++__cus_index_%s) {\n",
+                id, id, length, id);
+        emit_code_for_declaration(out, variable);
+        fprintf(out, " = __cus_array_%s[__cus_index_%s];\n", id, id);
+        emit_code_for_block(out, node->each.body);
+        fprintf(out, "}\n");
+    }
+    else {
+        fprintf(out, "for(int %s = __cus_first_%s; %s < __cus_end_%s; ++%s) ",
+                variable->declaration.identifier, id, variable->declaration.identifier, id,
+                variable->declaration.identifier);
+        emit_code_for_block(out, node->each.body);
+    }
+
+    if(restricted) fprintf(out, "}\n");
+    fprintf(out, "}\n");
+
+    sb_free(restricted);
+    sb_free(analysis.locals);
+    sb_free(analysis.outer);
+}
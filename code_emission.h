@@ -3,8 +3,99 @@
 
 #include <stdio.h>
 #include "Ast_Node.h"
+#include "Token_Stream.h"
+#include "format.h"
+#include "profile.h"
+
+#define STRING_POOL_PREFIX "__cus_str_"
+
+/*
+ * String literals are emitted once each, as static arrays ahead of the
+ * code, numbered by their first use in the source. The emit_code
+ * functions pool the literals of their tree themselves. Streaming, which
+ * never holds the whole tree, pools each statement of the outer block
+ * with pool_statement_strings before the prologue and clears the pool
+ * after the epilogue.
+ *
+ * Returns the literal's index in the order values were first pooled,
+ * which is its id when literals are pooled in source order.
+ */
+s32
+pool_string_literal(c8 *value, s32 line, s32 colm);
+
+void
+pool_statement_strings(Ast_Node *statement);
+
+/*
+ * Specialized printf calls need stdio, and the integer writers for their
+ * conversions, ahead of the pool
+ */
+void
+pool_format_helpers(Format *format);
+
+void
+clear_string_pool(void);
 
 void
 emit_code(FILE *out, Ast_Node *root);
+
+/*
+ * Formats ranges of the root block's statements on the thread pool and
+ * writes them in order with a single writev, the output is identical to
+ * emit_code
+ */
+void
+emit_code_parallel(FILE *out, Ast_Node *root);
+
+/*
+ * Piecewise emit_code for streaming, the prologue, every statement of the
+ * root block in order, then the epilogue
+ */
+void
+emit_code_prologue(FILE *out);
+
+void
+emit_code_statement(FILE *out, Ast_Node *statement);
+
+void
+emit_code_epilogue(FILE *out);
+
+/*
+ * A module is emitted as globals for its top level declarations and an
+ * init function running the rest of its statements once, importers call
+ * it where the import statement stands
+ */
+void
+emit_module_code(FILE *out, Ast_Node *root, c8 *module_name);
+
+/*
+ * emit_code with an execution counter for every block and call site, the
+ * program writes them to the profile's data file when it exits
+ */
+void
+emit_profiled_code(FILE *out, Ast_Node *root, Profile *profile);
+
+/*
+ * C spelling of a binary operator token
+ */
+const c8*
+operator_spelling(enum Tag tag);
+
+/*
+ * Arguments of a specialized printf statement, emitted and asked whether
+ * they call functions by index
+ */
+typedef struct Format_Arguments {
+    void  *data;
+    void (*emit)(FILE *out, void *data, s32 index);
+    s32  (*calls)(void *data, s32 index);
+} Format_Arguments;
+
+/*
+ * The writes standing in for a printf statement with a simple format,
+ * which the caller wraps in a block
+ */
+void
+emit_format_writes(FILE *out, Format *format, Format_Arguments *arguments);
 #endif
 
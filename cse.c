@@ -0,0 +1,597 @@
+
+/*
+ * Common subexpression elimination
+ *
+ * Every block is walked twice with the same bookkeeping: the first walk
+ * counts how often each available expression is met again, the second
+ * replaces the ones met again by a temporary. An expression becomes
+ * available where it is first evaluated and stays so until a statement
+ * assigns one of the variables it reads, which the entries reading each
+ * variable are indexed by. Shared expressions are never modified, an
+ * expression with a rewritten operand is a copy.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cse.h"
+#include "Chain_Buffer.h"
+#include "Parser.h"
+#include "Rope.h"
+#include "Type_Table.h"
+#include "stretchy_buffer.h"
+
+#define CSE_TEMPORARY_PREFIX "__cus_cse_"
+
+typedef struct Cse_Entry {
+    Ast_Node *expression;
+    u32       hash;
+    s32       killed;
+    // Occurrences after the first one, counted by the first walk
+    s32       reuses;
+    // Made by the second walk once the first occurrence is rewritten
+    Ast_Node *temporary;
+} Cse_Entry;
+
+typedef struct Cse_Reader {
+    Ast_Node *declaration;
+    // Indices of the entries reading it, killed ones included
+    s32      *entries;
+} Cse_Reader;
+
+typedef struct Cse_Block {
+    Cse_Entry  *entries;
+    // Index + 1 into entries, open addressing on their hash
+    s32        *slots;
+    s32         slot_count;
+    Cse_Reader *readers;
+    s32        *reader_slots;
+    s32         reader_slot_count;
+
+    s32         rewriting;
+    // Inside the right side of && or ||, which may not be evaluated: values
+    // already computed are reused, nothing new becomes available
+    s32         lazy;
+    // Reuses of each entry, in order of creation, as counted by the first walk
+    s32        *reuses;
+    Ast_Node   *statement;
+    // Temporaries to declare before statement
+    Ast_Node  **prefix;
+} Cse_Block;
+
+// Sorted, module globals may change behind any call
+static Ast_Node **imported_declarations = 0;
+static s32        temporary_count       = 0;
+
+static u32
+hash_pointer(void *pointer)
+{
+    u64 key = (u64)(uintptr_t)pointer;
+    return (u32)((key >> 3) * 0x9E3779B97F4A7C15ull >> 32);
+}
+
+static s32
+compare_pointers(const void *a, const void *b)
+{
+    uintptr_t lhs = (uintptr_t)*(Ast_Node* const*)a;
+    uintptr_t rhs = (uintptr_t)*(Ast_Node* const*)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static s32
+is_imported(Ast_Node *declaration)
+{
+    return imported_declarations
+        && bsearch(&declaration, imported_declarations, sb_count(imported_declarations),
+                   sizeof(Ast_Node*), compare_pointers);
+}
+
+/*
+ * Numbers, and variables and operators over them. Hashed nodes contain
+ * neither calls nor strings once typed, so only imports are left to check.
+ */
+static s32
+is_pure(Ast_Node *node)
+{
+    if(node->hash && !imported_declarations) return 1;
+    switch(node->type)
+    {
+    case N_Number:       return 1;
+    case N_Variable:     return !is_imported(node->variable.declaration);
+    case N_Bin_Operator: return is_pure(node->bin_operator.lhs) && is_pure(node->bin_operator.rhs);
+    case N_Index:        return is_pure(node->index.array) && is_pure(node->index.index);
+    default:             return 0;
+    }
+}
+
+static s32
+is_candidate(Ast_Node *node)
+{
+    return (node->type == N_Bin_Operator || node->type == N_Index)
+        && node->type_id == TYPE_ID_INT && is_pure(node);
+}
+
+/*
+ * Variables are compared by declaration, a shared node is bound to one
+ */
+static s32
+same_expression(Ast_Node *lhs, Ast_Node *rhs)
+{
+    if(lhs == rhs) return 1;
+    if(lhs->type != rhs->type) return 0;
+    switch(lhs->type)
+    {
+    case N_Number:   return lhs->number.value == rhs->number.value;
+    case N_Variable: return lhs->variable.declaration == rhs->variable.declaration;
+    case N_Bin_Operator:
+        return lhs->bin_operator.tag == rhs->bin_operator.tag
+            && same_expression(lhs->bin_operator.lhs, rhs->bin_operator.lhs)
+            && same_expression(lhs->bin_operator.rhs, rhs->bin_operator.rhs);
+    case N_Index:
+        return same_expression(lhs->index.array, rhs->index.array)
+            && same_expression(lhs->index.index, rhs->index.index);
+    default: return 0;
+    }
+}
+
+static Cse_Reader*
+find_reader(Cse_Block *block, Ast_Node *declaration)
+{
+    if(2 * (sb_count(block->readers) + 1) > block->reader_slot_count) {
+        free(block->reader_slots);
+        block->reader_slot_count = block->reader_slot_count ? block->reader_slot_count * 2 : 256;
+        block->reader_slots      = calloc(block->reader_slot_count, sizeof(s32));
+        for(s32 i = 0; i < sb_count(block->readers); ++i) {
+            u32 slot = hash_pointer(block->readers[i].declaration) & (block->reader_slot_count - 1);
+            while(block->reader_slots[slot]) slot = (slot + 1) & (block->reader_slot_count - 1);
+            block->reader_slots[slot] = i + 1;
+        }
+    }
+
+    u32 slot = hash_pointer(declaration) & (block->reader_slot_count - 1);
+    for(; block->reader_slots[slot]; slot = (slot + 1) & (block->reader_slot_count - 1)) {
+        Cse_Reader *reader = &block->readers[block->reader_slots[slot] - 1];
+        if(reader->declaration == declaration) return reader;
+    }
+    Cse_Reader reader = { declaration, 0 };
+    sb_push(block->readers, reader);
+    block->reader_slots[slot] = sb_count(block->readers);
+    return &sb_last(block->readers);
+}
+
+static void
+add_reads(Cse_Block *block, Ast_Node *node, s32 entry)
+{
+    switch(node->type)
+    {
+    case N_Variable:
+        sb_push(find_reader(block, node->variable.declaration)->entries, entry);
+        break;
+    case N_Bin_Operator:
+        add_reads(block, node->bin_operator.lhs, entry);
+        add_reads(block, node->bin_operator.rhs, entry);
+        break;
+    case N_Index:
+        add_reads(block, node->index.array, entry);
+        add_reads(block, node->index.index, entry);
+        break;
+    default: break;
+    }
+}
+
+static void
+kill_readers(Cse_Block *block, Ast_Node *declaration)
+{
+    if(!block->reader_slot_count) return;
+    Cse_Reader *reader = find_reader(block, declaration);
+    for(s32 i = 0; i < sb_count(reader->entries); ++i)
+        block->entries[reader->entries[i]].killed = 1;
+    if(reader->entries) stb__sbn(reader->entries) = 0;
+}
+
+/*
+ * Arrays are passed by address, a call may write any array it is given
+ */
+static void
+kill_call_arguments(Cse_Block *block, Ast_Node *call)
+{
+    for(s32 i = 0; i < sb_count(call->function_call.arguments); ++i) {
+        Ast_Node *argument = call->function_call.arguments[i];
+        if(!is_array_type(argument->type_id)) continue;
+        while(argument->type == N_Index) argument = argument->index.array;
+        if(argument->type == N_Variable) kill_readers(block, argument->variable.declaration);
+    }
+}
+
+/*
+ * Every variable assigned anywhere in node, nested blocks and arrays
+ * passed to calls included
+ */
+static void
+kill_assigned(Cse_Block *block, Ast_Node *node)
+{
+    switch(node->type)
+    {
+    case N_Block:
+        for(s32 i = 0; i < sb_count(node->block.statements); ++i)
+            kill_assigned(block, node->block.statements[i]);
+        break;
+    case N_Assignment:
+        for(s32 i = 0; i < sb_count(node->assignment.indices); ++i)
+            kill_assigned(block, node->assignment.indices[i]);
+        kill_assigned(block, node->assignment.expression);
+        kill_readers(block, node->assignment.declaration);
+        break;
+    case N_Function_Call:
+        for(s32 i = 0; i < sb_count(node->function_call.arguments); ++i)
+            kill_assigned(block, node->function_call.arguments[i]);
+        kill_call_arguments(block, node);
+        break;
+    case N_Bin_Operator:
+        kill_assigned(block, node->bin_operator.lhs);
+        kill_assigned(block, node->bin_operator.rhs);
+        break;
+    case N_Index:
+        kill_assigned(block, node->index.array);
+        kill_assigned(block, node->index.index);
+        break;
+    case N_If:
+        for(s32 i = 0; i < sb_count(node->if_statement.blocks); ++i) {
+            kill_assigned(block, node->if_statement.conditions[i]);
+            kill_assigned(block, node->if_statement.blocks[i]);
+        }
+        if(node->if_statement.else_block) kill_assigned(block, node->if_statement.else_block);
+        break;
+    case N_While:
+        if(node->while_statement.condition) kill_assigned(block, node->while_statement.condition);
+        kill_assigned(block, node->while_statement.body);
+        break;
+    case N_Match:
+        kill_assigned(block, node->match.expression);
+        for(s32 i = 0; i < sb_count(node->match.blocks); ++i)
+            kill_assigned(block, node->match.blocks[i]);
+        if(node->match.default_block) kill_assigned(block, node->match.default_block);
+        break;
+    case N_Each:
+        if(node->each.array) kill_assigned(block, node->each.array);
+        else {
+            kill_assigned(block, node->each.first);
+            kill_assigned(block, node->each.end);
+        }
+        kill_readers(block, node->each.variable);
+        kill_assigned(block, node->each.body);
+        break;
+    case N_Return:
+        if(node->return_statement.expression) kill_assigned(block, node->return_statement.expression);
+        break;
+    default: break;
+    }
+}
+
+static s32
+find_entry(Cse_Block *block, Ast_Node *node, u32 hash)
+{
+    if(!block->slot_count) return -1;
+    u32 slot = hash & (block->slot_count - 1);
+    for(; block->slots[slot]; slot = (slot + 1) & (block->slot_count - 1)) {
+        s32 entry = block->slots[slot] - 1;
+        if(block->entries[entry].hash == hash && !block->entries[entry].killed
+           && same_expression(block->entries[entry].expression, node))
+            return entry;
+    }
+    return -1;
+}
+
+static s32
+add_entry(Cse_Block *block, Ast_Node *node, u32 hash)
+{
+    if(2 * (sb_count(block->entries) + 1) > block->slot_count) {
+        free(block->slots);
+        block->slot_count = block->slot_count ? block->slot_count * 2 : 256;
+        block->slots      = calloc(block->slot_count, sizeof(s32));
+        for(s32 i = 0; i < sb_count(block->entries); ++i) {
+            u32 slot = block->entries[i].hash & (block->slot_count - 1);
+            while(block->slots[slot]) slot = (slot + 1) & (block->slot_count - 1);
+            block->slots[slot] = i + 1;
+        }
+    }
+
+    s32 entry = sb_count(block->entries);
+    Cse_Entry added = { node, hash, 0, block->rewriting ? block->reuses[entry] : 0, 0 };
+    sb_push(block->entries, added);
+
+    u32 slot = hash & (block->slot_count - 1);
+    while(block->slots[slot]) slot = (slot + 1) & (block->slot_count - 1);
+    block->slots[slot] = entry + 1;
+    add_reads(block, node, entry);
+    return entry;
+}
+
+static Ast_Node*
+new_node_at(enum Node_Type type, Ast_Node *site)
+{
+    Ast_Node *result = chain_reserve(Ast_Node);
+    memset(result, 0, sizeof(*result));
+    result->type = type;
+    result->file = site->file;
+    result->line = site->line;
+    result->colm = site->colm;
+    return result;
+}
+
+/*
+ * Declares a temporary assigned expression ahead of the statement, the
+ * variable returned is shared by every use of it
+ */
+static Ast_Node*
+new_temporary(Cse_Block *block, Ast_Node *expression)
+{
+    c8 name[32];
+    snprintf(name, sizeof(name), CSE_TEMPORARY_PREFIX "%i", temporary_count++);
+
+    Ast_Node *declaration = new_node_at(N_Declaration, block->statement);
+    declaration->type_id                = TYPE_ID_INT;
+    declaration->declaration.identifier = intern_string(name);
+    declaration->declaration.type       = get_type(TYPE_ID_INT)->name;
+
+    Ast_Node *assignment = new_node_at(N_Assignment, block->statement);
+    assignment->type_id                = TYPE_ID_INT;
+    assignment->assignment.identifier  = declaration->declaration.identifier;
+    assignment->assignment.expression  = expression;
+    assignment->assignment.declaration = declaration;
+
+    sb_push(block->prefix, declaration);
+    sb_push(block->prefix, assignment);
+
+    Ast_Node *variable = new_node_at(N_Variable, expression);
+    variable->type_id              = TYPE_ID_INT;
+    variable->variable.identifier  = declaration->declaration.identifier;
+    variable->variable.declaration = declaration;
+    variable->hash                 = expression_hash(variable);
+    return variable;
+}
+
+/*
+ * Returns what takes the place of node, which is only ever node itself
+ * during the first walk
+ */
+static Ast_Node*
+cse_expression(Cse_Block *block, Ast_Node *node)
+{
+    if(node->type == N_Function_Call) {
+        // Calls are never shared, their arguments are rewritten in place.
+        // What the call may write is unavailable to the rest of the statement.
+        for(s32 i = 0; i < sb_count(node->function_call.arguments); ++i)
+            node->function_call.arguments[i] = cse_expression(block, node->function_call.arguments[i]);
+        kill_call_arguments(block, node);
+        return node;
+    }
+    if(node->type != N_Bin_Operator && node->type != N_Index) return node;
+
+    s32 entry = -1;
+    if(is_candidate(node)) {
+        u32 hash = expression_hash(node);
+        s32 available = find_entry(block, node, hash);
+        if(available >= 0) {
+            if(!block->rewriting) ++block->entries[available].reuses;
+            return block->rewriting ? block->entries[available].temporary : node;
+        }
+        if(!block->lazy) entry = add_entry(block, node, hash);
+    }
+
+    Ast_Node *result = node;
+    if(node->type == N_Index) {
+        Ast_Node *array = cse_expression(block, node->index.array);
+        Ast_Node *index = cse_expression(block, node->index.index);
+        if(array != node->index.array || index != node->index.index) {
+            result = copy_node(node);
+            result->hash        = 0;
+            result->index.array = array;
+            result->index.index = index;
+        }
+    }
+    else {
+        s32 lazy = node->bin_operator.tag == tag_and || node->bin_operator.tag == tag_or;
+        Ast_Node *lhs = cse_expression(block, node->bin_operator.lhs);
+        block->lazy += lazy;
+        Ast_Node *rhs = cse_expression(block, node->bin_operator.rhs);
+        block->lazy -= lazy;
+        if(lhs != node->bin_operator.lhs || rhs != node->bin_operator.rhs) {
+            result = copy_node(node);
+            result->hash             = 0;
+            result->bin_operator.lhs = lhs;
+            result->bin_operator.rhs = rhs;
+        }
+    }
+
+    if(entry >= 0 && block->rewriting && block->entries[entry].reuses)
+        result = block->entries[entry].temporary = new_temporary(block, result);
+    return result;
+}
+
+/*
+ * Only the expressions a statement evaluates before anything else it does
+ */
+static void
+cse_statement(Cse_Block *block, Ast_Node **slot)
+{
+    Ast_Node *node = *slot;
+    switch(node->type)
+    {
+    case N_Assignment:
+        for(s32 i = 0; i < sb_count(node->assignment.indices); ++i)
+            node->assignment.indices[i] = cse_expression(block, node->assignment.indices[i]);
+        node->assignment.expression = cse_expression(block, node->assignment.expression);
+        break;
+    case N_Function_Call:
+    case N_Bin_Operator:
+    case N_Index:
+        *slot = cse_expression(block, node);
+        break;
+    case N_If:
+        node->if_statement.conditions[0] = cse_expression(block, node->if_statement.conditions[0]);
+        break;
+    case N_Match:
+        node->match.expression = cse_expression(block, node->match.expression);
+        break;
+    case N_Each:
+        if(node->each.array) node->each.array = cse_expression(block, node->each.array);
+        else {
+            node->each.first = cse_expression(block, node->each.first);
+            node->each.end   = cse_expression(block, node->each.end);
+        }
+        break;
+    case N_Return:
+        if(node->return_statement.expression)
+            node->return_statement.expression = cse_expression(block, node->return_statement.expression);
+        break;
+    default: break;
+    }
+}
+
+static void
+clear_cse_block(Cse_Block *block)
+{
+    for(s32 i = 0; i < sb_count(block->readers); ++i)
+        sb_free(block->readers[i].entries);
+    sb_free(block->readers);
+    sb_free(block->entries);
+    free(block->slots);
+    free(block->reader_slots);
+    block->readers           = 0;
+    block->entries           = 0;
+    block->slots             = 0;
+    block->slot_count        = 0;
+    block->reader_slots      = 0;
+    block->reader_slot_count = 0;
+}
+
+static void
+cse_nested_blocks(Ast_Node *node);
+
+static void
+cse_block(Ast_Node *node)
+{
+    Ast_Node **statements = node->block.statements;
+    s32        count      = sb_count(statements);
+    Cse_Block  block      = {0};
+
+    for(s32 i = 0; i < count; ++i) {
+        block.statement = statements[i];
+        cse_statement(&block, &statements[i]);
+        kill_assigned(&block, statements[i]);
+    }
+
+    s32 reused = 0;
+    for(s32 i = 0; i < sb_count(block.entries); ++i) {
+        sb_push(block.reuses, block.entries[i].reuses);
+        reused |= block.entries[i].reuses;
+    }
+    clear_cse_block(&block);
+
+    if(reused) {
+        Ast_Node **rewritten = 0;
+        block.rewriting = 1;
+        for(s32 i = 0; i < count; ++i) {
+            block.statement = statements[i];
+            cse_statement(&block, &statements[i]);
+            kill_assigned(&block, statements[i]);
+            for(s32 j = 0; j < sb_count(block.prefix); ++j)
+                sb_push(rewritten, block.prefix[j]);
+            if(block.prefix) stb__sbn(block.prefix) = 0;
+            sb_push(rewritten, statements[i]);
+        }
+        sb_free(statements);
+        node->block.statements = rewritten;
+        clear_cse_block(&block);
+    }
+    sb_free(block.reuses);
+    sb_free(block.prefix);
+
+    for(s32 i = 0; i < sb_count(node->block.statements); ++i)
+        cse_nested_blocks(node->block.statements[i]);
+}
+
+static void
+cse_nested_blocks(Ast_Node *node)
+{
+    switch(node->type)
+    {
+    case N_Block:
+        cse_block(node);
+        break;
+    case N_If:
+        for(s32 i = 0; i < sb_count(node->if_statement.blocks); ++i)
+            cse_block(node->if_statement.blocks[i]);
+        if(node->if_statement.else_block) cse_block(node->if_statement.else_block);
+        break;
+    case N_While:
+        cse_block(node->while_statement.body);
+        break;
+    case N_Match:
+        for(s32 i = 0; i < sb_count(node->match.blocks); ++i)
+            cse_block(node->match.blocks[i]);
+        if(node->match.default_block) cse_block(node->match.default_block);
+        break;
+    case N_Each:
+        cse_block(node->each.body);
+        break;
+    default: break;
+    }
+}
+
+/*
+ * Gathers the imported declarations, returns whether there are labels
+ */
+static s32
+scan_program(Ast_Node *node)
+{
+    s32 labels = 0;
+    switch(node->type)
+    {
+    case N_Block:
+        for(s32 i = 0; i < sb_count(node->block.statements); ++i)
+            labels |= scan_program(node->block.statements[i]);
+        break;
+    case N_Import:
+        for(s32 i = 0; i < sb_count(node->import.declarations); ++i)
+            sb_push(imported_declarations, node->import.declarations[i]);
+        break;
+    case N_If:
+        for(s32 i = 0; i < sb_count(node->if_statement.blocks); ++i)
+            labels |= scan_program(node->if_statement.blocks[i]);
+        if(node->if_statement.else_block) labels |= scan_program(node->if_statement.else_block);
+        break;
+    case N_While:
+        labels |= scan_program(node->while_statement.body);
+        break;
+    case N_Match:
+        for(s32 i = 0; i < sb_count(node->match.blocks); ++i)
+            labels |= scan_program(node->match.blocks[i]);
+        if(node->match.default_block) labels |= scan_program(node->match.default_block);
+        break;
+    case N_Each:
+        labels |= scan_program(node->each.body);
+        break;
+    case N_Label:
+    case N_Goto:
+        labels = 1;
+        break;
+    default: break;
+    }
+    return labels;
+}
+
+void
+eliminate_common_subexpressions(Ast_Node *root)
+{
+    temporary_count = 0;
+    if(!scan_program(root)) {
+        if(imported_declarations)
+            qsort(imported_declarations, sb_count(imported_declarations), sizeof(Ast_Node*), compare_pointers);
+        cse_block(root);
+    }
+    sb_free(imported_declarations);
+    imported_declarations = 0;
+}
@@ -0,0 +1,18 @@
+#ifndef CSE_H_
+#define CSE_H_
+
+#include "Ast_Node.h"
+
+/*
+ * Common subexpression elimination
+ * Within each block, a pure integer expression evaluated again while its
+ * operands still hold the same values is computed once, into a temporary
+ * declared before the statement evaluating it first. Only expressions
+ * every statement evaluates unconditionally take part, so no expression
+ * is evaluated where it wasn't before. Runs on a resolved and typed tree,
+ * programs with labels are left alone as a goto could skip a temporary.
+ */
+void
+eliminate_common_subexpressions(Ast_Node *root);
+
+#endif
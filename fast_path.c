@@ -0,0 +1,438 @@
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fast_path.h"
+#include "Chain_Buffer.h"
+#include "Parser.h"
+#include "Symbol_Table.h"
+#include "Type_Table.h"
+#include "code_emission.h"
+#include "format.h"
+#include "stretchy_buffer.h"
+
+typedef struct Fast_Compiler {
+    Token_Stream *stream;
+    Symbol_Table  symbols;
+    FILE         *body;
+    // C of the statement being compiled, expressions are parenthesized
+    // by inserting in front of their left operand
+    c8           *text;
+    s32           depth;
+    s32           operator_count;
+    // Calls parsed so far, tells arguments that call functions apart
+    s32           call_count;
+    s32           failed;
+} Fast_Compiler;
+
+// Where the arguments of a printf statement ended up in the text
+typedef struct Fast_Arguments {
+    Fast_Compiler *compiler;
+    s32           *starts;
+    s32           *ends;
+    s32           *calls;
+} Fast_Arguments;
+
+static Type_Id
+fast_binary(Fast_Compiler *compiler, s32 min_precedence);
+
+static void
+give_up(Fast_Compiler *compiler)
+{
+    compiler->failed = 1;
+}
+
+static void
+append(Fast_Compiler *compiler, const c8 *format, ...)
+{
+    c8 buffer[256];
+    va_list args;
+    va_start(args, format);
+    s32 length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if(length >= (s32)sizeof(buffer)) {
+        va_start(args, format);
+        vsnprintf(sb_add(compiler->text, length + 1), length + 1, format, args);
+        va_end(args);
+        stb__sbn(compiler->text)--;
+    }
+    else memcpy(sb_add(compiler->text, length), buffer, length);
+}
+
+static void
+flush_statement(Fast_Compiler *compiler, const c8 *end)
+{
+    fwrite(compiler->text, 1, sb_count(compiler->text), compiler->body);
+    fputs(end, compiler->body);
+    if(compiler->text) stb__sbn(compiler->text) = 0;
+}
+
+/*
+ * printf calls with a literal format are checked as the typer does, the
+ * format has to be the literal itself rather than an expression of it.
+ * format is only given for a call standing alone, if its format is simple
+ * it is returned there and the literal isn't pooled.
+ */
+static void
+fast_call(Fast_Compiler *compiler, Fast_Arguments *arguments, Format *format)
+{
+    Token name = *eat_token(compiler->stream);
+    eat_token(compiler->stream);
+    append(compiler, "%s(", name.lexeme);
+    ++compiler->call_count;
+    if(compiler->depth >= PARSER_MAX_DEPTH) {
+        give_up(compiler);
+        return;
+    }
+
+    s32 is_printf = strcmp(name.lexeme, "printf") == 0;
+    c8 *literal   = 0;
+    Token first   = *peek_token(compiler->stream);
+    if(is_printf && first.tag == tag_lbrack) {
+        give_up(compiler);
+        return;
+    }
+    if(is_printf && first.tag == tag_string) {
+        enum Tag next = lookahead_token(compiler->stream, 1)->tag;
+        if(next == tag_comma || next == tag_rbrack) literal = string_literal_value(first.lexeme, first.length);
+    }
+    Format parsed = { 0 };
+    if(literal) parse_format(&parsed, literal);
+    s32 specialized = format && parsed.simple;
+
+    Type_Id *types = 0;
+    ++compiler->depth;
+    if(peek_token(compiler->stream)->tag != tag_rbrack) {
+        for(s32 i = 0; !compiler->failed; ++i) {
+            if(i) append(compiler, ", ");
+            s32 start = sb_count(compiler->text);
+            s32 calls = compiler->call_count;
+            if(i == 0 && specialized) {
+                eat_token(compiler->stream);
+                sb_push(types, TYPE_ID_STRING);
+            }
+            else sb_push(types, fast_binary(compiler, 1));
+            if(arguments && i) {
+                sb_push(arguments->starts, start);
+                sb_push(arguments->ends, sb_count(compiler->text));
+                sb_push(arguments->calls, compiler->call_count != calls);
+            }
+            if(peek_token(compiler->stream)->tag != tag_comma) break;
+            eat_token(compiler->stream);
+        }
+    }
+    --compiler->depth;
+    if(peek_token(compiler->stream)->tag != tag_rbrack) give_up(compiler);
+    eat_token(compiler->stream);
+    append(compiler, ")");
+
+    if(literal && !compiler->failed) {
+        s32 valid = !parsed.checked || parsed.argument_count == sb_count(types) - 1;
+        for(s32 i = 0, argument = 1; valid && i < sb_count(parsed.pieces); ++i) {
+            c8 conversion = parsed.pieces[i].conversion;
+            if(!conversion) continue;
+            Type_Id type = types[argument++];
+            if(conversion != '?' && !is_assignable(conversion == 's' ? TYPE_ID_STRING : TYPE_ID_INT, type))
+                valid = 0;
+        }
+
+        if(!valid) give_up(compiler);
+    }
+    if(specialized && !compiler->failed) {
+        pool_format_helpers(&parsed);
+        *format = parsed;
+    }
+    else free_format(&parsed);
+    sb_free(types);
+}
+
+static Type_Id
+fast_operand(Fast_Compiler *compiler)
+{
+    Token peek = *peek_token(compiler->stream);
+    if(peek.tag == tag_id) {
+        if(lookahead_token(compiler->stream, 1)->tag == tag_lbrack) {
+            fast_call(compiler, 0, 0);
+            return TYPE_ID_UNKNOWN;
+        }
+
+        Ast_Node *declaration = lookup_symbol(&compiler->symbols, peek.lexeme);
+        eat_token(compiler->stream);
+        if(!declaration || peek_token(compiler->stream)->tag == tag_lsquarebrack) {
+            give_up(compiler);
+            return TYPE_ID_UNKNOWN;
+        }
+        append(compiler, "%s", peek.lexeme);
+        return declaration->type_id;
+    }
+
+    if(peek.tag == tag_number) {
+        eat_token(compiler->stream);
+        append(compiler, "%i", peek.number);
+        return TYPE_ID_INT;
+    }
+
+    if(peek.tag == tag_string) {
+        eat_token(compiler->stream);
+        s32 id = pool_string_literal(string_literal_value(peek.lexeme, peek.length), peek.line, peek.colm);
+        append(compiler, STRING_POOL_PREFIX "%i", id);
+        return TYPE_ID_STRING;
+    }
+
+    give_up(compiler);
+    return TYPE_ID_UNKNOWN;
+}
+
+/*
+ * As parse_unary, -x is written as (0 - x) and !x as (x == 0)
+ */
+static Type_Id
+fast_unary(Fast_Compiler *compiler)
+{
+    Token peek = *peek_token(compiler->stream);
+    if(peek.tag != tag_minus && peek.tag != tag_bang && peek.tag != tag_lbrack)
+        return fast_operand(compiler);
+
+    if(peek.tag == tag_minus && lookahead_token(compiler->stream, 1)->tag == tag_number) {
+        eat_token(compiler->stream);
+        append(compiler, "%i", (s32)(0u - (u32)eat_token(compiler->stream)->number));
+        return TYPE_ID_INT;
+    }
+
+    if(compiler->depth >= PARSER_MAX_DEPTH) {
+        give_up(compiler);
+        return TYPE_ID_UNKNOWN;
+    }
+
+    eat_token(compiler->stream);
+    ++compiler->depth;
+    Type_Id result = TYPE_ID_INT;
+    if(peek.tag == tag_lbrack) {
+        result = fast_binary(compiler, 1);
+        if(peek_token(compiler->stream)->tag != tag_rbrack) give_up(compiler);
+        eat_token(compiler->stream);
+    }
+    else {
+        if(peek.tag == tag_minus) append(compiler, "(0 - ");
+        else                      append(compiler, "(");
+        if(!is_assignable(TYPE_ID_INT, fast_unary(compiler))) give_up(compiler);
+        append(compiler, peek.tag == tag_minus ? ")" : " == 0)");
+    }
+    --compiler->depth;
+    return result;
+}
+
+static Type_Id
+fast_binary(Fast_Compiler *compiler, s32 min_precedence)
+{
+    s32 start   = sb_count(compiler->text);
+    Type_Id lhs = fast_unary(compiler);
+    while(!compiler->failed) {
+        enum Tag op = peek_token(compiler->stream)->tag;
+        s32 precedence = binary_precedence(op);
+        if(!precedence || precedence < min_precedence) break;
+
+        if(++compiler->operator_count > PARSER_MAX_OPERATORS) {
+            give_up(compiler);
+            break;
+        }
+        eat_token(compiler->stream);
+        sb_add(compiler->text, 1);
+        memmove(compiler->text + start + 1, compiler->text + start, sb_count(compiler->text) - start - 1);
+        compiler->text[start] = '(';
+        append(compiler, " %s ", operator_spelling(op));
+        Type_Id rhs = fast_binary(compiler, precedence + 1);
+        append(compiler, ")");
+        if(!is_assignable(TYPE_ID_INT, lhs) || !is_assignable(TYPE_ID_INT, rhs)) give_up(compiler);
+        lhs = TYPE_ID_INT;
+    }
+    return lhs;
+}
+
+static void
+emit_fast_argument(FILE *out, void *data, s32 index)
+{
+    Fast_Arguments *arguments = data;
+    fwrite(arguments->compiler->text + arguments->starts[index], 1,
+           arguments->ends[index] - arguments->starts[index], out);
+}
+
+static s32
+fast_argument_calls(void *data, s32 index)
+{
+    return ((Fast_Arguments*)data)->calls[index];
+}
+
+/*
+ * A call standing alone, which for printf with a simple literal format is
+ * written the way emit_code_for_format does
+ */
+static void
+fast_call_statement(Fast_Compiler *compiler)
+{
+    Fast_Arguments arguments = { compiler, 0, 0, 0 };
+    Format format = { 0 };
+    fast_call(compiler, &arguments, &format);
+    if(binary_precedence(peek_token(compiler->stream)->tag) || peek_token(compiler->stream)->tag == tag_equal)
+        give_up(compiler);
+
+    if(!compiler->failed && format.simple) {
+        Format_Arguments writes = { &arguments, emit_fast_argument, fast_argument_calls };
+        fputs("{\n", compiler->body);
+        emit_format_writes(compiler->body, &format, &writes);
+        fputs("}\n", compiler->body);
+        stb__sbn(compiler->text) = 0;
+    }
+    else if(!compiler->failed) flush_statement(compiler, ";\n");
+
+    free_format(&format);
+    sb_free(arguments.starts);
+    sb_free(arguments.ends);
+    sb_free(arguments.calls);
+}
+
+static void
+fast_block(Fast_Compiler *compiler);
+
+static void
+fast_statement(Fast_Compiler *compiler)
+{
+    Token peek = *peek_token(compiler->stream);
+    compiler->operator_count = 0;
+
+    if(peek.tag == tag_lcurlybrack) {
+        fast_block(compiler);
+        if(!compiler->failed) fputs(";\n", compiler->body);
+        return;
+    }
+    if(peek.tag != tag_id) {
+        give_up(compiler);
+        return;
+    }
+
+    enum Tag next = lookahead_token(compiler->stream, 1)->tag;
+    if(next == tag_colon) {
+        eat_token(compiler->stream);
+        eat_token(compiler->stream);
+        Token type = *eat_token(compiler->stream);
+        Type_Id type_id = type.tag == tag_id ? find_type(type.lexeme) : TYPE_ID_UNKNOWN;
+        if(type_id == TYPE_ID_UNKNOWN || is_array_type(type_id)) {
+            give_up(compiler);
+            return;
+        }
+
+        Ast_Node *declaration = chain_reserve(Ast_Node);
+        declaration->type                  = N_Declaration;
+        declaration->type_id               = type_id;
+        declaration->file                  = peek.file;
+        declaration->line                  = peek.line;
+        declaration->colm                  = peek.colm;
+        declaration->hash                  = 0;
+        declaration->declaration.identifier = peek.lexeme;
+        declaration->declaration.type       = type.lexeme;
+        declaration->declaration.read_only  = 0;
+        if(declare_symbol(&compiler->symbols, declaration)) {
+            give_up(compiler);
+            return;
+        }
+        append(compiler, "%s %s", get_type(type_id)->c_name, peek.lexeme);
+        flush_statement(compiler, ";\n");
+    }
+    else if(next == tag_equal) {
+        Ast_Node *declaration = lookup_symbol(&compiler->symbols, peek.lexeme);
+        eat_token(compiler->stream);
+        eat_token(compiler->stream);
+        if(!declaration || declaration->declaration.read_only) {
+            give_up(compiler);
+            return;
+        }
+        append(compiler, "%s = ", peek.lexeme);
+        if(!is_assignable(declaration->type_id, fast_binary(compiler, 1))) give_up(compiler);
+        if(!compiler->failed) flush_statement(compiler, ";\n");
+    }
+    else if(next == tag_lbrack) {
+        fast_call_statement(compiler);
+    }
+    else {
+        fast_binary(compiler, 1);
+        if(peek_token(compiler->stream)->tag == tag_equal) give_up(compiler);
+        if(!compiler->failed) flush_statement(compiler, ";\n");
+    }
+}
+
+/*
+ * The brackets of the outer block are written by the prologue and
+ * epilogue
+ */
+static void
+fast_statements(Fast_Compiler *compiler)
+{
+    eat_token(compiler->stream);
+    if(compiler->depth >= PARSER_MAX_DEPTH) {
+        give_up(compiler);
+        return;
+    }
+
+    ++compiler->depth;
+    enter_scope(&compiler->symbols);
+    while(!compiler->failed) {
+        enum Tag tag = peek_token(compiler->stream)->tag;
+        if(tag == tag_rcurlybrack) break;
+        if(tag == tag_eof) give_up(compiler);
+        else               fast_statement(compiler);
+        discard_consumed_tokens(compiler->stream);
+    }
+    leave_scope(&compiler->symbols);
+    --compiler->depth;
+    eat_token(compiler->stream);
+}
+
+static void
+fast_block(Fast_Compiler *compiler)
+{
+    fputs("{\n", compiler->body);
+    fast_statements(compiler);
+    fputs("}\n", compiler->body);
+}
+
+s32
+fast_compile_file(FILE *out, c8 *file_name)
+{
+    Token_Stream stream = {0};
+    stream.quiet = 1;
+    open_token_stream(&stream, file_name);
+
+    Fast_Compiler compiler = {0};
+    compiler.stream = &stream;
+
+    c8    *body = 0;
+    size_t size = 0;
+    compiler.body = open_memstream(&body, &size);
+
+    // Tokens after the outer block are left for the full parser to report
+    Chain_Mark mark = chain_mark();
+    if(peek_token(&stream)->tag != tag_lcurlybrack) give_up(&compiler);
+    else {
+        fast_statements(&compiler);
+        if(!compiler.failed && peek_token(&stream)->tag != tag_eof) give_up(&compiler);
+    }
+    fclose(compiler.body);
+
+    // The pool is complete only now, the body waits for it
+    s32 compiled = !compiler.failed && !stream.error_count;
+    if(compiled) {
+        emit_code_prologue(out);
+        fwrite(body, 1, size, out);
+        emit_code_epilogue(out);
+    }
+    clear_string_pool();
+
+    free(body);
+    sb_free(compiler.text);
+    chain_release(mark);
+    free_symbol_table(&compiler.symbols);
+    close_token_stream(&stream);
+    return compiled;
+}
@@ -0,0 +1,20 @@
+#ifndef FAST_PATH_H_
+#define FAST_PATH_H_
+
+#include <stdio.h>
+#include "types.h"
+
+/*
+ * Single pass compilation
+ * Straight-line programs, declarations of scalars, assignments, calls and
+ * plain blocks, are compiled while they are parsed: every construct is
+ * checked against the symbol table and written as C as soon as it is
+ * recognized, only declarations are kept as nodes. Anything else, and
+ * anything that would be an error, makes it give up without writing a
+ * byte, for the full pipeline to compile or report. Output is identical
+ * to emit_code. Returns 0 if it gave up.
+ */
+s32
+fast_compile_file(FILE *out, c8 *file_name);
+
+#endif
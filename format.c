@@ -0,0 +1,106 @@
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+
+#include "format.h"
+#include "Token_Stream.h"
+#include "stretchy_buffer.h"
+
+Ast_Node*
+literal_format(Ast_Node *call)
+{
+    if(call->type != N_Function_Call || strcmp(call->function_call.identifier, "printf") != 0)
+        return 0;
+    if(!sb_count(call->function_call.arguments) || call->function_call.arguments[0]->type != N_String)
+        return 0;
+    return call->function_call.arguments[0];
+}
+
+static void
+push_piece(Format *format, c8 conversion, s32 offset, s32 length)
+{
+    if(!conversion && !length) return;
+    Format_Piece piece = { conversion, offset, length };
+    sb_push(format->pieces, piece);
+    if(conversion) ++format->argument_count;
+}
+
+/*
+ * Flags, width, precision and the h and hh lengths are checked but not
+ * specialized. Other lengths and the floating point and pointer
+ * conversions still take one argument each, only its kind is unchecked.
+ */
+void
+parse_format(Format *format, c8 *value)
+{
+    memset(format, 0, sizeof(*format));
+    format->simple  = 1;
+    format->checked = 1;
+
+    u32 length = strlen(value);
+    c8 *bytes  = malloc(length + 1);
+    length = decode_string_literal(value, length, bytes);
+    // printf stops at the first NUL
+    length = strnlen(bytes, length);
+
+    s32 text = 0;
+    for(s32 i = 0; i < (s32)length && format->checked; ++i) {
+        if(bytes[i] != '%') continue;
+        if(i + 1 < (s32)length && bytes[i + 1] == '%') {
+            // The first % stays in the text
+            push_piece(format, 0, text, i + 1 - text);
+            text = ++i + 1;
+            continue;
+        }
+        push_piece(format, 0, text, i - text);
+
+        s32 at = i + 1;
+        while(at < (s32)length && strchr("-+ #0", bytes[at])) ++at;
+        if(at < (s32)length && bytes[at] == '*') push_piece(format, '*', 0, 0), ++at;
+        else while(at < (s32)length && bytes[at] >= '0' && bytes[at] <= '9') ++at;
+        if(at < (s32)length && bytes[at] == '.') {
+            ++at;
+            if(at < (s32)length && bytes[at] == '*') push_piece(format, '*', 0, 0), ++at;
+            else while(at < (s32)length && bytes[at] >= '0' && bytes[at] <= '9') ++at;
+        }
+        s32 shorts = 0;
+        while(at < (s32)length && bytes[at] == 'h') ++at, ++shorts;
+        s32 longs = 0;
+        while(at < (s32)length && strchr("lLjztq", bytes[at])) ++at, ++longs;
+        if(at > i + 1) format->simple = 0;
+
+        c8 conversion = at < (s32)length ? bytes[at] : 0;
+        if(!conversion || !strchr("diouxXcseEfFgGaApn", conversion)) {
+            format->checked = 0;
+            break;
+        }
+        if(longs || shorts > 2 || (shorts && conversion == 's') || !strchr("diouxXcs", conversion)) {
+            push_piece(format, '?', 0, 0);
+            format->simple = 0;
+        }
+        else {
+            push_piece(format, conversion, 0, 0);
+            if(strchr("oX", conversion)) format->simple = 0;
+        }
+        text = i = at;
+        ++text;
+    }
+    push_piece(format, 0, text, length - text);
+
+    format->text = bytes;
+    if(!format->checked) {
+        free_format(format);
+        format->simple = 0;
+    }
+}
+
+void
+free_format(Format *format)
+{
+    sb_free(format->pieces);
+    free(format->text);
+    format->pieces         = 0;
+    format->text           = 0;
+    format->argument_count = 0;
+}
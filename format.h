@@ -0,0 +1,51 @@
+#ifndef FORMAT_H_
+#define FORMAT_H_
+
+#include "Ast_Node.h"
+
+/*
+ * printf formats known at compile time
+ * A call of printf whose first argument is a string literal has its
+ * arguments checked against the format by the typer, and when every
+ * conversion is a plain %d %i %u %x %c or %s (no flags, width, precision
+ * or length) the emitter writes the pieces directly instead of having
+ * printf parse the format at run time. Anything else is left to printf.
+ */
+
+typedef struct Format_Piece {
+    // 0 for text, otherwise the conversion character, '*' for a width or
+    // precision taken from the arguments, '?' for an argument of a kind
+    // that isn't checked
+    c8  conversion;
+    // Text pieces, a slice of the decoded format
+    s32 offset;
+    s32 length;
+} Format_Piece;
+
+typedef struct Format {
+    Format_Piece *pieces;
+    // The decoded format, up to its first NUL
+    c8           *text;
+    s32           argument_count;
+    s32           simple;
+    // 0 if some conversion isn't understood, then nothing is known about
+    // the arguments
+    s32           checked;
+} Format;
+
+/*
+ * The format literal of a printf call, 0 for any other call
+ */
+Ast_Node*
+literal_format(Ast_Node *call);
+
+/*
+ * Splits a canonical string literal value into pieces
+ */
+void
+parse_format(Format *format, c8 *value);
+
+void
+free_format(Format *format);
+
+#endif
@@ -0,0 +1,436 @@
+/*
+ * Differential harness against the C# reference compiler in Custom/
+ *
+ * Generates corpora in the subset of the language both implementations
+ * accept, compiles every corpus with both and compares the emitted C once
+ * it is normalized: whitespace outside string literals is dropped, our
+ * string pool is inlined back into the code and each compiler's wrapping
+ * of main is removed. The throughput of each compiler is the best of a
+ * few runs of the whole process, startup included.
+ *
+ *     differential compiler [reference command...]
+ *
+ * The reference command is run with the corpus path appended, in a
+ * scratch directory since it writes out.c to its working directory.
+ * Without one only our compiler is run and timed.
+ */
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../types.h"
+#include "../stretchy_buffer.h"
+
+#define CORPUS_STATEMENTS 100000
+#define TIMED_RUNS        3
+#define CONTEXT_LENGTH    40
+#define NESTING_DEPTH     200
+
+// Wrapping of the root block left after normalization
+#define OURS_PREFIX      "intmain(){"
+#define OURS_SUFFIX      "return0;}"
+#define REFERENCE_PREFIX "#include\"stdio.h\"intmain(intargc,int**argv)"
+
+#define POOL_PREFIX "__cus_str_"
+
+typedef c8* (*Corpus_Generator)(c8 *out, s32 n);
+
+typedef struct Corpus {
+    const c8         *name;
+    Corpus_Generator  generate;
+} Corpus;
+
+typedef struct Run {
+    c8  *output;
+    r64  seconds;
+    s32  failed;
+} Run;
+
+/*
+ * Corpora
+ * Only blocks, int declarations, assignments and calls with number,
+ * string and variable arguments, which is all the reference parses.
+ * Names avoid the keywords of both. Within that, the reference
+ * - crashes on calls without arguments,
+ * - never consumes a block's closing bracket, so a nested block ends
+ *   every block around it and may only come last,
+ * - declares string variables as string where we emit const char*,
+ * - ends a string literal at an escaped quote,
+ * so calls always get arguments, nesting is a single chain and strings
+ * are only passed as literals, without escaped quotes.
+ */
+
+static u32 random_state = 0x2545F491;
+
+static u32
+next_random(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static c8*
+append(c8 *out, const c8 *text)
+{
+    size_t length = strlen(text);
+    memcpy(sb_add(out, length), text, length);
+    return out;
+}
+
+static c8*
+appendf(c8 *out, const c8 *format, ...)
+{
+    c8 line[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    return append(out, line);
+}
+
+static c8*
+corpus_declarations(c8 *out, s32 n)
+{
+    for(s32 i = 0; i < n / 2; ++i)
+        out = appendf(out, "v%i : int\nv%i = %u\n", i, i, next_random() % 100000);
+    return out;
+}
+
+static c8*
+corpus_calls(c8 *out, s32 n)
+{
+    for(s32 i = 0; i < 16; ++i)
+        out = appendf(out, "v%i : int\nv%i = %i\n", i, i, i);
+    for(s32 i = 0; i < n; ++i) {
+        out = appendf(out, "f%u(", next_random() % 8);
+        s32 arguments = 1 + next_random() % 5;
+        for(s32 a = 0; a < arguments; ++a) {
+            if(a) out = append(out, ", ");
+            switch(next_random() % 3)
+            {
+            case 0 : out = appendf(out, "v%u", next_random() % 16); break;
+            case 1 : out = appendf(out, "%u", next_random() % 1000); break;
+            default: out = appendf(out, "\"text %u\"", next_random() % 64); break;
+            }
+        }
+        out = append(out, ")\n");
+    }
+    return out;
+}
+
+static c8*
+corpus_assignments(c8 *out, s32 n)
+{
+    for(s32 i = 0; i < 16; ++i)
+        out = appendf(out, "v%i : int\nv%i = %i\n", i, i, i);
+    for(s32 i = 0; i < n; ++i) {
+        if(next_random() % 2) out = appendf(out, "v%u = v%u\n", next_random() % 16, next_random() % 16);
+        else                  out = appendf(out, "v%u = g(v%u)\n", next_random() % 16, next_random() % 16);
+    }
+    return out;
+}
+
+static c8*
+corpus_nesting(c8 *out, s32 n)
+{
+    s32 depth = NESTING_DEPTH;
+    for(s32 d = 0; d < depth; ++d) {
+        for(s32 i = 0; i < n / depth / 3; ++i)
+            out = appendf(out, "x%i_%i : int\nx%i_%i = %u\nf(x%i_%i)\n", d, i, d, i, next_random() % 1000, d, i);
+        if(d + 1 < depth) out = append(out, "{\n");
+    }
+    for(s32 d = 1; d < depth; ++d) out = append(out, "}\n");
+    return out;
+}
+
+static c8*
+corpus_strings(c8 *out, s32 n)
+{
+    // Repeats and escapes exercise our string pool
+    static const c8 *const escapes[] = { "", "\\t", "\\n", "\\\\" };
+    for(s32 i = 0; i < n; ++i)
+        out = appendf(out, "puts(\"line%s %u\")\n", escapes[next_random() % 4], next_random() % 256);
+    return out;
+}
+
+static const Corpus corpora[] = {
+    { "declarations", corpus_declarations },
+    { "calls",        corpus_calls        },
+    { "assignments",  corpus_assignments  },
+    { "nesting",      corpus_nesting      },
+    { "strings",      corpus_strings      },
+};
+
+/*
+ * Running
+ */
+
+static r64
+now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static c8*
+read_file(const c8 *path)
+{
+    FILE *in = fopen(path, "rb");
+    if(!in) return 0;
+
+    c8 *result = 0;
+    c8 buffer[1 << 16];
+    size_t read;
+    while((read = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        memcpy(sb_add(result, read), buffer, read);
+    fclose(in);
+    sb_push(result, 0);
+    return result;
+}
+
+/*
+ * Runs command TIMED_RUNS times, the output of the last run is kept
+ */
+static Run
+run_timed(const c8 *command, const c8 *output_file)
+{
+    Run result = {0};
+    result.seconds = 1e30;
+    for(s32 i = 0; i < TIMED_RUNS; ++i) {
+        remove(output_file);
+        r64 start = now();
+        s32 status = system(command);
+        r64 seconds = now() - start;
+        if(status != 0) result.failed = 1;
+        if(seconds < result.seconds) result.seconds = seconds;
+    }
+    result.output = read_file(output_file);
+    if(!result.output) result.failed = 1;
+    return result;
+}
+
+/*
+ * Normalization
+ */
+
+// Length of the string literal at text, quotes included
+static size_t
+literal_length(const c8 *text)
+{
+    size_t i = 1;
+    while(text[i] && text[i] != '"') i += text[i] == '\\' && text[i + 1] ? 2 : 1;
+    return text[i] ? i + 1 : i;
+}
+
+/*
+ * Drops the definitions of our string pool and puts each literal back
+ * where its name is used
+ */
+static c8*
+inline_string_pool(const c8 *text)
+{
+    static const c8 definition[] = "static const char " POOL_PREFIX;
+    c8 **literals = 0;
+    c8 *code = 0;
+
+    for(const c8 *line = text; *line;) {
+        const c8 *end = strchr(line, '\n');
+        end = end ? end + 1 : line + strlen(line);
+        if(strncmp(line, definition, sizeof(definition) - 1) == 0) {
+            const c8 *quote = strchr(line, '"');
+            c8 *literal = 0;
+            if(quote && quote < end) memcpy(sb_add(literal, literal_length(quote)), quote, literal_length(quote));
+            sb_push(literal, 0);
+            sb_push(literals, literal);
+        }
+        else memcpy(sb_add(code, end - line), line, end - line);
+        line = end;
+    }
+    sb_push(code, 0);
+
+    c8 *result = 0;
+    for(const c8 *c = code; *c;) {
+        if(*c == '"') {
+            size_t length = literal_length(c);
+            memcpy(sb_add(result, length), c, length);
+            c += length;
+        }
+        else if(strncmp(c, POOL_PREFIX, sizeof(POOL_PREFIX) - 1) == 0) {
+            c8 *digits_end;
+            long id = strtol(c + sizeof(POOL_PREFIX) - 1, &digits_end, 10);
+            if(id >= 0 && id < sb_count(literals)) {
+                size_t length = strlen(literals[id]);
+                memcpy(sb_add(result, length), literals[id], length);
+            }
+            c = digits_end;
+        }
+        else sb_push(result, *c++);
+    }
+    sb_push(result, 0);
+
+    for(s32 i = 0; i < sb_count(literals); ++i)
+        sb_free(literals[i]);
+    sb_free(literals);
+    sb_free(code);
+    return result;
+}
+
+/*
+ * Whitespace outside string literals goes, then the given wrapping of
+ * the root block where it is present
+ */
+static c8*
+normalize(const c8 *text, const c8 *prefix, const c8 *suffix)
+{
+    c8 *result = 0;
+    for(const c8 *c = text; *c;) {
+        if(*c == '"') {
+            size_t length = literal_length(c);
+            memcpy(sb_add(result, length), c, length);
+            c += length;
+        }
+        else if(*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n') ++c;
+        else sb_push(result, *c++);
+    }
+    sb_push(result, 0);
+
+    size_t prefix_length = strlen(prefix);
+    if(strncmp(result, prefix, prefix_length) == 0)
+        memmove(result, result + prefix_length, strlen(result) - prefix_length + 1);
+    size_t length = strlen(result), suffix_length = suffix ? strlen(suffix) : 0;
+    if(suffix && length >= suffix_length && strcmp(result + length - suffix_length, suffix) == 0)
+        result[length - suffix_length] = 0;
+    return result;
+}
+
+static void
+print_context(const c8 *label, const c8 *text, size_t at)
+{
+    size_t start = at > CONTEXT_LENGTH / 2 ? at - CONTEXT_LENGTH / 2 : 0;
+    printf("      %-9s ...%.*s...\n", label, CONTEXT_LENGTH, text + start);
+}
+
+/*
+ * Returns 1 if the normalized outputs differ, printing where
+ */
+static s32
+compare_outputs(const c8 *ours, const c8 *reference)
+{
+    c8 *pooled = inline_string_pool(ours);
+    c8 *lhs    = normalize(pooled, OURS_PREFIX, OURS_SUFFIX);
+    c8 *rhs    = normalize(reference, REFERENCE_PREFIX, 0);
+
+    size_t at = 0;
+    while(lhs[at] && lhs[at] == rhs[at]) ++at;
+    s32 differ = lhs[at] != rhs[at];
+    if(differ) {
+        printf("    first difference at normalized offset %zu\n", at);
+        print_context("ours", lhs, at);
+        print_context("reference", rhs, at);
+    }
+
+    sb_free(pooled);
+    sb_free(lhs);
+    sb_free(rhs);
+    return differ;
+}
+
+static void
+print_throughput(const c8 *label, Run *run, size_t bytes, s32 statements)
+{
+    if(run->failed) {
+        printf("  %-9s FAILED\n", label);
+        return;
+    }
+    printf("  %-9s %9.1f ms %9.2f MB/s %12.0f statements/s\n", label, run->seconds * 1000.0,
+           bytes / run->seconds / (1 << 20), statements / run->seconds);
+}
+
+int
+main(int argc, char **argv)
+{
+    if(argc < 2) {
+        fprintf(stderr, "usage: differential compiler [reference command...]\n");
+        return 2;
+    }
+
+    c8 *compiler = realpath(argv[1], 0);
+    if(!compiler) {
+        fprintf(stderr, "differential: no compiler at %s\n", argv[1]);
+        return 2;
+    }
+
+    c8 reference[4096] = {0};
+    for(s32 i = 2, used = 0; i < argc && used < (s32)sizeof(reference); ++i)
+        used += snprintf(reference + used, sizeof(reference) - used, "%s'%s'", i > 2 ? " " : "", argv[i]);
+
+    c8 directory[] = "/tmp/cus_differential_XXXXXX";
+    if(!mkdtemp(directory)) {
+        perror("differential");
+        return 2;
+    }
+    if(!*reference) printf("No reference command, only timing our compiler\n\n");
+
+    s32 diverged = 0, failed = 0;
+    for(size_t k = 0; k < sizeof(corpora) / sizeof(corpora[0]); ++k) {
+        const Corpus *corpus = &corpora[k];
+
+        c8 *source = append(0, "{\n");
+        source = corpus->generate(source, CORPUS_STATEMENTS);
+        source = append(source, "}\n");
+
+        c8 corpus_file[4200], ours_file[4200], reference_file[4200], command[16384];
+        snprintf(corpus_file,    sizeof(corpus_file),    "%s/%s.cus", directory, corpus->name);
+        snprintf(ours_file,      sizeof(ours_file),      "%s/ours.c", directory);
+        snprintf(reference_file, sizeof(reference_file), "%s/out.c",  directory);
+
+        FILE *out = fopen(corpus_file, "wb");
+        fwrite(source, 1, sb_count(source), out);
+        fclose(out);
+        size_t bytes = sb_count(source);
+        sb_free(source);
+
+        printf("%s, %zu KB\n", corpus->name, bytes / 1024);
+
+        snprintf(command, sizeof(command), "'%s' '%s' > '%s' 2> /dev/null", compiler, corpus_file, ours_file);
+        Run ours = run_timed(command, ours_file);
+        print_throughput("ours", &ours, bytes, CORPUS_STATEMENTS);
+        failed += ours.failed;
+
+        if(*reference) {
+            snprintf(command, sizeof(command), "cd '%s' && %s '%s' > /dev/null 2>&1",
+                     directory, reference, corpus_file);
+            Run theirs = run_timed(command, reference_file);
+            print_throughput("reference", &theirs, bytes, CORPUS_STATEMENTS);
+            failed += theirs.failed;
+
+            if(!ours.failed && !theirs.failed) {
+                s32 differ = compare_outputs(ours.output, theirs.output);
+                printf("    %s\n", differ ? "DIVERGED" : "same");
+                diverged += differ;
+            }
+            sb_free(theirs.output);
+        }
+        sb_free(ours.output);
+        printf("\n");
+
+        remove(corpus_file);
+        remove(ours_file);
+        remove(reference_file);
+    }
+    rmdir(directory);
+    free(compiler);
+
+    if(diverged) printf("%i corpus(es) diverged\n", diverged);
+    if(failed)   printf("%i run(s) failed\n", failed);
+    return diverged || failed ? 1 : 0;
+}
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Builds the C# reference compiler with mono or the dotnet SDK, whichever
+# is installed, and runs the differential harness against it. dotnet is
+# also looked for where its install script puts it. With neither the
+# harness only times our compiler.
+set -e
+cd "$(dirname "$0")/.."
+
+SOURCES="Custom/Custom/Custom.cs Custom/Custom/TokenStream.cs Custom/Custom/AstNode.cs Custom/Custom/Parser.cs"
+BUILD=reference_build
+
+gcc -std=c99 -g -O2 fuzz/differential.c -o differential
+rm -rf $BUILD
+mkdir -p $BUILD
+
+CSC=$(command -v mcs || command -v csc || true)
+DOTNET=$(command -v dotnet || true)
+if [ -z "$DOTNET" ] && [ -x "$HOME/.dotnet/dotnet" ]; then DOTNET="$HOME/.dotnet/dotnet"; fi
+if command -v mono > /dev/null 2>&1 && [ -n "$CSC" ]; then
+    "$CSC" -nologo -optimize+ -out:$BUILD/reference.exe $SOURCES
+    ./differential ./a.out mono "$PWD/$BUILD/reference.exe"
+elif [ -n "$DOTNET" ]; then
+    FRAMEWORK=net$("$DOTNET" --version | cut -d. -f1-2)
+    {
+        echo '<Project Sdk="Microsoft.NET.Sdk">'
+        echo '  <PropertyGroup>'
+        echo '    <OutputType>Exe</OutputType>'
+        echo "    <TargetFramework>$FRAMEWORK</TargetFramework>"
+        echo '    <AssemblyName>reference</AssemblyName>'
+        echo '    <EnableDefaultCompileItems>false</EnableDefaultCompileItems>'
+        echo '    <InvariantGlobalization>true</InvariantGlobalization>'
+        echo '  </PropertyGroup>'
+        echo '  <ItemGroup>'
+        for source in $SOURCES; do echo "    <Compile Include=\"../$source\" />"; done
+        echo '  </ItemGroup>'
+        echo '</Project>'
+    } > $BUILD/reference.csproj
+    "$DOTNET" build -nologo -v quiet -c Release -o $BUILD/bin $BUILD/reference.csproj
+    ./differential ./a.out "$DOTNET" "$PWD/$BUILD/bin/reference.dll"
+else
+    echo "differential: neither mono nor dotnet found"
+    ./differential ./a.out
+fi
@@ -0,0 +1,22 @@
+/*
+ * libFuzzer target for the lexer
+ */
+
+#include "../Token_Stream.h"
+#include "../stretchy_buffer.h"
+
+int
+LLVMFuzzerTestOneInput(const u8 *data, size_t size)
+{
+    Token_Stream stream = {0};
+    tokenize_buffer(&stream, "<fuzz>", (const c8*)data, size);
+
+    // Every stream has to end in exactly one eof token
+    s32 count = sb_count(stream.tokens);
+    if(count == 0 || stream.tokens[count - 1].tag != tag_eof) __builtin_trap();
+    for(s32 i = 0; i < count - 1; ++i)
+        if(stream.tokens[i].tag == tag_eof) __builtin_trap();
+
+    sb_free(stream.tokens);
+    return 0;
+}
@@ -0,0 +1,35 @@
+/*
+ * Replays inputs through a fuzz target when libFuzzer isn't available,
+ * e.g. to run a corpus under gcc's sanitizers
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../types.h"
+
+int
+LLVMFuzzerTestOneInput(const u8 *data, size_t size);
+
+int
+main(int argc, char **argv)
+{
+    for(int i = 1; i < argc; ++i) {
+        FILE *file = fopen(argv[i], "rb");
+        if(!file) {
+            fprintf(stderr, "Could not open %s\n", argv[i]);
+            return 1;
+        }
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        u8 *data = malloc(size ? size : 1);
+        size_t read = fread(data, 1, size, file);
+        fclose(file);
+
+        LLVMFuzzerTestOneInput(data, read);
+        free(data);
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+/*
+ * libFuzzer target for the parser and the passes that run before emission
+ */
+
+#include "../Token_Stream.h"
+#include "../Parser.h"
+#include "../Symbol_Table.h"
+#include "../Type_Table.h"
+#include "../Chain_Buffer.h"
+#include "../stretchy_buffer.h"
+
+int
+LLVMFuzzerTestOneInput(const u8 *data, size_t size)
+{
+    Chain_Mark mark = chain_mark();
+
+    Token_Stream stream = {0};
+    tokenize_buffer(&stream, "<fuzz>", (const c8*)data, size);
+    Ast_Node *root = parse_stream(&stream);
+
+    if(!stream.error_count && !resolve_names(root))
+        type_check(root);
+
+    sb_free(stream.tokens);
+    chain_release(mark);
+    clear_occurrences();
+    return 0;
+}
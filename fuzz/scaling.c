@@ -0,0 +1,442 @@
+/*
+ * Scaling harness
+ *
+ * Grows pathological input shapes by doubling and measures every phase of
+ * the compiler in a forked child. A phase whose time or memory grows by
+ * much more than 2x on two doublings in a row, or by a huge factor on one,
+ * is flagged as superlinear. Single steps are not trusted since the cost
+ * per element rises as the working set falls out of each cache level. A
+ * child that crashes or runs out of time is flagged as well.
+ *
+ * Every size is measured several times and each phase keeps its median,
+ * a step that looks superlinear is measured again from scratch and only
+ * flagged if the ratio reproduces, so one slow run never fails a build.
+ *
+ *     scaling [max_log2_size] [shape_name]
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <malloc.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../Token_Stream.h"
+#include "../Parser.h"
+#include "../Symbol_Table.h"
+#include "../Type_Table.h"
+#include "../code_emission.h"
+#include "../stretchy_buffer.h"
+
+#define PHASE_COUNT        4
+#define SUPERLINEAR_RATIO  3.0
+#define EXPLOSIVE_RATIO    6.0
+#define MIN_MEASURED_TIME  0.005
+#define MIN_MEASURED_BYTES (1 << 20)
+#define CHILD_TIME_LIMIT   20
+#define MEASURED_RUNS      5
+
+static const c8 *phase_names[PHASE_COUNT] = { "lex", "parse", "check", "emit" };
+
+typedef struct Measurement {
+    r64 seconds[PHASE_COUNT];
+    s64 bytes[PHASE_COUNT];
+    s32 ran[PHASE_COUNT];
+} Measurement;
+
+typedef c8* (*Shape_Generator)(s32 n);
+
+typedef struct Shape {
+    const c8        *name;
+    Shape_Generator  generate;
+} Shape;
+
+/*
+ * Shapes
+ */
+
+static c8*
+repeat(c8 *out, const c8 *text, s32 n)
+{
+    size_t length = strlen(text);
+    c8 *at = sb_add(out, length * n);
+    for(s32 i = 0; i < n; ++i, at += length)
+        memcpy(at, text, length);
+    return out;
+}
+
+static c8*
+append(c8 *out, const c8 *text)
+{
+    return repeat(out, text, 1);
+}
+
+static c8*
+shape_identifier(s32 n)
+{
+    c8 *out = append(0, "{\n");
+    out = repeat(out, "a", n);
+    return append(out, " : int\n}\n");
+}
+
+static c8*
+shape_comment_at_eof(s32 n)
+{
+    c8 *out = append(0, "{\n}\n//");
+    return repeat(out, "x", n);
+}
+
+static c8*
+shape_string(s32 n)
+{
+    c8 *out = append(0, "{\ns : string\ns = \"");
+    out = repeat(out, "x", n);
+    return append(out, "\"\n}\n");
+}
+
+static c8*
+shape_nesting(s32 n)
+{
+    c8 *out = repeat(0, "{", n);
+    return repeat(out, "}", n);
+}
+
+static c8*
+shape_nested_calls(s32 n)
+{
+    c8 *out = append(0, "{\nf(");
+    out = repeat(out, "f(", n);
+    out = repeat(out, ")", n + 1);
+    return append(out, "\n}\n");
+}
+
+static c8*
+shape_arguments(s32 n)
+{
+    c8 *out = append(0, "{\nf(");
+    out = repeat(out, "1, ", n);
+    return append(out, "1)\n}\n");
+}
+
+static c8*
+shape_statements(s32 n)
+{
+    c8 *out = append(0, "{\na : int\n");
+    out = repeat(out, "a = 1\n", n);
+    return append(out, "}\n");
+}
+
+static c8*
+shape_declarations(s32 n)
+{
+    c8 *out = append(0, "{\n");
+    c8 line[64];
+    for(s32 i = 0; i < n; ++i) {
+        snprintf(line, sizeof(line), "v%i : int\nv%i = %i\n", i, i, i);
+        out = append(out, line);
+    }
+    return append(out, "}\n");
+}
+
+static c8*
+shape_errors(s32 n)
+{
+    c8 *out = append(0, "{\n");
+    out = repeat(out, ") )\n", n);
+    return append(out, "}\n");
+}
+
+static c8*
+shape_operators(s32 n)
+{
+    c8 *out = append(0, "{\na : int\n");
+    out = repeat(out, "a = a + 1 * 2\n", n);
+    return append(out, "}\n");
+}
+
+static c8*
+shape_match_cases(s32 n)
+{
+    c8 *out = append(0, "{\na : int\nmatch a {\n");
+    c8 line[64];
+    for(s32 i = 0; i < n; ++i) {
+        snprintf(line, sizeof(line), "%i { a = %i }\n", (i * 7919) % n * 3, i);
+        out = append(out, line);
+    }
+    return append(out, "}\n}\n");
+}
+
+static const Shape shapes[] = {
+    { "identifier",     shape_identifier     },
+    { "comment_at_eof", shape_comment_at_eof },
+    { "string",         shape_string         },
+    { "nesting",        shape_nesting        },
+    { "nested_calls",   shape_nested_calls   },
+    { "arguments",      shape_arguments      },
+    { "statements",     shape_statements     },
+    { "declarations",   shape_declarations   },
+    { "errors",         shape_errors         },
+    { "operators",      shape_operators      },
+    { "match_cases",    shape_match_cases    },
+};
+
+/*
+ * Measuring
+ */
+
+static r64
+now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+static s64
+allocated_bytes()
+{
+    struct mallinfo2 info = mallinfo2();
+    return (s64)(info.uordblks + info.hblkhd);
+}
+
+#define BEGIN_PHASE(index) r64 start_##index = now(); s64 bytes_##index = allocated_bytes()
+#define END_PHASE(index)                                                    \
+    result.seconds[index] = now() - start_##index;                         \
+    result.bytes[index]   = allocated_bytes() - bytes_##index;             \
+    result.ran[index]     = 1
+
+static void
+run_child(const Shape *shape, s32 n, s32 out)
+{
+    s32 null = open("/dev/null", O_WRONLY);
+    dup2(null, 2);
+    alarm(CHILD_TIME_LIMIT);
+
+    c8 *source = shape->generate(n);
+    Measurement result;
+    memset(&result, 0, sizeof(result));
+
+    Token_Stream stream = {0};
+    BEGIN_PHASE(0);
+    tokenize_buffer(&stream, "<scaling>", source, sb_count(source));
+    END_PHASE(0);
+
+    BEGIN_PHASE(1);
+    Ast_Node *root = parse_stream(&stream);
+    END_PHASE(1);
+
+    if(!stream.error_count) {
+        BEGIN_PHASE(2);
+        s32 errors = resolve_names(root);
+        if(!errors) errors = type_check(root);
+        END_PHASE(2);
+
+        if(!errors) {
+            FILE *sink = fopen("/dev/null", "w");
+            BEGIN_PHASE(3);
+            emit_code(sink, root);
+            fflush(sink);
+            END_PHASE(3);
+            fclose(sink);
+        }
+    }
+
+    write(out, &result, sizeof(result));
+    _exit(0);
+}
+
+static s32
+measure(const Shape *shape, s32 n, Measurement *result, c8 *failure, size_t failure_size)
+{
+    s32 pipes[2];
+    if(pipe(pipes) != 0) return 0;
+
+    pid_t child = fork();
+    if(child == 0) {
+        close(pipes[0]);
+        run_child(shape, n, pipes[1]);
+    }
+    close(pipes[1]);
+
+    ssize_t read_size = read(pipes[0], result, sizeof(*result));
+    close(pipes[0]);
+
+    s32 status;
+    struct rusage usage;
+    wait4(child, &status, 0, &usage);
+
+    if(WIFSIGNALED(status)) {
+        snprintf(failure, failure_size, "%s",
+                 WTERMSIG(status) == SIGALRM ? "timeout" : strsignal(WTERMSIG(status)));
+        return 0;
+    }
+    if(read_size != sizeof(*result)) {
+        snprintf(failure, failure_size, "no result");
+        return 0;
+    }
+    return 1;
+}
+
+static int
+compare_r64(const void *a, const void *b)
+{
+    r64 lhs = *(const r64*)a, rhs = *(const r64*)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static int
+compare_s64(const void *a, const void *b)
+{
+    s64 lhs = *(const s64*)a, rhs = *(const s64*)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+/*
+ * Median per phase over MEASURED_RUNS children, any failing run fails
+ */
+static s32
+measure_median(const Shape *shape, s32 n, Measurement *result, c8 *failure, size_t failure_size)
+{
+    Measurement runs[MEASURED_RUNS];
+    for(s32 r = 0; r < MEASURED_RUNS; ++r)
+        if(!measure(shape, n, &runs[r], failure, failure_size)) return 0;
+
+    *result = runs[0];
+    for(s32 p = 0; p < PHASE_COUNT; ++p) {
+        r64 seconds[MEASURED_RUNS];
+        s64 bytes[MEASURED_RUNS];
+        for(s32 r = 0; r < MEASURED_RUNS; ++r) {
+            seconds[r] = runs[r].seconds[p];
+            bytes[r]   = runs[r].bytes[p];
+        }
+        qsort(seconds, MEASURED_RUNS, sizeof(r64), compare_r64);
+        qsort(bytes,   MEASURED_RUNS, sizeof(s64), compare_s64);
+        result->seconds[p] = seconds[MEASURED_RUNS / 2];
+        result->bytes[p]   = bytes[MEASURED_RUNS / 2];
+    }
+    return 1;
+}
+
+static r64
+time_ratio(const Measurement *current, const Measurement *previous, s32 phase)
+{
+    if(current->seconds[phase] > MIN_MEASURED_TIME && previous->seconds[phase] > 0)
+        return current->seconds[phase] / previous->seconds[phase];
+    return 0;
+}
+
+static r64
+memory_ratio(const Measurement *current, const Measurement *previous, s32 phase)
+{
+    if(current->bytes[phase] > MIN_MEASURED_BYTES && previous->bytes[phase] > 0)
+        return (r64)current->bytes[phase] / previous->bytes[phase];
+    return 0;
+}
+
+/*
+ * Measures n / 2 and n again, returns whether the phase still grows by
+ * more than threshold
+ */
+static s32
+reproduces(const Shape *shape, s32 n, s32 phase, s32 memory, r64 threshold)
+{
+    Measurement previous, current;
+    c8 failure[64];
+    if(!measure_median(shape, n / 2, &previous, failure, sizeof(failure))) return 1;
+    if(!measure_median(shape, n,     &current,  failure, sizeof(failure))) return 1;
+
+    r64 ratio = memory ? memory_ratio(&current, &previous, phase)
+                       : time_ratio(&current, &previous, phase);
+    return ratio > threshold;
+}
+
+int
+main(int argc, char **argv)
+{
+    s32 max_log2 = argc > 1 ? atoi(argv[1]) : 18;
+    c8 *only     = argc > 2 ? argv[2] : 0;
+    s32 min_log2 = 10;
+    s32 flagged  = 0;
+
+    for(size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); ++s) {
+        const Shape *shape = &shapes[s];
+        if(only && strcmp(only, shape->name) != 0) continue;
+
+        Measurement previous;
+        s32 have_previous = 0;
+        s32 time_strikes[PHASE_COUNT]   = {0};
+        s32 memory_strikes[PHASE_COUNT] = {0};
+
+        printf("%s\n", shape->name);
+        printf("  %9s", "n");
+        for(s32 p = 0; p < PHASE_COUNT; ++p)
+            printf(" %10s ms %9s KB", phase_names[p], "");
+        printf("\n");
+
+        for(s32 log2 = min_log2; log2 <= max_log2; ++log2) {
+            s32 n = 1 << log2;
+            Measurement current;
+            c8 failure[64];
+
+            if(!measure_median(shape, n, &current, failure, sizeof(failure))) {
+                printf("  %9i FAILED: %s\n", n, failure);
+                ++flagged;
+                break;
+            }
+
+            printf("  %9i", n);
+            for(s32 p = 0; p < PHASE_COUNT; ++p) {
+                if(current.ran[p])
+                    printf(" %13.3f %12lli", current.seconds[p] * 1000.0,
+                           (long long)current.bytes[p] / 1024);
+                else
+                    printf(" %13s %12s", "-", "-");
+            }
+
+            if(have_previous) {
+                for(s32 p = 0; p < PHASE_COUNT; ++p) {
+                    if(!current.ran[p] || !previous.ran[p]) continue;
+
+                    r64 time = time_ratio(&current, &previous, p);
+                    time_strikes[p] = time > SUPERLINEAR_RATIO ? time_strikes[p] + 1 : 0;
+                    if(time_strikes[p] == 2 || time > EXPLOSIVE_RATIO) {
+                        r64 threshold = time > EXPLOSIVE_RATIO ? EXPLOSIVE_RATIO : SUPERLINEAR_RATIO;
+                        if(reproduces(shape, n, p, 0, threshold)) {
+                            printf("  SUPERLINEAR %s time x%.1f", phase_names[p], time);
+                            ++flagged;
+                        }
+                        else {
+                            time_strikes[p] = 0;
+                        }
+                    }
+
+                    r64 memory = memory_ratio(&current, &previous, p);
+                    memory_strikes[p] = memory > SUPERLINEAR_RATIO ? memory_strikes[p] + 1 : 0;
+                    if(memory_strikes[p] == 2 || memory > EXPLOSIVE_RATIO) {
+                        r64 threshold = memory > EXPLOSIVE_RATIO ? EXPLOSIVE_RATIO : SUPERLINEAR_RATIO;
+                        if(reproduces(shape, n, p, 1, threshold)) {
+                            printf("  SUPERLINEAR %s memory x%.1f", phase_names[p], memory);
+                            ++flagged;
+                        }
+                        else {
+                            memory_strikes[p] = 0;
+                        }
+                    }
+                }
+            }
+            printf("\n");
+
+            previous = current;
+            have_previous = 1;
+        }
+    }
+
+    if(flagged) printf("\n%i scaling problem(s) found\n", flagged);
+    return flagged ? 1 : 0;
+}
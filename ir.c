@@ -0,0 +1,1143 @@
+/*
+ * AST to SSA lowering, linear scan register allocation and IR dumps
+ *
+ * SSA is built directly while lowering, following Braun et al. "Simple and
+ * Efficient Construction of Static Single Assignment Form": every variable
+ * keeps its latest definition per block, reads in unsealed blocks create
+ * placeholder phis which are completed when the block is sealed. Blocks
+ * are sealed as soon as all their predecessors are known, loop headers
+ * after their body and label blocks only at the end, since a goto may
+ * still jump to them.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+#include "Chain_Buffer.h"
+#include "code_emission.h"
+#include "Parser.h"
+#include "Type_Table.h"
+#include "stretchy_buffer.h"
+
+typedef struct Ir_Definition {
+    s32 variable;
+    s32 block;
+    s32 value;
+} Ir_Definition;
+
+typedef struct Ir_Incomplete_Phi {
+    s32 variable;
+    s32 phi;
+} Ir_Incomplete_Phi;
+
+typedef struct Ir_Local {
+    Ast_Node *declaration;
+    s32       variable;
+} Ir_Local;
+
+typedef struct Ir_Local_Slot {
+    Ast_Node *declaration;
+    s32       local;
+} Ir_Local_Slot;
+
+typedef struct Ir_Label {
+    c8  *identifier;
+    s32  block;
+} Ir_Label;
+
+typedef struct Ir_Builder {
+    Ir_Function        *function;
+    s32                 current;
+    Ir_Local           *locals;
+    // Index into locals per declaration, stale once its scope is left
+    Ir_Local_Slot      *local_slots;
+    s32                 local_slot_count;
+    s32                 local_slot_used;
+    s32                 variable_count;
+    // Latest definition of a variable per block, index + 1 into
+    // definitions, open addressing on the pair
+    Ir_Definition      *definitions;
+    s32                *definition_slots;
+    s32                 definition_slot_count;
+    // Per block, phis waiting for the block to be sealed
+    Ir_Incomplete_Phi **incomplete_phis;
+    // Per value, the phis using it as an operand
+    s32               **phi_users;
+    Ir_Label           *labels;
+} Ir_Builder;
+
+/*
+ * The function's arrays grow in the chain arena, so it lives as long as
+ * the tree it was lowered from. They keep the stretchy buffer header, so
+ * sb_count and sb_last read them as usual, but they are never freed and
+ * only grow through ir_push. Superseded copies stay behind in the arena.
+ */
+#define ir_push(a, v) (ir_maybe_grow(a), (a)[stb__sbn(a)++] = (v))
+#define ir_maybe_grow(a) \
+    ((a) == 0 || stb__sbn(a) == stb__sbm(a) ? ((a) = ir_grow((a), sizeof(*(a)))) : 0)
+
+static void*
+ir_grow(void *array, s32 item_size)
+{
+    s32 count    = array ? stb__sbn(array) : 0;
+    s32 capacity = array ? 2 * stb__sbm(array) : 8;
+
+    s32 *raw = chain_push_psize(0, 2 * sizeof(s32) + (size_t)capacity * item_size);
+    raw[0] = capacity;
+    raw[1] = count;
+    if(count) memcpy(raw + 2, array, (size_t)count * item_size);
+    return raw + 2;
+}
+
+// Cases left when a match's binary search switches to comparing in turn
+#define IR_MATCH_LINEAR_CASES 3
+
+static s32
+lower_expression(Ir_Builder *b, Ast_Node *node);
+
+static void
+lower_statement(Ir_Builder *b, Ast_Node *node);
+
+static s32
+is_value(Ir_Op op)
+{
+    return op == IR_UNDEF || op == IR_CONST || op == IR_STRING ||
+           op == IR_PHI   || op == IR_CALL  || op == IR_BIN;
+}
+
+static s32
+resolve_value(Ir_Function *function, s32 value)
+{
+    while(value != IR_NO_VALUE && function->instructions[value].replaced_by != IR_NO_VALUE)
+        value = function->instructions[value].replaced_by;
+    return value;
+}
+
+static s32
+new_block(Ir_Builder *b)
+{
+    Ir_Block block = {0};
+    ir_push(b->function->blocks, block);
+    sb_push(b->incomplete_phis, 0);
+    return sb_count(b->function->blocks) - 1;
+}
+
+static s32
+new_instruction(Ir_Builder *b, Ir_Op op, s32 block)
+{
+    Ir_Instruction instruction;
+    memset(&instruction, 0, sizeof(instruction));
+    instruction.op            = op;
+    instruction.block         = block;
+    instruction.target[0]     = -1;
+    instruction.target[1]     = -1;
+    instruction.replaced_by   = IR_NO_VALUE;
+    ir_push(b->function->instructions, instruction);
+    sb_push(b->phi_users, 0);
+    return sb_count(b->function->instructions) - 1;
+}
+
+static s32
+append(Ir_Builder *b, Ir_Op op)
+{
+    s32 result = new_instruction(b, op, b->current);
+    ir_push(b->function->blocks[b->current].body, result);
+    return result;
+}
+
+static void
+set_operands(Ir_Builder *b, s32 instruction, s32 *values, s32 count)
+{
+    Ir_Instruction *inst = &b->function->instructions[instruction];
+    inst->first_operand = sb_count(b->function->operands);
+    inst->operand_count = count;
+    for(s32 i = 0; i < count; ++i)
+        ir_push(b->function->operands, values[i]);
+}
+
+/*
+ * SSA construction
+ */
+
+static s32
+read_variable(Ir_Builder *b, s32 variable, s32 block);
+
+static u32
+hash_declaration(Ast_Node *declaration)
+{
+    u64 key = (u64)(uintptr_t)declaration;
+    return (u32)((key >> 3) * 0x9E3779B97F4A7C15ull >> 32);
+}
+
+static Ir_Local_Slot*
+find_local_slot(Ir_Builder *b, Ast_Node *declaration)
+{
+    u32 mask = b->local_slot_count - 1;
+    u32 slot = hash_declaration(declaration) & mask;
+    while(b->local_slots[slot].declaration && b->local_slots[slot].declaration != declaration)
+        slot = (slot + 1) & mask;
+    return &b->local_slots[slot];
+}
+
+static void
+add_local(Ir_Builder *b, Ir_Local local)
+{
+    if(2 * (b->local_slot_used + 1) > b->local_slot_count) {
+        Ir_Local_Slot *old_slots = b->local_slots;
+        s32 old_count = b->local_slot_count;
+        b->local_slot_count = old_count ? old_count * 2 : 256;
+        b->local_slots      = calloc(b->local_slot_count, sizeof(Ir_Local_Slot));
+        for(s32 i = 0; i < old_count; ++i)
+            if(old_slots[i].declaration)
+                *find_local_slot(b, old_slots[i].declaration) = old_slots[i];
+        free(old_slots);
+    }
+
+    Ir_Local_Slot *slot = find_local_slot(b, local.declaration);
+    if(!slot->declaration) ++b->local_slot_used;
+    slot->declaration = local.declaration;
+    slot->local       = sb_count(b->locals);
+    sb_push(b->locals, local);
+}
+
+static u32
+hash_definition(s32 variable, s32 block)
+{
+    u64 key = (u64)(u32)variable << 32 | (u32)block;
+    return (u32)(key * 0x9E3779B97F4A7C15ull >> 32);
+}
+
+static void
+grow_definition_slots(Ir_Builder *b)
+{
+    free(b->definition_slots);
+    b->definition_slot_count = b->definition_slot_count ? b->definition_slot_count * 2 : 256;
+    b->definition_slots      = calloc(b->definition_slot_count, sizeof(s32));
+
+    u32 mask = b->definition_slot_count - 1;
+    for(s32 i = 0; i < sb_count(b->definitions); ++i) {
+        u32 slot = hash_definition(b->definitions[i].variable, b->definitions[i].block) & mask;
+        while(b->definition_slots[slot]) slot = (slot + 1) & mask;
+        b->definition_slots[slot] = i + 1;
+    }
+}
+
+static Ir_Definition*
+find_definition(Ir_Builder *b, s32 variable, s32 block, s32 create)
+{
+    if(!b->definition_slots) {
+        if(!create) return 0;
+        grow_definition_slots(b);
+    }
+
+    u32 mask = b->definition_slot_count - 1;
+    u32 slot = hash_definition(variable, block) & mask;
+    while(b->definition_slots[slot]) {
+        Ir_Definition *definition = &b->definitions[b->definition_slots[slot] - 1];
+        if(definition->variable == variable && definition->block == block) return definition;
+        slot = (slot + 1) & mask;
+    }
+    if(!create) return 0;
+
+    Ir_Definition definition;
+    definition.variable = variable;
+    definition.block    = block;
+    definition.value    = IR_NO_VALUE;
+    sb_push(b->definitions, definition);
+    b->definition_slots[slot] = sb_count(b->definitions);
+
+    if(sb_count(b->definitions) * 2 > b->definition_slot_count)
+        grow_definition_slots(b);
+    return &sb_last(b->definitions);
+}
+
+static void
+write_variable(Ir_Builder *b, s32 variable, s32 block, s32 value)
+{
+    find_definition(b, variable, block, 1)->value = value;
+}
+
+/*
+ * The value a phi stands for if its operands are all the same value or
+ * the phi itself, IR_NO_VALUE if it merges different values
+ */
+static s32
+trivial_phi_value(Ir_Function *function, s32 phi)
+{
+    Ir_Instruction *inst = &function->instructions[phi];
+
+    s32 same = IR_NO_VALUE;
+    for(s32 i = 0; i < inst->operand_count; ++i) {
+        s32 operand = resolve_value(function, function->operands[inst->first_operand + i]);
+        if(operand == same || operand == phi) continue;
+        if(same != IR_NO_VALUE) return IR_NO_VALUE;
+        same = operand;
+    }
+    return same == IR_NO_VALUE ? function->undef : same;
+}
+
+/*
+ * Removing a phi may leave the phis using it trivial in turn. They are
+ * found through its user list and handed on to its replacement, which
+ * now stands in for it in their operands.
+ */
+static s32
+try_remove_trivial_phi(Ir_Builder *b, s32 phi)
+{
+    Ir_Function *function = b->function;
+    s32 *worklist = 0;
+    sb_push(worklist, phi);
+
+    while(sb_count(worklist)) {
+        s32 candidate = sb_last(worklist);
+        --stb__sbn(worklist);
+        if(function->instructions[candidate].op != IR_PHI) continue;
+
+        s32 same = trivial_phi_value(function, candidate);
+        if(same == IR_NO_VALUE) continue;
+        function->instructions[candidate].op          = IR_NOP;
+        function->instructions[candidate].replaced_by = same;
+
+        s32 *users = b->phi_users[candidate];
+        for(s32 i = 0; i < sb_count(users); ++i) {
+            if(users[i] == candidate) continue;
+            sb_push(worklist, users[i]);
+            if(function->instructions[same].op == IR_PHI)
+                sb_push(b->phi_users[same], users[i]);
+        }
+        sb_free(b->phi_users[candidate]);
+        b->phi_users[candidate] = 0;
+    }
+
+    sb_free(worklist);
+    return resolve_value(function, phi);
+}
+
+static s32
+add_phi_operands(Ir_Builder *b, s32 variable, s32 phi)
+{
+    s32 block = b->function->instructions[phi].block;
+    s32 *values = 0;
+    for(s32 i = 0; i < sb_count(b->function->blocks[block].predecessors); ++i) {
+        s32 predecessor = b->function->blocks[block].predecessors[i];
+        sb_push(values, read_variable(b, variable, predecessor));
+    }
+    set_operands(b, phi, values, sb_count(values));
+    for(s32 i = 0; i < sb_count(values); ++i) {
+        s32 value = resolve_value(b->function, values[i]);
+        if(b->function->instructions[value].op == IR_PHI)
+            sb_push(b->phi_users[value], phi);
+    }
+    sb_free(values);
+    return try_remove_trivial_phi(b, phi);
+}
+
+static s32
+new_phi(Ir_Builder *b, s32 block)
+{
+    s32 phi = new_instruction(b, IR_PHI, block);
+    ir_push(b->function->blocks[block].phis, phi);
+    return phi;
+}
+
+static s32
+read_variable_recursive(Ir_Builder *b, s32 variable, s32 block)
+{
+    Ir_Block *ir_block = &b->function->blocks[block];
+    s32 value;
+
+    if(!ir_block->sealed) {
+        value = new_phi(b, block);
+        Ir_Incomplete_Phi incomplete;
+        incomplete.variable = variable;
+        incomplete.phi      = value;
+        sb_push(b->incomplete_phis[block], incomplete);
+    }
+    else if(sb_count(ir_block->predecessors) == 0) {
+        value = b->function->undef;
+    }
+    else if(sb_count(ir_block->predecessors) == 1) {
+        value = read_variable(b, variable, ir_block->predecessors[0]);
+    }
+    else {
+        // Break cycles through loops before visiting the predecessors
+        value = new_phi(b, block);
+        write_variable(b, variable, block, value);
+        value = add_phi_operands(b, variable, value);
+    }
+
+    write_variable(b, variable, block, value);
+    return value;
+}
+
+static s32
+read_variable(Ir_Builder *b, s32 variable, s32 block)
+{
+    Ir_Definition *definition = find_definition(b, variable, block, 0);
+    if(definition && definition->value != IR_NO_VALUE)
+        return resolve_value(b->function, definition->value);
+    return read_variable_recursive(b, variable, block);
+}
+
+static void
+seal_block(Ir_Builder *b, s32 block)
+{
+    // Reading the predecessors may still add phis to this block
+    for(s32 i = 0; i < sb_count(b->incomplete_phis[block]); ++i) {
+        Ir_Incomplete_Phi incomplete = b->incomplete_phis[block][i];
+        add_phi_operands(b, incomplete.variable, incomplete.phi);
+    }
+    sb_free(b->incomplete_phis[block]);
+    b->incomplete_phis[block] = 0;
+    b->function->blocks[block].sealed = 1;
+}
+
+/*
+ * Lowering
+ */
+
+static void
+add_predecessor(Ir_Builder *b, s32 block, s32 predecessor)
+{
+    ir_push(b->function->blocks[block].predecessors, predecessor);
+}
+
+static void
+jump_to(Ir_Builder *b, s32 target)
+{
+    s32 jump = append(b, IR_JUMP);
+    b->function->instructions[jump].target[0] = target;
+    add_predecessor(b, target, b->current);
+}
+
+static void
+branch_to(Ir_Builder *b, s32 condition, s32 on_true, s32 on_false)
+{
+    s32 branch = append(b, IR_BRANCH);
+    set_operands(b, branch, &condition, 1);
+    b->function->instructions[branch].target[0] = on_true;
+    b->function->instructions[branch].target[1] = on_false;
+    add_predecessor(b, on_true,  b->current);
+    add_predecessor(b, on_false, b->current);
+}
+
+/*
+ * Statements after a jump or return land in a block nothing jumps to
+ */
+static void
+start_unreachable_block(Ir_Builder *b)
+{
+    b->current = new_block(b);
+    seal_block(b, b->current);
+}
+
+static s32
+lower_constant(Ir_Builder *b, s64 value)
+{
+    s32 result = append(b, IR_CONST);
+    b->function->instructions[result].constant = value;
+    return result;
+}
+
+static s32
+lower_binary(Ir_Builder *b, enum Tag tag, s32 lhs, s32 rhs)
+{
+    s32 operands[2] = { lhs, rhs };
+    s32 result = append(b, IR_BIN);
+    b->function->instructions[result].tag = tag;
+    set_operands(b, result, operands, 2);
+    return result;
+}
+
+static s32
+label_block(Ir_Builder *b, c8 *identifier)
+{
+    for(s32 i = 0; i < sb_count(b->labels); ++i)
+        if(b->labels[i].identifier == identifier) return b->labels[i].block;
+
+    Ir_Label label;
+    label.identifier = identifier;
+    label.block      = new_block(b);
+    sb_push(b->labels, label);
+    return label.block;
+}
+
+static Ir_Local*
+find_local(Ir_Builder *b, Ast_Node *declaration)
+{
+    if(!b->local_slots || !declaration) return 0;
+    Ir_Local_Slot *slot = find_local_slot(b, declaration);
+    if(!slot->declaration || slot->local >= sb_count(b->locals)) return 0;
+    Ir_Local *local = &b->locals[slot->local];
+    return local->declaration == declaration ? local : 0;
+}
+
+static s32
+lower_function_call(Ir_Builder *b, Ast_Node *node)
+{
+    s32 *arguments = 0;
+    for(s32 i = 0; i < sb_count(node->function_call.arguments); ++i)
+        sb_push(arguments, lower_expression(b, node->function_call.arguments[i]));
+
+    s32 result = append(b, IR_CALL);
+    b->function->instructions[result].symbol = node->function_call.identifier;
+    set_operands(b, result, arguments, sb_count(arguments));
+    sb_free(arguments);
+    return result;
+}
+
+/*
+ * The right operand gets its own block, which the left one branches over
+ * as in C. Both sides are tested against 0 and merged by a phi, where the
+ * skipped edge carries the left test, already 0 for && and 1 for ||.
+ */
+static s32
+lower_short_circuit(Ir_Builder *b, Ast_Node *node)
+{
+    enum Tag tag = node->bin_operator.tag;
+    s32 values[2];
+    values[0] = lower_binary(b, tag_notequal, lower_expression(b, node->bin_operator.lhs),
+                             lower_constant(b, 0));
+
+    s32 rhs_block = new_block(b);
+    s32 end       = new_block(b);
+    if(tag == tag_and) branch_to(b, values[0], rhs_block, end);
+    else               branch_to(b, values[0], end, rhs_block);
+    seal_block(b, rhs_block);
+
+    b->current = rhs_block;
+    values[1] = lower_binary(b, tag_notequal, lower_expression(b, node->bin_operator.rhs),
+                             lower_constant(b, 0));
+    jump_to(b, end);
+    seal_block(b, end);
+
+    b->current = end;
+    s32 phi = new_phi(b, end);
+    set_operands(b, phi, values, 2);
+    return phi;
+}
+
+static void
+expression_error(Ir_Builder *b, const c8 *message, Ast_Node *node)
+{
+    emit_node_error(message, node);
+}
+
+static s32
+lower_expression(Ir_Builder *b, Ast_Node *node)
+{
+    switch(node->type)
+    {
+    case N_Number: {
+        s32 result = append(b, IR_CONST);
+        b->function->instructions[result].constant = node->number.value;
+        return result;
+    }
+    case N_String: {
+        s32 result = append(b, IR_STRING);
+        b->function->instructions[result].string = node->string.value;
+        return result;
+    }
+    case N_Variable: {
+        Ir_Local *local = find_local(b, node->variable.declaration);
+        if(!local) {
+            expression_error(b, "IR: Use of undeclared variable", node);
+            return b->function->undef;
+        }
+        return read_variable(b, local->variable, b->current);
+    }
+    case N_Function_Call:
+        return lower_function_call(b, node);
+    case N_Index:
+        expression_error(b, "IR: Arrays are not supported", node);
+        return b->function->undef;
+    case N_Bin_Operator: {
+        if(node->bin_operator.tag == tag_and || node->bin_operator.tag == tag_or)
+            return lower_short_circuit(b, node);
+        s32 lhs = lower_expression(b, node->bin_operator.lhs);
+        s32 rhs = lower_expression(b, node->bin_operator.rhs);
+        return lower_binary(b, node->bin_operator.tag, lhs, rhs);
+    }
+    default:
+        expression_error(b, "IR: Unsupported expression", node);
+        return b->function->undef;
+    }
+}
+
+static void
+lower_if(Ir_Builder *b, Ast_Node *node)
+{
+    s32 end = new_block(b);
+    for(s32 i = 0; i < sb_count(node->if_statement.blocks); ++i) {
+        s32 condition = lower_expression(b, node->if_statement.conditions[i]);
+        s32 then_block = new_block(b);
+        s32 next_block = new_block(b);
+        branch_to(b, condition, then_block, next_block);
+        seal_block(b, then_block);
+        seal_block(b, next_block);
+
+        b->current = then_block;
+        lower_statement(b, node->if_statement.blocks[i]);
+        jump_to(b, end);
+        b->current = next_block;
+    }
+    if(node->if_statement.else_block) lower_statement(b, node->if_statement.else_block);
+    jump_to(b, end);
+    seal_block(b, end);
+    b->current = end;
+}
+
+static void
+lower_while(Ir_Builder *b, Ast_Node *node)
+{
+    s32 header = new_block(b);
+    jump_to(b, header);
+    b->current = header;
+
+    s32 body = new_block(b);
+    s32 exit = new_block(b);
+    if(node->while_statement.condition)
+        branch_to(b, lower_expression(b, node->while_statement.condition), body, exit);
+    else
+        jump_to(b, body);
+    seal_block(b, body);
+
+    b->current = body;
+    lower_statement(b, node->while_statement.body);
+    jump_to(b, header);
+    seal_block(b, header);
+
+    seal_block(b, exit);
+    b->current = exit;
+}
+
+/*
+ * A range counts its variable up like a while loop. The end is a value of
+ * the preheader, so it is evaluated once like in the emitted C.
+ */
+static void
+lower_each(Ir_Builder *b, Ast_Node *node)
+{
+    if(node->each.array) {
+        emit_error("IR: Arrays are not supported", node->file, node->line, node->colm);
+        return;
+    }
+
+    s32 first = lower_expression(b, node->each.first);
+    s32 end   = lower_expression(b, node->each.end);
+    s32 scope_start = sb_count(b->locals);
+    lower_statement(b, node->each.variable);
+    s32 variable = sb_last(b->locals).variable;
+    write_variable(b, variable, b->current, first);
+
+    s32 header = new_block(b);
+    jump_to(b, header);
+    b->current = header;
+
+    s32 body = new_block(b);
+    s32 exit = new_block(b);
+    branch_to(b, lower_binary(b, tag_lessthan, read_variable(b, variable, header), end), body, exit);
+    seal_block(b, body);
+
+    b->current = body;
+    lower_statement(b, node->each.body);
+    s32 next = lower_binary(b, tag_plus, read_variable(b, variable, b->current), lower_constant(b, 1));
+    write_variable(b, variable, b->current, next);
+    jump_to(b, header);
+    seal_block(b, header);
+
+    seal_block(b, exit);
+    b->current = exit;
+    stb__sbn(b->locals) = scope_start;
+}
+
+/*
+ * The IR has no indirect jumps, matches are always a binary search
+ */
+static void
+lower_match_search(Ir_Builder *b, s32 value, Ast_Match_Case *cases, s32 count,
+                   s32 *case_blocks, s32 fallback)
+{
+    if(count <= IR_MATCH_LINEAR_CASES) {
+        for(s32 i = 0; i < count; ++i) {
+            s32 equal = lower_binary(b, tag_isequal, value, lower_constant(b, cases[i].value));
+            s32 next  = new_block(b);
+            branch_to(b, equal, case_blocks[cases[i].block], next);
+            seal_block(b, next);
+            b->current = next;
+        }
+        jump_to(b, fallback);
+        return;
+    }
+
+    s32 half  = count / 2;
+    s32 less  = lower_binary(b, tag_lessthan, value, lower_constant(b, cases[half].value));
+    s32 lower = new_block(b);
+    s32 upper = new_block(b);
+    branch_to(b, less, lower, upper);
+    seal_block(b, lower);
+    seal_block(b, upper);
+
+    b->current = lower;
+    lower_match_search(b, value, cases, half, case_blocks, fallback);
+    b->current = upper;
+    lower_match_search(b, value, cases + half, count - half, case_blocks, fallback);
+}
+
+static void
+lower_match(Ir_Builder *b, Ast_Node *node)
+{
+    s32 value = lower_expression(b, node->match.expression);
+
+    s32 *case_blocks = 0;
+    for(s32 i = 0; i < sb_count(node->match.blocks); ++i)
+        sb_push(case_blocks, new_block(b));
+    s32 fallback = new_block(b);
+    s32 end      = new_block(b);
+
+    lower_match_search(b, value, node->match.cases, sb_count(node->match.cases), case_blocks, fallback);
+
+    for(s32 i = 0; i < sb_count(node->match.blocks); ++i) {
+        seal_block(b, case_blocks[i]);
+        b->current = case_blocks[i];
+        lower_statement(b, node->match.blocks[i]);
+        jump_to(b, end);
+    }
+    seal_block(b, fallback);
+    b->current = fallback;
+    if(node->match.default_block) lower_statement(b, node->match.default_block);
+    jump_to(b, end);
+
+    seal_block(b, end);
+    b->current = end;
+    sb_free(case_blocks);
+}
+
+static void
+lower_return(Ir_Builder *b, s32 value)
+{
+    s32 ret = append(b, IR_RETURN);
+    set_operands(b, ret, &value, 1);
+}
+
+static void
+lower_statement(Ir_Builder *b, Ast_Node *node)
+{
+    switch(node->type)
+    {
+    case N_Block: {
+        s32 scope_start = sb_count(b->locals);
+        for(s32 i = 0; i < sb_count(node->block.statements); ++i)
+            lower_statement(b, node->block.statements[i]);
+        if(b->locals) stb__sbn(b->locals) = scope_start;
+    } break;
+    case N_Declaration: {
+        if(is_array_type(node->type_id)) {
+            emit_error("IR: Arrays are not supported", node->file, node->line, node->colm);
+            break;
+        }
+        Ir_Local local;
+        local.declaration = node;
+        local.variable    = b->variable_count++;
+        add_local(b, local);
+    } break;
+    case N_Assignment: {
+        if(node->assignment.indices) {
+            emit_error("IR: Arrays are not supported", node->file, node->line, node->colm);
+            break;
+        }
+        Ir_Local *local = find_local(b, node->assignment.declaration);
+        s32 value = lower_expression(b, node->assignment.expression);
+        if(!local) {
+            emit_error("IR: Assignment to undeclared variable", node->file, node->line, node->colm);
+            break;
+        }
+        write_variable(b, local->variable, b->current, value);
+    } break;
+    case N_If:
+        lower_if(b, node);
+        break;
+    case N_While:
+        lower_while(b, node);
+        break;
+    case N_Each:
+        lower_each(b, node);
+        break;
+    case N_Match:
+        lower_match(b, node);
+        break;
+    case N_Return:
+        lower_return(b, node->return_statement.expression
+                        ? lower_expression(b, node->return_statement.expression)
+                        : lower_constant(b, 0));
+        start_unreachable_block(b);
+        break;
+    case N_Goto:
+        jump_to(b, label_block(b, node->goto_statement.label));
+        start_unreachable_block(b);
+        break;
+    case N_Label: {
+        s32 block = label_block(b, node->label.identifier);
+        jump_to(b, block);
+        b->current = block;
+    } break;
+    default:
+        lower_expression(b, node);
+        break;
+    }
+}
+
+Ir_Function*
+lower_to_ir(Ast_Node *root)
+{
+    Ir_Function *function = chain_reserve(Ir_Function);
+    memset(function, 0, sizeof(*function));
+    function->name = "main";
+
+    Ir_Builder b = {0};
+    b.function = function;
+    b.current  = new_block(&b);
+    function->undef = append(&b, IR_UNDEF);
+    seal_block(&b, b.current);
+
+    lower_statement(&b, root);
+    lower_return(&b, lower_constant(&b, 0));
+
+    for(s32 i = 0; i < sb_count(b.labels); ++i)
+        seal_block(&b, b.labels[i].block);
+
+    for(s32 i = 0; i < sb_count(function->operands); ++i)
+        function->operands[i] = resolve_value(function, function->operands[i]);
+
+    for(s32 i = 0; i < sb_count(b.incomplete_phis); ++i)
+        sb_free(b.incomplete_phis[i]);
+    for(s32 i = 0; i < sb_count(b.phi_users); ++i)
+        sb_free(b.phi_users[i]);
+    sb_free(b.definitions);
+    free(b.definition_slots);
+    sb_free(b.locals);
+    free(b.local_slots);
+    sb_free(b.incomplete_phis);
+    sb_free(b.phi_users);
+    sb_free(b.labels);
+    return function;
+}
+
+/*
+ * Linear scan register allocation (Poletto & Sarkar)
+ *
+ * Instructions are numbered block by block, phis first. Live ranges come
+ * from a backwards liveness pass over per block bitsets and are widened to
+ * a single interval per value, without holes.
+ */
+
+static void
+bitset_set(u64 *words, s32 index)
+{
+    words[index >> 6] |= 1ull << (index & 63);
+}
+
+static void
+bitset_clear(u64 *words, s32 index)
+{
+    words[index >> 6] &= ~(1ull << (index & 63));
+}
+
+static s32
+successor_count(Ir_Instruction *terminator)
+{
+    if(terminator->op == IR_JUMP)   return 1;
+    if(terminator->op == IR_BRANCH) return 2;
+    return 0;
+}
+
+static Ir_Instruction*
+block_terminator(Ir_Function *function, s32 block)
+{
+    s32 *body = function->blocks[block].body;
+    if(!sb_count(body)) return 0;
+    return &function->instructions[sb_last(body)];
+}
+
+static void
+compute_live_out(Ir_Function *function, s32 block, u64 *live_in, u64 *live_out, s32 words)
+{
+    u64 *out = live_out + block * words;
+    memset(out, 0, words * sizeof(u64));
+
+    Ir_Instruction *terminator = block_terminator(function, block);
+    if(!terminator) return;
+
+    for(s32 s = 0; s < successor_count(terminator); ++s) {
+        s32 successor = terminator->target[s];
+        Ir_Block *succ = &function->blocks[successor];
+
+        for(s32 w = 0; w < words; ++w)
+            out[w] |= live_in[successor * words + w];
+
+        // Phi inputs are only live along the matching edge
+        s32 edge = -1;
+        for(s32 p = 0; p < sb_count(succ->predecessors); ++p)
+            if(succ->predecessors[p] == block) edge = p;
+
+        for(s32 p = 0; p < sb_count(succ->phis); ++p) {
+            Ir_Instruction *phi = &function->instructions[succ->phis[p]];
+            if(phi->op != IR_PHI) continue;
+            bitset_clear(out, succ->phis[p]);
+            if(edge >= 0 && edge < phi->operand_count)
+                bitset_set(out, function->operands[phi->first_operand + edge]);
+        }
+    }
+}
+
+static s32
+compute_live_in(Ir_Function *function, s32 block, u64 *live_in, u64 *live_out, s32 words)
+{
+    u64 *live = malloc(words * sizeof(u64));
+    memcpy(live, live_out + block * words, words * sizeof(u64));
+
+    s32 *body = function->blocks[block].body;
+    for(s32 i = sb_count(body) - 1; i >= 0; --i) {
+        Ir_Instruction *inst = &function->instructions[body[i]];
+        bitset_clear(live, body[i]);
+        for(s32 o = 0; o < inst->operand_count; ++o)
+            bitset_set(live, function->operands[inst->first_operand + o]);
+    }
+
+    s32 changed = memcmp(live, live_in + block * words, words * sizeof(u64)) != 0;
+    memcpy(live_in + block * words, live, words * sizeof(u64));
+    free(live);
+    return changed;
+}
+
+static Ir_Allocation *sort_allocations;
+
+static int
+compare_interval_start(const void *a, const void *b)
+{
+    s32 lhs = *(const s32*)a, rhs = *(const s32*)b;
+    s32 diff = sort_allocations[lhs].start - sort_allocations[rhs].start;
+    return diff ? diff : lhs - rhs;
+}
+
+void
+allocate_registers(Ir_Function *function, s32 register_count)
+{
+    s32 value_count = sb_count(function->instructions);
+    s32 block_count = sb_count(function->blocks);
+    s32 words       = (value_count + 63) / 64;
+
+    sb_free(function->allocations);
+    function->allocations = 0;
+    sb_add(function->allocations, value_count);
+    for(s32 i = 0; i < value_count; ++i) {
+        function->allocations[i].start      = -1;
+        function->allocations[i].end        = -1;
+        function->allocations[i].reg        = -1;
+        function->allocations[i].spill_slot = -1;
+    }
+    function->spill_slot_count = 0;
+
+    // Linear numbering
+    s32 *block_start = malloc(block_count * sizeof(s32));
+    s32 *block_end   = malloc(block_count * sizeof(s32));
+    s32 position = 0;
+    for(s32 b = 0; b < block_count; ++b) {
+        Ir_Block *block = &function->blocks[b];
+        block_start[b] = position;
+        for(s32 i = 0; i < sb_count(block->phis); ++i)
+            if(function->instructions[block->phis[i]].op == IR_PHI)
+                function->allocations[block->phis[i]].start = position++;
+        for(s32 i = 0; i < sb_count(block->body); ++i)
+            function->allocations[block->body[i]].start = position++;
+        block_end[b] = position ? position - 1 : 0;
+    }
+    for(s32 i = 0; i < value_count; ++i)
+        function->allocations[i].end = function->allocations[i].start;
+
+    // Liveness
+    u64 *live_in  = calloc((size_t)block_count * words + 1, sizeof(u64));
+    u64 *live_out = calloc((size_t)block_count * words + 1, sizeof(u64));
+    for(s32 changed = 1; changed;) {
+        changed = 0;
+        for(s32 b = block_count - 1; b >= 0; --b) {
+            compute_live_out(function, b, live_in, live_out, words);
+            changed |= compute_live_in(function, b, live_in, live_out, words);
+        }
+    }
+
+    // Intervals
+    for(s32 b = 0; b < block_count; ++b) {
+        for(s32 w = 0; w < words; ++w) {
+            for(u64 bits = live_in[b * words + w]; bits; bits &= bits - 1) {
+                Ir_Allocation *allocation = &function->allocations[w * 64 + __builtin_ctzll(bits)];
+                if(block_start[b] < allocation->start) allocation->start = block_start[b];
+            }
+            for(u64 bits = live_out[b * words + w]; bits; bits &= bits - 1) {
+                Ir_Allocation *allocation = &function->allocations[w * 64 + __builtin_ctzll(bits)];
+                if(block_end[b] > allocation->end) allocation->end = block_end[b];
+            }
+        }
+        s32 *body = function->blocks[b].body;
+        for(s32 i = 0; i < sb_count(body); ++i) {
+            Ir_Instruction *inst = &function->instructions[body[i]];
+            s32 use = function->allocations[body[i]].start;
+            for(s32 o = 0; o < inst->operand_count; ++o) {
+                Ir_Allocation *allocation = &function->allocations[function->operands[inst->first_operand + o]];
+                if(use > allocation->end) allocation->end = use;
+            }
+        }
+    }
+
+    // Scan
+    s32 *order = 0;
+    for(s32 v = 0; v < value_count; ++v)
+        if(is_value(function->instructions[v].op) && function->allocations[v].start >= 0)
+            sb_push(order, v);
+    sort_allocations = function->allocations;
+    if(order) qsort(order, sb_count(order), sizeof(s32), compare_interval_start);
+
+    s32 *active = malloc((register_count + 1) * sizeof(s32));
+    s32  active_count = 0;
+    s32 *free_registers = malloc((register_count + 1) * sizeof(s32));
+    s32  free_count = 0;
+    for(s32 r = register_count - 1; r >= 0; --r)
+        free_registers[free_count++] = r;
+
+    for(s32 i = 0; i < sb_count(order); ++i) {
+        s32 value = order[i];
+        Ir_Allocation *current = &function->allocations[value];
+
+        // Expire old intervals, active is kept sorted by end
+        s32 expired = 0;
+        while(expired < active_count && function->allocations[active[expired]].end < current->start) {
+            free_registers[free_count++] = function->allocations[active[expired]].reg;
+            ++expired;
+        }
+        memmove(active, active + expired, (active_count - expired) * sizeof(s32));
+        active_count -= expired;
+
+        if(free_count) {
+            current->reg = free_registers[--free_count];
+        }
+        else {
+            // Spill whichever interval ends last
+            s32 last = active[active_count - 1];
+            if(function->allocations[last].end > current->end) {
+                current->reg = function->allocations[last].reg;
+                function->allocations[last].reg = -1;
+                function->allocations[last].spill_slot = function->spill_slot_count++;
+                --active_count;
+            }
+            else {
+                current->spill_slot = function->spill_slot_count++;
+                continue;
+            }
+        }
+
+        s32 at = active_count;
+        while(at > 0 && function->allocations[active[at - 1]].end > current->end) {
+            active[at] = active[at - 1];
+            --at;
+        }
+        active[at] = value;
+        ++active_count;
+    }
+
+    free(active);
+    free(free_registers);
+    sb_free(order);
+    free(live_in);
+    free(live_out);
+    free(block_start);
+    free(block_end);
+}
+
+/*
+ * Textual dump
+ */
+
+static const c8*
+op_name(Ir_Op op)
+{
+    switch(op)
+    {
+    case IR_NOP    : return "nop";
+    case IR_UNDEF  : return "undef";
+    case IR_CONST  : return "const";
+    case IR_STRING : return "string";
+    case IR_PHI    : return "phi";
+    case IR_CALL   : return "call";
+    case IR_BIN    : return "bin";
+    case IR_JUMP   : return "jump";
+    case IR_BRANCH : return "branch";
+    case IR_RETURN : return "ret";
+    }
+    return "?";
+}
+
+static void
+dump_instruction(FILE *out, Ir_Function *function, s32 index)
+{
+    Ir_Instruction *inst = &function->instructions[index];
+    s32 *operands = function->operands + inst->first_operand;
+
+    fprintf(out, "    ");
+    if(is_value(inst->op)) fprintf(out, "%%%i = ", index);
+    fprintf(out, "%s", op_name(inst->op));
+
+    switch(inst->op)
+    {
+    case IR_CONST  : fprintf(out, " %lli", (long long)inst->constant); break;
+    case IR_STRING : fprintf(out, " \"%s\"", inst->string); break;
+    case IR_CALL   : fprintf(out, " %s", inst->symbol); break;
+    case IR_BIN    : fprintf(out, " %s", operator_spelling(inst->tag)); break;
+    default: break;
+    }
+
+    for(s32 i = 0; i < inst->operand_count; ++i) {
+        fprintf(out, i ? ", " : " ");
+        if(inst->op == IR_PHI)
+            fprintf(out, "[b%i: ", function->blocks[inst->block].predecessors[i]);
+        fprintf(out, "%%%i", operands[i]);
+        if(inst->op == IR_PHI) fprintf(out, "]");
+    }
+
+    if(inst->op == IR_JUMP)   fprintf(out, " b%i", inst->target[0]);
+    if(inst->op == IR_BRANCH) fprintf(out, " b%i, b%i", inst->target[0], inst->target[1]);
+
+    if(function->allocations && is_value(inst->op)) {
+        Ir_Allocation *allocation = &function->allocations[index];
+        if(allocation->reg >= 0)
+            fprintf(out, "\t; r%i [%i, %i]", allocation->reg, allocation->start, allocation->end);
+        else if(allocation->spill_slot >= 0)
+            fprintf(out, "\t; spill%i [%i, %i]", allocation->spill_slot, allocation->start, allocation->end);
+    }
+    fprintf(out, "\n");
+}
+
+void
+dump_ir(FILE *out, Ir_Function *function)
+{
+    fprintf(out, "function %s\n", function->name);
+    for(s32 b = 0; b < sb_count(function->blocks); ++b) {
+        Ir_Block *block = &function->blocks[b];
+        fprintf(out, "b%i:", b);
+        if(sb_count(block->predecessors)) {
+            fprintf(out, "\t\t; preds");
+            for(s32 i = 0; i < sb_count(block->predecessors); ++i)
+                fprintf(out, " b%i", block->predecessors[i]);
+        }
+        fprintf(out, "\n");
+
+        for(s32 i = 0; i < sb_count(block->phis); ++i)
+            if(function->instructions[block->phis[i]].op == IR_PHI)
+                dump_instruction(out, function, block->phis[i]);
+        for(s32 i = 0; i < sb_count(block->body); ++i)
+            dump_instruction(out, function, block->body[i]);
+    }
+    if(function->spill_slot_count)
+        fprintf(out, "; %i spill slots\n", function->spill_slot_count);
+}
@@ -0,0 +1,89 @@
+#ifndef IR_H_
+#define IR_H_
+
+#include <stdio.h>
+#include "Ast_Node.h"
+
+/*
+ * Three address SSA form
+ *
+ * A function is a handful of flat arrays. Instructions are referred to by
+ * their index, an instruction's index is also the SSA value it defines.
+ * Operand lists (call arguments, phi inputs) are ranges in one shared
+ * operand array. Blocks hold index lists into the instruction array, phis
+ * are kept apart from the body since they can be created after the body
+ * has been emitted.
+ */
+
+#define IR_NO_VALUE       -1
+#define IR_REGISTER_COUNT  8
+
+typedef enum Ir_Op {
+    IR_NOP = 0,
+    IR_UNDEF,
+    IR_CONST,
+    IR_STRING,
+    IR_PHI,
+    IR_CALL,
+    IR_BIN,
+    IR_JUMP,
+    IR_BRANCH,
+    IR_RETURN,
+} Ir_Op;
+
+typedef struct Ir_Instruction {
+    Ir_Op op;
+    s32   block;
+
+    union {
+        s64       constant;
+        c8       *string;
+        c8       *symbol;
+        enum Tag  tag;
+    };
+
+    // Operand range for calls, phis and binary operators
+    s32 first_operand;
+    s32 operand_count;
+
+    // Successors for jumps and branches
+    s32 target[2];
+
+    // Set when a trivial phi is folded away
+    s32 replaced_by;
+} Ir_Instruction;
+
+typedef struct Ir_Block {
+    s32 *phis;
+    s32 *body;
+    s32 *predecessors;
+    s32  sealed;
+} Ir_Block;
+
+typedef struct Ir_Allocation {
+    s32 start;
+    s32 end;
+    s32 reg;
+    s32 spill_slot;
+} Ir_Allocation;
+
+typedef struct Ir_Function {
+    c8             *name;
+    Ir_Instruction *instructions;
+    s32            *operands;
+    Ir_Block       *blocks;
+    Ir_Allocation  *allocations;
+    s32             spill_slot_count;
+    s32             undef;
+} Ir_Function;
+
+Ir_Function*
+lower_to_ir(Ast_Node *root);
+
+void
+allocate_registers(Ir_Function *function, s32 register_count);
+
+void
+dump_ir(FILE *out, Ir_Function *function);
+
+#endif
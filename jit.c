@@ -0,0 +1,681 @@
+/*
+ * x86-64 machine code emission straight from the AST
+ *
+ * Every declared variable gets an 8 byte slot below rbp, every expression
+ * leaves its value in rax. Calls follow the System V convention, arguments
+ * are pushed while they are evaluated and popped into registers just
+ * before the call.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "jit.h"
+#include "Module.h"
+#include "Parser.h"
+#include "Rope.h"
+#include "Symbol_Table.h"
+#include "Type_Table.h"
+#include "stretchy_buffer.h"
+
+#define JIT_MAX_REGISTER_ARGUMENTS 6
+
+typedef struct Jit_Local {
+    Ast_Node *declaration;
+    s32       offset;
+} Jit_Local;
+
+/*
+ * Code embeds absolute addresses of external functions and string
+ * literals, each is recorded so cached code can be patched when loaded
+ */
+typedef enum Jit_Relocation_Kind {
+    JIT_RELOCATE_FUNCTION,
+    JIT_RELOCATE_STRING,
+} Jit_Relocation_Kind;
+
+typedef struct Jit_Relocation {
+    u32 offset; // of the imm64 in the code
+    u32 kind;
+    u32 data;   // offset into the string blob, a symbol name or string bytes
+    u32 length; // of string bytes
+} Jit_Relocation;
+
+typedef struct Jit_Context {
+    u8             *code;
+    Jit_Relocation *relocations;
+    c8             *strings;
+    Jit_Local      *locals;
+    s32        frame_size;
+    s32        stack_depth;
+    s32        error_count;
+} Jit_Context;
+
+/*
+ * Cache files hold the code of a source file next to it, keyed by the
+ * hash of its text. The version changes whenever emitted code does.
+ */
+#define JIT_CACHE_MAGIC   0x4A535543 // "CUSJ"
+#define JIT_CACHE_VERSION 1
+
+typedef struct Jit_Cache_Header {
+    u32 magic;
+    u32 version;
+    u64 source_hash;
+    u32 code_size;
+    u32 relocation_count;
+    u32 string_bytes;
+    u32 reserved;
+} Jit_Cache_Header;
+
+static void
+jit_emit_node(Jit_Context *ctx, Ast_Node *node);
+
+static void
+emit_u8(Jit_Context *ctx, u8 byte)
+{
+    sb_push(ctx->code, byte);
+}
+
+static void
+emit_u32(Jit_Context *ctx, u32 value)
+{
+    memcpy(sb_add(ctx->code, 4), &value, 4);
+}
+
+static void
+emit_u64(Jit_Context *ctx, u64 value)
+{
+    memcpy(sb_add(ctx->code, 8), &value, 8);
+}
+
+// Records the imm64 about to be emitted
+static void
+add_relocation(Jit_Context *ctx, Jit_Relocation_Kind kind, const c8 *data, u32 length)
+{
+    Jit_Relocation relocation;
+    relocation.offset = sb_count(ctx->code);
+    relocation.kind   = kind;
+    relocation.data   = sb_count(ctx->strings);
+    relocation.length = length;
+    memcpy(sb_add(ctx->strings, length), data, length);
+    sb_push(ctx->relocations, relocation);
+}
+
+static void
+jit_error(Jit_Context *ctx, const c8 *message, Ast_Node *node)
+{
+    emit_node_error(message, node);
+    ++ctx->error_count;
+}
+
+static Jit_Local*
+find_local(Jit_Context *ctx, Ast_Node *declaration)
+{
+    for(s32 i = sb_count(ctx->locals) - 1; i >= 0; --i)
+        if(ctx->locals[i].declaration == declaration)
+            return &ctx->locals[i];
+    return 0;
+}
+
+static void
+jit_emit_declaration(Jit_Context *ctx, Ast_Node *node)
+{
+    if(is_array_type(node->type_id)) {
+        jit_error(ctx, "JIT: Arrays are not supported", node);
+        return;
+    }
+    // Values are kept as 64 bit integers, C types can't be
+    if(is_opaque_type(node->type_id)) {
+        jit_error(ctx, "JIT: Only int, char and string variables are supported", node);
+        return;
+    }
+    ctx->frame_size += 8;
+
+    Jit_Local local;
+    local.declaration = node;
+    local.offset      = ctx->frame_size;
+    sb_push(ctx->locals, local);
+
+    // mov qword [rbp - offset], 0
+    emit_u8(ctx, 0x48); emit_u8(ctx, 0xC7); emit_u8(ctx, 0x85);
+    emit_u32(ctx, (u32)-local.offset);
+    emit_u32(ctx, 0);
+}
+
+static void
+jit_emit_assignment(Jit_Context *ctx, Ast_Node *node)
+{
+    Jit_Local *local = find_local(ctx, node->assignment.declaration);
+    if(!local) {
+        jit_error(ctx, "JIT: Assignment to undeclared variable", node);
+        return;
+    }
+    if(node->assignment.indices) {
+        jit_error(ctx, "JIT: Arrays are not supported", node);
+        return;
+    }
+    jit_emit_node(ctx, node->assignment.expression);
+
+    // mov [rbp - offset], rax
+    emit_u8(ctx, 0x48); emit_u8(ctx, 0x89); emit_u8(ctx, 0x85);
+    emit_u32(ctx, (u32)-local->offset);
+}
+
+static void
+jit_emit_variable(Jit_Context *ctx, Ast_Node *node)
+{
+    Jit_Local *local = find_local(ctx, node->variable.declaration);
+    if(!local) {
+        jit_error(ctx, "JIT: Use of undeclared variable", node);
+        return;
+    }
+
+    // mov rax, [rbp - offset]
+    emit_u8(ctx, 0x48); emit_u8(ctx, 0x8B); emit_u8(ctx, 0x85);
+    emit_u32(ctx, (u32)-local->offset);
+}
+
+static void
+jit_emit_number(Jit_Context *ctx, Ast_Node *node)
+{
+    // mov rax, imm32 (sign extended)
+    emit_u8(ctx, 0x48); emit_u8(ctx, 0xC7); emit_u8(ctx, 0xC0);
+    emit_u32(ctx, (u32)node->number.value);
+}
+
+static void
+jit_emit_string(Jit_Context *ctx, Ast_Node *node)
+{
+    // Literals are held in their C spelling, the program gets the bytes
+    u32 length = (u32)strlen(node->string.value);
+    c8 *bytes  = malloc(length + 1);
+    u32 size   = decode_string_literal(node->string.value, length, bytes);
+    c8 *value  = cache_string_length(bytes, size);
+
+    // movabs rax, imm64, the cached string lives as long as the process
+    emit_u8(ctx, 0x48); emit_u8(ctx, 0xB8);
+    add_relocation(ctx, JIT_RELOCATE_STRING, bytes, size);
+    emit_u64(ctx, (u64)(uintptr_t)value);
+    free(bytes);
+}
+
+static void
+jit_emit_function_call(Jit_Context *ctx, Ast_Node *node)
+{
+    // pop rdi, rsi, rdx, rcx, r8, r9
+    static const u8 pop_argument[JIT_MAX_REGISTER_ARGUMENTS][2] = {
+        {0x00, 0x5F}, {0x00, 0x5E}, {0x00, 0x5A},
+        {0x00, 0x59}, {0x41, 0x58}, {0x41, 0x59},
+    };
+
+    s32 argument_count = sb_count(node->function_call.arguments);
+    if(argument_count > JIT_MAX_REGISTER_ARGUMENTS) {
+        jit_error(ctx, "JIT: Calls with more than 6 arguments are not supported", node);
+        return;
+    }
+
+    void *address = dlsym(RTLD_DEFAULT, node->function_call.identifier);
+    if(!address) {
+        jit_error(ctx, "JIT: Unresolved external function", node);
+        return;
+    }
+
+    for(s32 i = 0; i < argument_count; ++i) {
+        jit_emit_node(ctx, node->function_call.arguments[i]);
+        emit_u8(ctx, 0x50); // push rax
+        ++ctx->stack_depth;
+    }
+
+    for(s32 i = argument_count - 1; i >= 0; --i) {
+        if(pop_argument[i][0]) emit_u8(ctx, pop_argument[i][0]);
+        emit_u8(ctx, pop_argument[i][1]);
+        --ctx->stack_depth;
+    }
+
+    // Outer calls may still have arguments pushed, keep rsp 16 byte aligned
+    s32 misaligned = ctx->stack_depth & 1;
+    if(misaligned) {
+        emit_u8(ctx, 0x48); emit_u8(ctx, 0x83); emit_u8(ctx, 0xEC); emit_u8(ctx, 0x08);
+    }
+
+    emit_u8(ctx, 0x31); emit_u8(ctx, 0xC0);                   // xor eax, eax (no vector args)
+    emit_u8(ctx, 0x49); emit_u8(ctx, 0xBB);                   // movabs r11, address
+    add_relocation(ctx, JIT_RELOCATE_FUNCTION, node->function_call.identifier,
+                   strlen(node->function_call.identifier) + 1);
+    emit_u64(ctx, (u64)(uintptr_t)address);
+    emit_u8(ctx, 0x41); emit_u8(ctx, 0xFF); emit_u8(ctx, 0xD3); // call r11
+    // External functions return int, the upper half of rax is garbage
+    emit_u8(ctx, 0x48); emit_u8(ctx, 0x63); emit_u8(ctx, 0xC0); // movsxd rax, eax
+
+    if(misaligned) {
+        emit_u8(ctx, 0x48); emit_u8(ctx, 0x83); emit_u8(ctx, 0xC4); emit_u8(ctx, 0x08);
+    }
+}
+
+/*
+ * Control flow
+ * Jumps are emitted with a zero rel32 and patched once the target is known
+ */
+
+static s32
+emit_jump(Jit_Context *ctx, u8 opcode)
+{
+    if(opcode == 0xE9) emit_u8(ctx, 0xE9);                    // jmp rel32
+    else { emit_u8(ctx, 0x0F); emit_u8(ctx, opcode); }      // jcc rel32
+    emit_u32(ctx, 0);
+    return sb_count(ctx->code) - 4;
+}
+
+static void
+patch_jump(Jit_Context *ctx, s32 patch, s32 target)
+{
+    u32 offset = (u32)(target - (patch + 4));
+    memcpy(ctx->code + patch, &offset, 4);
+}
+
+static void
+emit_test_rax(Jit_Context *ctx)
+{
+    emit_u8(ctx, 0x85); emit_u8(ctx, 0xC0);                 // test eax, eax
+}
+
+/*
+ * Values are ints, operated on in eax/ecx and kept sign extended in rax
+ */
+static void
+jit_emit_bin_operator(Jit_Context *ctx, Ast_Node *node)
+{
+    enum Tag tag = node->bin_operator.tag;
+
+    // Short circuit, at the end the flags of the last test decide
+    if(tag == tag_and || tag == tag_or) {
+        jit_emit_node(ctx, node->bin_operator.lhs);
+        emit_test_rax(ctx);
+        s32 skip = emit_jump(ctx, tag == tag_and ? 0x84 : 0x85); // jz / jnz
+        jit_emit_node(ctx, node->bin_operator.rhs);
+        emit_test_rax(ctx);
+        patch_jump(ctx, skip, sb_count(ctx->code));
+        emit_u8(ctx, 0x0F); emit_u8(ctx, 0x95); emit_u8(ctx, 0xC0); // setne al
+        emit_u8(ctx, 0x0F); emit_u8(ctx, 0xB6); emit_u8(ctx, 0xC0); // movzx eax, al
+        return;
+    }
+
+    jit_emit_node(ctx, node->bin_operator.lhs);
+    emit_u8(ctx, 0x50);                                         // push rax
+    ++ctx->stack_depth;
+    jit_emit_node(ctx, node->bin_operator.rhs);
+    emit_u8(ctx, 0x48); emit_u8(ctx, 0x89); emit_u8(ctx, 0xC1); // mov rcx, rax
+    emit_u8(ctx, 0x58);                                         // pop rax
+    --ctx->stack_depth;
+
+    u8 condition = 0;
+    switch(tag)
+    {
+    case tag_plus      : emit_u8(ctx, 0x01); emit_u8(ctx, 0xC8); break;                   // add eax, ecx
+    case tag_minus     : emit_u8(ctx, 0x29); emit_u8(ctx, 0xC8); break;                   // sub eax, ecx
+    case tag_astrix    : emit_u8(ctx, 0x0F); emit_u8(ctx, 0xAF); emit_u8(ctx, 0xC1); break; // imul eax, ecx
+    case tag_ampersand : emit_u8(ctx, 0x21); emit_u8(ctx, 0xC8); break;                   // and eax, ecx
+    case tag_pipe      : emit_u8(ctx, 0x09); emit_u8(ctx, 0xC8); break;                   // or eax, ecx
+    case tag_caret     : emit_u8(ctx, 0x31); emit_u8(ctx, 0xC8); break;                   // xor eax, ecx
+    case tag_lshift    : emit_u8(ctx, 0xD3); emit_u8(ctx, 0xE0); break;                   // shl eax, cl
+    case tag_rshift    : emit_u8(ctx, 0xD3); emit_u8(ctx, 0xF8); break;                   // sar eax, cl
+    case tag_slash     :
+    case tag_percent   :
+        emit_u8(ctx, 0x99);                                     // cdq
+        emit_u8(ctx, 0xF7); emit_u8(ctx, 0xF9);                 // idiv ecx
+        if(tag == tag_percent) { emit_u8(ctx, 0x89); emit_u8(ctx, 0xD0); } // mov eax, edx
+        break;
+    case tag_isequal          : condition = 0x94; break;     // sete
+    case tag_notequal         : condition = 0x95; break;     // setne
+    case tag_lessthan         : condition = 0x9C; break;     // setl
+    case tag_lessthanequal    : condition = 0x9E; break;     // setle
+    case tag_greaterthan      : condition = 0x9F; break;     // setg
+    case tag_greaterthanequal : condition = 0x9D; break;     // setge
+    default:
+        jit_error(ctx, "JIT: Unsupported operator", node);
+        return;
+    }
+
+    if(condition) {
+        emit_u8(ctx, 0x39); emit_u8(ctx, 0xC8);                  // cmp eax, ecx
+        emit_u8(ctx, 0x0F); emit_u8(ctx, condition); emit_u8(ctx, 0xC0);
+        emit_u8(ctx, 0x0F); emit_u8(ctx, 0xB6); emit_u8(ctx, 0xC0); // movzx eax, al
+    }
+    emit_u8(ctx, 0x48); emit_u8(ctx, 0x63); emit_u8(ctx, 0xC0);     // movsxd rax, eax
+}
+
+static void
+jit_emit_block(Jit_Context *ctx, Ast_Node *node);
+
+static void
+jit_emit_if(Jit_Context *ctx, Ast_Node *node)
+{
+    s32 *exits = 0;
+    for(s32 i = 0; i < sb_count(node->if_statement.blocks); ++i) {
+        jit_emit_node(ctx, node->if_statement.conditions[i]);
+        emit_test_rax(ctx);
+        s32 next = emit_jump(ctx, 0x84);                       // jz next
+        jit_emit_block(ctx, node->if_statement.blocks[i]);
+        sb_push(exits, emit_jump(ctx, 0xE9));
+        patch_jump(ctx, next, sb_count(ctx->code));
+    }
+    if(node->if_statement.else_block) jit_emit_block(ctx, node->if_statement.else_block);
+
+    for(s32 i = 0; i < sb_count(exits); ++i)
+        patch_jump(ctx, exits[i], sb_count(ctx->code));
+    sb_free(exits);
+}
+
+static void
+jit_emit_while(Jit_Context *ctx, Ast_Node *node)
+{
+    s32 top  = sb_count(ctx->code);
+    s32 exit = -1;
+    if(node->while_statement.condition) {
+        jit_emit_node(ctx, node->while_statement.condition);
+        emit_test_rax(ctx);
+        exit = emit_jump(ctx, 0x84);                           // jz exit
+    }
+    jit_emit_block(ctx, node->while_statement.body);
+    patch_jump(ctx, emit_jump(ctx, 0xE9), top);
+    if(exit >= 0) patch_jump(ctx, exit, sb_count(ctx->code));
+}
+
+/*
+ * Ranges only, the end is kept in a slot of its own so it is evaluated once
+ */
+static void
+jit_emit_each(Jit_Context *ctx, Ast_Node *node)
+{
+    if(node->each.array) {
+        jit_error(ctx, "JIT: Arrays are not supported", node);
+        return;
+    }
+
+    s32 scope_start = sb_count(ctx->locals);
+    jit_emit_declaration(ctx, node->each.variable);
+    u32 variable = (u32)-sb_last(ctx->locals).offset;
+    jit_emit_node(ctx, node->each.first);
+    emit_u8(ctx, 0x48); emit_u8(ctx, 0x89); emit_u8(ctx, 0x85); // mov [rbp - variable], rax
+    emit_u32(ctx, variable);
+
+    ctx->frame_size += 8;
+    u32 end = (u32)-ctx->frame_size;
+    jit_emit_node(ctx, node->each.end);
+    emit_u8(ctx, 0x48); emit_u8(ctx, 0x89); emit_u8(ctx, 0x85); // mov [rbp - end], rax
+    emit_u32(ctx, end);
+
+    s32 top = sb_count(ctx->code);
+    emit_u8(ctx, 0x48); emit_u8(ctx, 0x8B); emit_u8(ctx, 0x85); // mov rax, [rbp - variable]
+    emit_u32(ctx, variable);
+    emit_u8(ctx, 0x48); emit_u8(ctx, 0x3B); emit_u8(ctx, 0x85); // cmp rax, [rbp - end]
+    emit_u32(ctx, end);
+    s32 exit = emit_jump(ctx, 0x8D);                           // jge exit
+    jit_emit_block(ctx, node->each.body);
+    emit_u8(ctx, 0x48); emit_u8(ctx, 0xFF); emit_u8(ctx, 0x85); // inc qword [rbp - variable]
+    emit_u32(ctx, variable);
+    patch_jump(ctx, emit_jump(ctx, 0xE9), top);
+    patch_jump(ctx, exit, sb_count(ctx->code));
+    stb__sbn(ctx->locals) = scope_start;
+}
+
+static void
+jit_emit_return(Jit_Context *ctx, Ast_Node *node)
+{
+    if(node->return_statement.expression) jit_emit_node(ctx, node->return_statement.expression);
+    else { emit_u8(ctx, 0x31); emit_u8(ctx, 0xC0); }          // xor eax, eax
+    emit_u8(ctx, 0x48); emit_u8(ctx, 0x89); emit_u8(ctx, 0xEC); // mov rsp, rbp
+    emit_u8(ctx, 0x5D);                                         // pop rbp
+    emit_u8(ctx, 0xC3);                                         // ret
+}
+
+static void
+jit_emit_block(Jit_Context *ctx, Ast_Node *node)
+{
+    s32 scope_start = sb_count(ctx->locals);
+    for(s32 i = 0; i < sb_count(node->block.statements); ++i)
+        jit_emit_node(ctx, node->block.statements[i]);
+    if(ctx->locals) stb__sbn(ctx->locals) = scope_start;
+}
+
+static void
+jit_emit_node(Jit_Context *ctx, Ast_Node *node)
+{
+    switch(node->type)
+    {
+    case N_Block         : jit_emit_block         (ctx, node); break;
+    case N_Declaration   : jit_emit_declaration   (ctx, node); break;
+    case N_Assignment    : jit_emit_assignment    (ctx, node); break;
+    case N_Function_Call : jit_emit_function_call (ctx, node); break;
+    case N_Variable      : jit_emit_variable      (ctx, node); break;
+    case N_Number        : jit_emit_number        (ctx, node); break;
+    case N_String        : jit_emit_string        (ctx, node); break;
+    case N_Bin_Operator  : jit_emit_bin_operator  (ctx, node); break;
+    case N_If            : jit_emit_if            (ctx, node); break;
+    case N_While         : jit_emit_while         (ctx, node); break;
+    case N_Return        : jit_emit_return        (ctx, node); break;
+    case N_Import        : jit_error(ctx, "JIT: Imported modules only exist as C code", node); break;
+    case N_Each          : jit_emit_each          (ctx, node); break;
+    case N_Index         : jit_error(ctx, "JIT: Arrays are not supported", node); break;
+    default: jit_error(ctx, "JIT: Unsupported AST Node type", node); break;
+    }
+}
+
+static Jit_Function
+make_executable(u8 *code, s32 size)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t mapped_size = (size + page_size - 1) & ~(page_size - 1);
+
+    void *memory = mmap(0, mapped_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED) {
+        emit_error("JIT: Could not map memory for code", 0, 0, 0);
+        return 0;
+    }
+
+    memcpy(memory, code, size);
+    if(mprotect(memory, mapped_size, PROT_READ | PROT_EXEC) != 0) {
+        emit_error("JIT: Could not make code executable", 0, 0, 0);
+        munmap(memory, mapped_size);
+        return 0;
+    }
+
+    Jit_Function result;
+    memcpy(&result, &memory, sizeof(result));
+    return result;
+}
+
+// Emits the whole block into ctx, returns the number of errors
+static s32
+jit_emit_program(Jit_Context *ctx, Ast_Node *root)
+{
+    emit_u8(ctx, 0x55);                                        // push rbp
+    emit_u8(ctx, 0x48); emit_u8(ctx, 0x89); emit_u8(ctx, 0xE5); // mov rbp, rsp
+    emit_u8(ctx, 0x48); emit_u8(ctx, 0x81); emit_u8(ctx, 0xEC); // sub rsp, frame
+    s32 frame_patch = sb_count(ctx->code);
+    emit_u32(ctx, 0);
+    emit_u8(ctx, 0x31); emit_u8(ctx, 0xC0);                      // xor eax, eax
+
+    jit_emit_node(ctx, root);
+
+    emit_u8(ctx, 0x48); emit_u8(ctx, 0x89); emit_u8(ctx, 0xEC); // mov rsp, rbp
+    emit_u8(ctx, 0x5D);                                        // pop rbp
+    emit_u8(ctx, 0xC3);                                        // ret
+
+    u32 frame_size = (ctx->frame_size + 15) & ~15;
+    memcpy(ctx->code + frame_patch, &frame_size, 4);
+    return ctx->error_count;
+}
+
+static void
+free_context(Jit_Context *ctx)
+{
+    sb_free(ctx->code);
+    sb_free(ctx->relocations);
+    sb_free(ctx->strings);
+    sb_free(ctx->locals);
+}
+
+Jit_Function
+jit_compile(Ast_Node *root)
+{
+    Jit_Context ctx = {0};
+
+    Jit_Function result = 0;
+    if(!jit_emit_program(&ctx, root))
+        result = make_executable(ctx.code, sb_count(ctx.code));
+
+    free_context(&ctx);
+    return result;
+}
+
+/*
+ * Cache files
+ */
+
+static c8*
+cache_path(const c8 *source_file)
+{
+    c8 buffer[4096];
+    snprintf(buffer, sizeof(buffer), "%sjit", source_file);
+    return intern_string(buffer);
+}
+
+// Failing to write only costs a compile next time, so it isn't an error
+static void
+write_cache(c8 *cache_file, u64 hash, Jit_Context *ctx)
+{
+    Jit_Cache_Header header = {0};
+    header.magic            = JIT_CACHE_MAGIC;
+    header.version          = JIT_CACHE_VERSION;
+    header.source_hash      = hash;
+    header.code_size        = sb_count(ctx->code);
+    header.relocation_count = sb_count(ctx->relocations);
+    header.string_bytes     = sb_count(ctx->strings);
+
+    // Written aside and renamed, so a failed run never leaves half a file
+    c8 temporary_file[4096];
+    snprintf(temporary_file, sizeof(temporary_file), "%s.tmp", cache_file);
+
+    FILE *file = fopen(temporary_file, "wb");
+    if(!file) return;
+    s32 written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  fwrite(ctx->relocations, sizeof(*ctx->relocations), header.relocation_count, file) == header.relocation_count &&
+                  fwrite(ctx->code, 1, header.code_size, file) == header.code_size &&
+                  fwrite(ctx->strings, 1, header.string_bytes, file) == header.string_bytes;
+    written = (fclose(file) == 0) && written;
+    written = written && rename(temporary_file, cache_file) == 0;
+    if(!written) remove(temporary_file);
+}
+
+static Jit_Cache_Header*
+check_cache(u8 *data, u64 size, u64 hash)
+{
+    if(size < sizeof(Jit_Cache_Header)) return 0;
+
+    Jit_Cache_Header *header = (Jit_Cache_Header*)data;
+    if(header->magic != JIT_CACHE_MAGIC || header->version != JIT_CACHE_VERSION ||
+       header->source_hash != hash)
+        return 0;
+
+    u64 expected = sizeof(Jit_Cache_Header)
+                 + (u64)header->relocation_count * sizeof(Jit_Relocation)
+                 + header->code_size
+                 + header->string_bytes;
+    if(expected != size) return 0;
+
+    Jit_Relocation *relocations = (Jit_Relocation*)(header + 1);
+    c8 *strings = (c8*)(relocations + header->relocation_count) + header->code_size;
+    for(u32 i = 0; i < header->relocation_count; ++i) {
+        Jit_Relocation *relocation = &relocations[i];
+        if((u64)relocation->offset + 8 > header->code_size) return 0;
+        if((u64)relocation->data + relocation->length > header->string_bytes) return 0;
+        if(relocation->kind == JIT_RELOCATE_FUNCTION &&
+           (!relocation->length || strings[relocation->data + relocation->length - 1] != 0))
+            return 0;
+        if(relocation->kind != JIT_RELOCATE_FUNCTION && relocation->kind != JIT_RELOCATE_STRING)
+            return 0;
+    }
+    return header;
+}
+
+// Returns 0 when there is no usable cache, the file is then compiled
+static Jit_Function
+load_cache(c8 *cache_file, u64 hash)
+{
+    s32 fd = open(cache_file, O_RDONLY);
+    if(fd < 0) return 0;
+
+    struct stat info;
+    u8 *data = 0;
+    Jit_Cache_Header *header = 0;
+    if(fstat(fd, &info) == 0) {
+        data = malloc(info.st_size ? info.st_size : 1);
+        if(read(fd, data, info.st_size) == info.st_size)
+            header = check_cache(data, info.st_size, hash);
+    }
+    close(fd);
+
+    Jit_Function result = 0;
+    if(header) {
+        Jit_Relocation *relocations = (Jit_Relocation*)(header + 1);
+        u8 *code = (u8*)(relocations + header->relocation_count);
+        c8 *strings = (c8*)code + header->code_size;
+
+        s32 resolved = 1;
+        for(u32 i = 0; i < header->relocation_count && resolved; ++i) {
+            Jit_Relocation *relocation = &relocations[i];
+            c8 *bytes = strings + relocation->data;
+            void *address = relocation->kind == JIT_RELOCATE_FUNCTION
+                          ? dlsym(RTLD_DEFAULT, bytes)
+                          : cache_string_length(bytes, relocation->length);
+            resolved = address != 0;
+            u64 value = (u64)(uintptr_t)address;
+            memcpy(code + relocation->offset, &value, 8);
+        }
+        if(resolved) result = make_executable(code, header->code_size);
+    }
+    free(data);
+    return result;
+}
+
+Jit_Function
+jit_compile_file(c8 *file_name)
+{
+    u64 hash;
+    if(!hash_file(file_name, &hash)) {
+        emit_error("JIT: Could not read source file", 0, 0, 0);
+        return 0;
+    }
+
+    c8 *cache_file = cache_path(file_name);
+    Jit_Function result = load_cache(cache_file, hash);
+    if(result) return result;
+
+    Token_Stream token_stream = {0};
+
+    tokenize_file(&token_stream, file_name);
+    Ast_Node *root = parse_stream(&token_stream);
+    sb_free(token_stream.tokens);
+    if(token_stream.error_count) return 0;
+    if(load_imports(root))  return 0;
+    if(resolve_names(root)) return 0;
+    if(type_check(root))    return 0;
+
+    Jit_Context ctx = {0};
+    if(!jit_emit_program(&ctx, root)) {
+        result = make_executable(ctx.code, sb_count(ctx.code));
+        if(result) write_cache(cache_file, hash, &ctx);
+    }
+    free_context(&ctx);
+    return result;
+}
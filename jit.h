@@ -0,0 +1,25 @@
+#ifndef JIT_H_
+#define JIT_H_
+
+#include "Ast_Node.h"
+
+/*
+ * In-process x86-64 backend
+ * The compiled block runs as a function with no arguments, its result
+ * is the value of the last statement executed
+ */
+typedef s64 (*Jit_Function)(void);
+
+Jit_Function
+jit_compile(Ast_Node *root);
+
+/*
+ * Compile a source file. The code is cached on disk next to it, in
+ * <file>jit keyed by a hash of the source, so running the same text
+ * again loads the code, relocating its calls and strings, instead of
+ * parsing and compiling
+ */
+Jit_Function
+jit_compile_file(c8 *file_name);
+
+#endif
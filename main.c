@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "Compiler.h"
 #include "Rope.h"
@@ -7,62 +9,89 @@
 #include "Ast_Node.h"
 #include "Parser.h"
 #include "code_emission.h"
+#include "jit.h"
+#include "ir.h"
+#include "Symbol_Table.h"
+#include "Type_Table.h"
+#include "Thread_Pool.h"
+#include "streaming.h"
+#include "fast_path.h"
+#include "cse.h"
+#include "Module.h"
+#include "profile.h"
 
 #include "stretchy_buffer.h"
 
-#define CHAIN_BUFFER_IMPLEMENTATION
-#include "Chain_Buffer.h"
-
-
-void
-emit_error(const c8 *message, c8 *file_name, s32 line, s32 colm)
-{
-    fprintf(stderr, "%s\n\t%s(%i:%i)\n", message, file_name, line, colm);
-
-    const s32 MAX_LINE_LEN = 120;
-    if(colm > MAX_LINE_LEN)
-        fprintf(stderr, "Error line is too long, not printing\n");
-
-    FILE *file = fopen(file_name, "r");
-    go_to_line(file, line);
-
-    c8 line_buffer[MAX_LINE_LEN];
-    fgets(line_buffer, MAX_LINE_LEN, file);
-    fprintf(stderr, "%s", line_buffer);
-
-    for(s32 i = 0; i < colm - 2; ++i)
-        fputc('~', stderr);
-
-    fprintf(stderr, "^\n");
-}
-
-void
-go_to_line (FILE *file, s32 line)
-{
-    c8 c;
-    for(s32 i = 0; i < line - 1; ++i)
-        do c = fgetc(file);
-        while (c != '\n');
-}
-
 int
 main(s32 argc, c8 **argv)
 {
-    if(argc == 1) {
+    c8 *file_name = 0;
+    s32 use_jit   = 0;
+    s32 dump      = 0;
+    s32 parallel  = 0;
+    s32 streaming = 0;
+    s32 module    = 0;
+    s32 profiled  = 0;
+    s32 report    = 0;
+    s32 fast      = 0;
+    s32 cse       = 0;
+
+    for(s32 i = 1; i < argc; ++i) {
+        if     (strcmp(argv[i], "-jit") == 0) use_jit = 1;
+        else if(strcmp(argv[i], "-ir")  == 0) dump    = 1;
+        else if(strcmp(argv[i], "-parallel") == 0) parallel = 1;
+        else if(strcmp(argv[i], "-stream") == 0) streaming = 1;
+        else if(strcmp(argv[i], "-module") == 0) module    = 1;
+        else if(strcmp(argv[i], "-profile") == 0) profiled = 1;
+        else if(strcmp(argv[i], "-report") == 0)  report   = 1;
+        else if(strcmp(argv[i], "-fast") == 0)    fast     = 1;
+        else if(strcmp(argv[i], "-cse") == 0)     cse      = 1;
+        else if(strcmp(argv[i], "-threads") == 0 && i + 1 < argc) set_thread_count(atoi(argv[++i]));
+        else file_name = cache_string(argv[i]);
+    }
+
+    if(!file_name) {
         fprintf(stderr, "No input file(s)\n");
         return -1;
     }
 
-    c8 *file_name = cache_string(argv[1]);
+    if(use_jit) {
+        Jit_Function function = jit_compile_file(file_name);
+        if(!function) return -1;
+        return (s32)function();
+    }
+
+    if(report)    return report_profile(stdout, file_name) ? -1 : 0;
+    if(module)    return build_module_file(file_name) ? -1 : 0;
+    if(streaming) return stream_compile_file(stdout, file_name) ? -1 : 0;
+    if(fast && !cse && !dump && !profiled && fast_compile_file(stdout, file_name)) return 0;
 
-    Token_Stream token_stream;
-    token_stream.tokens = 0;
-    token_stream.current= 0;
+    Token_Stream token_stream = {0};
 
     tokenize_file(&token_stream, file_name);
     Ast_Node *root_node = parse_stream(&token_stream);
+    if(token_stream.error_count) return -1;
+    if(load_imports(root_node))  return -1;
+    if(resolve_names(root_node)) return -1;
+    if(type_check(root_node))    return -1;
+    if(cse) eliminate_common_subexpressions(root_node);
+
+    if(dump) {
+        Ir_Function *function = lower_to_ir(root_node);
+        allocate_registers(function, IR_REGISTER_COUNT);
+        dump_ir(stdout, function);
+        return 0;
+    }
+
+    if(profiled) {
+        Profile profile;
+        if(!open_profile(&profile, file_name)) return -1;
+        emit_profiled_code(stdout, root_node, &profile);
+        return write_profile_map(&profile) ? -1 : 0;
+    }
 
-    emit_code(stdout, root_node);
+    if(parallel) emit_code_parallel(stdout, root_node);
+    else         emit_code(stdout, root_node);
 
     for(s32 i = 0; i < sb_count(token_stream.tokens); ++i) {
         Token *token = &token_stream.tokens[i];
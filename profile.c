@@ -0,0 +1,189 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+#include "Compiler.h"
+#include "Rope.h"
+#include "stretchy_buffer.h"
+
+static const c8 *site_kind_names[] = { "block", "call" };
+
+typedef struct Profile_Count {
+    u64 count;
+    s32 id;
+} Profile_Count;
+
+/*
+ * name.cus becomes name<extension>, other names just get it appended
+ */
+static c8*
+profile_path(const c8 *source_file, const c8 *extension)
+{
+    size_t length = strlen(source_file);
+    if(length > 4 && strcmp(source_file + length - 4, ".cus") == 0) length -= 4;
+
+    c8 buffer[4096];
+    snprintf(buffer, sizeof(buffer), "%.*s%s", (s32)length, source_file, extension);
+    return intern_string(buffer);
+}
+
+s32
+open_profile(Profile *profile, c8 *source_file)
+{
+    memset(profile, 0, sizeof(*profile));
+    profile->map_file  = profile_path(source_file, ".cusmap");
+    profile->data_file = profile_path(source_file, ".cusprof");
+    return hash_file(source_file, &profile->source_hash);
+}
+
+s32
+add_profile_site(Profile *profile, Profile_Site_Kind kind, Ast_Node *node)
+{
+    Profile_Site site;
+    site.kind = kind;
+    site.file = node->file;
+    site.line = node->line;
+    site.colm = node->colm;
+    sb_push(profile->sites, site);
+    return sb_count(profile->sites) - 1;
+}
+
+s32
+write_profile_map(Profile *profile)
+{
+    FILE *out = fopen(profile->map_file, "w");
+    if(!out) {
+        emit_error("Profile: Could not write map file", profile->map_file, 0, 0);
+        return 1;
+    }
+
+    fprintf(out, "cusmap %i %llx\n", sb_count(profile->sites), (unsigned long long)profile->source_hash);
+    for(s32 i = 0; i < sb_count(profile->sites); ++i) {
+        Profile_Site *site = &profile->sites[i];
+        fprintf(out, "%s %i %i %s\n", site_kind_names[site->kind], site->line, site->colm,
+                site->file ? site->file : "?");
+    }
+    fclose(out);
+    return 0;
+}
+
+/*
+ * Reading
+ */
+
+static s32
+read_profile_map(Profile *profile)
+{
+    FILE *in = fopen(profile->map_file, "r");
+    if(!in) {
+        emit_error("Profile: Could not read map file", profile->map_file, 0, 0);
+        return 1;
+    }
+
+    c8 line[4096 + 64];
+    s32 count = -1;
+    unsigned long long hash = 0;
+    if(fgets(line, sizeof(line), in)) sscanf(line, "cusmap %i %llx", &count, &hash);
+    profile->source_hash = hash;
+
+    while(count > sb_count(profile->sites) && fgets(line, sizeof(line), in)) {
+        c8 kind[16];
+        s32 file_start = 0;
+        Profile_Site site;
+        if(sscanf(line, "%15s %i %i %n", kind, &site.line, &site.colm, &file_start) != 3 || !file_start)
+            break;
+
+        line[strcspn(line, "\n")] = 0;
+        site.kind = strcmp(kind, "call") == 0 ? PROFILE_CALL : PROFILE_BLOCK;
+        site.file = intern_string(line + file_start);
+        sb_push(profile->sites, site);
+    }
+    fclose(in);
+
+    if(count < 0 || count != sb_count(profile->sites)) {
+        emit_error("Profile: Malformed map file", profile->map_file, 0, 0);
+        return 1;
+    }
+    return 0;
+}
+
+static u64*
+read_profile_counters(Profile *profile)
+{
+    FILE *in = fopen(profile->data_file, "rb");
+    if(!in) {
+        emit_error("Profile: Could not read profile, run the profiled program first", profile->data_file, 0, 0);
+        return 0;
+    }
+
+    u64 header[3];
+    u64 count    = sb_count(profile->sites);
+    u64 *counters = malloc((count ? count : 1) * sizeof(u64));
+    s32 valid = fread(header, sizeof(header), 1, in) == 1 &&
+                header[0] == PROFILE_MAGIC && header[1] == count &&
+                fread(counters, sizeof(u64), count, in) == count;
+    fclose(in);
+
+    if(!valid) {
+        emit_error("Profile: Malformed profile", profile->data_file, 0, 0);
+        free(counters);
+        return 0;
+    }
+    if(header[2] != profile->source_hash) {
+        emit_error("Profile: Profile was written by a different build than the map", profile->data_file, 0, 0);
+        free(counters);
+        return 0;
+    }
+    return counters;
+}
+
+static s32
+compare_counts(const void *a, const void *b)
+{
+    const Profile_Count *lhs = a, *rhs = b;
+    if(lhs->count != rhs->count) return lhs->count > rhs->count ? -1 : 1;
+    return lhs->id - rhs->id;
+}
+
+s32
+report_profile(FILE *out, c8 *source_file)
+{
+    Profile profile;
+    memset(&profile, 0, sizeof(profile));
+    profile.map_file  = profile_path(source_file, ".cusmap");
+    profile.data_file = profile_path(source_file, ".cusprof");
+    if(read_profile_map(&profile)) return 1;
+
+    // Locations of an edited source no longer line up with the counters
+    u64 current_hash;
+    if(hash_file(source_file, &current_hash) && current_hash != profile.source_hash)
+        emit_error("Profile: Source changed since the profiled build, locations may be off", source_file, 0, 0);
+
+    u64 *counters = read_profile_counters(&profile);
+    if(!counters) {
+        sb_free(profile.sites);
+        return 1;
+    }
+
+    s32 count = sb_count(profile.sites);
+    Profile_Count *sorted = malloc((count ? count : 1) * sizeof(Profile_Count));
+    for(s32 i = 0; i < count; ++i) {
+        sorted[i].count = counters[i];
+        sorted[i].id    = i;
+    }
+    qsort(sorted, count, sizeof(Profile_Count), compare_counts);
+
+    fprintf(out, "%12s  %6s  %-5s  %s\n", "count", "id", "kind", "location");
+    for(s32 i = 0; i < count; ++i) {
+        Profile_Site *site = &profile.sites[sorted[i].id];
+        fprintf(out, "%12llu  %6i  %-5s  %s:%i:%i\n", (unsigned long long)sorted[i].count,
+                sorted[i].id, site_kind_names[site->kind], site->file, site->line, site->colm);
+    }
+
+    free(sorted);
+    free(counters);
+    sb_free(profile.sites);
+    return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdio.h>
+#include "Ast_Node.h"
+
+/*
+ * Execution counters
+ * A profiled build gives every block and call site of the program a slot
+ * in one counter array, bumped with a plain increment each time it runs.
+ * Counter ids are handed out in emission order and written to name.cusmap
+ * next to the source, along with each site's location. At exit the
+ * program writes name.cusprof:
+ *
+ *     u64 magic, u64 counter_count, u64 source_hash
+ *     u64 counters[counter_count]
+ *
+ * The source hash ties a profile to the map of the build that wrote it.
+ */
+
+#define PROFILE_MAGIC 0x464f525053554300ull // "\0CUSPROF"
+
+typedef enum Profile_Site_Kind {
+    PROFILE_BLOCK = 0,
+    PROFILE_CALL,
+} Profile_Site_Kind;
+
+typedef struct Profile_Site {
+    Profile_Site_Kind kind;
+    c8               *file;
+    s32               line;
+    s32               colm;
+} Profile_Site;
+
+typedef struct Profile {
+    c8           *map_file;
+    c8           *data_file;
+    u64           source_hash;
+    // Indexed by counter id
+    Profile_Site *sites;
+} Profile;
+
+/*
+ * Names the map and profile files of a source and hashes it, returns 0 if
+ * the source can't be read
+ */
+s32
+open_profile(Profile *profile, c8 *source_file);
+
+/*
+ * Returns the new site's counter id
+ */
+s32
+add_profile_site(Profile *profile, Profile_Site_Kind kind, Ast_Node *node);
+
+s32
+write_profile_map(Profile *profile);
+
+/*
+ * Prints every counter of a source's last profiled run with its location,
+ * hottest first. Returns the number of errors.
+ */
+s32
+report_profile(FILE *out, c8 *source_file);
+
+#endif
@@ -0,0 +1,108 @@
+
+#include <stdlib.h>
+
+#include "streaming.h"
+#include "Module.h"
+#include "Parser.h"
+#include "Symbol_Table.h"
+#include "Type_Table.h"
+#include "code_emission.h"
+#include "stretchy_buffer.h"
+
+typedef struct Stream_Compiler {
+    FILE          *out;
+    Token_Stream  *stream;
+    Symbol_Table   symbols;
+    Ast_Node     **globals;
+    s32            error_count;
+} Stream_Compiler;
+
+static void
+compile_statement(void *data, Ast_Node *statement)
+{
+    Stream_Compiler *compiler = data;
+
+    // Once the syntax is broken later statements are only parsed, as with
+    // parse_stream nothing gets resolved
+    if(compiler->stream->error_count) return;
+
+    // Later statements refer to top level declarations, they have to
+    // outlive the chain space of their own statement
+    if(statement->type == N_Declaration) {
+        Ast_Node *global = malloc(sizeof(Ast_Node));
+        *global = *statement;
+        sb_push(compiler->globals, global);
+        statement = global;
+    }
+
+    if(statement->type == N_Import && load_import(statement)) {
+        ++compiler->error_count;
+        return;
+    }
+
+    s32 resolve_errors = compiler->symbols.error_count;
+    resolve_node(&compiler->symbols, statement);
+    if(compiler->symbols.error_count != resolve_errors) return;
+
+    compiler->error_count += type_check(statement);
+    if(compiler->symbols.error_count || compiler->error_count) return;
+
+    emit_code_statement(compiler->out, statement);
+}
+
+static void
+pool_statement(void *data, Ast_Node *statement)
+{
+    (void)data;
+    pool_statement_strings(statement);
+}
+
+/*
+ * The string pool goes ahead of the code, so the file is parsed once
+ * before it is compiled to gather the literals that aren't specialized
+ * printf formats, a statement at a time. Errors are left for the
+ * compiling pass to report, the program won't be emitted whole then
+ * anyway.
+ */
+static void
+pool_file_strings(c8 *file_name)
+{
+    Token_Stream stream = {0};
+    stream.quiet = 1;
+    open_token_stream(&stream, file_name);
+    parse_stream_statements(&stream, pool_statement, 0);
+    if(stream.error_count) clear_string_pool();
+    close_token_stream(&stream);
+}
+
+s32
+stream_compile_file(FILE *out, c8 *file_name)
+{
+    Token_Stream stream = {0};
+    open_token_stream(&stream, file_name);
+
+    Stream_Compiler compiler = {0};
+    compiler.out    = out;
+    compiler.stream = &stream;
+
+    pool_file_strings(file_name);
+    emit_code_prologue(out);
+    enter_scope(&compiler.symbols);
+    parse_stream_statements(&stream, compile_statement, &compiler);
+    leave_scope(&compiler.symbols);
+    if(!stream.error_count) resolve_pending_gotos(&compiler.symbols);
+
+    s32 errors = stream.error_count + compiler.symbols.error_count + compiler.error_count;
+    if(!errors) emit_code_epilogue(out);
+    // Statements ahead of the error are already out, the C compiler must
+    // not take them for the whole program
+    else fputs("#error \"Compilation failed, this program is incomplete\"\n", out);
+    clear_string_pool();
+
+    close_token_stream(&stream);
+    free_symbol_table(&compiler.symbols);
+    for(s32 i = 0; i < sb_count(compiler.globals); ++i)
+        free(compiler.globals[i]);
+    sb_free(compiler.globals);
+    return errors;
+}
@@ -0,0 +1,21 @@
+#ifndef STREAMING_H_
+#define STREAMING_H_
+
+#include <stdio.h>
+#include "types.h"
+
+/*
+ * Constant memory compilation
+ * Each statement of the outer block is resolved, checked and emitted as
+ * soon as it has been parsed, then its tokens and nodes are released.
+ * Only top level declarations outlive their statement, so peak memory is
+ * bounded by the largest statement plus the global declarations. Output
+ * is identical to emit_code. If errors are found after the first
+ * statements have been written the output ends in an #error instead of
+ * the epilogue, and statements before a name error are type checked and
+ * may report more. Returns the number of errors.
+ */
+s32
+stream_compile_file(FILE *out, c8 *file_name);
+
+#endif